@@ -0,0 +1,491 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <malloc.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "malloc_free.h"
+#include "bench.h"
+
+/* Replays allocation traces against the allocator, or against the system malloc to compare, and reports throughput,
+latency percentiles, peak footprint and fragmentation.
+
+A trace is a text file with one event per line. Ids are any number naming a pointer, such as its address when the trace
+was recorded, and can be reused once freed.
+
+    m <id> <size>                   malloc
+    c <id> <size>                   calloc of one object
+    a <id> <alignment> <size>       aligned alloc
+    r <old id> <new id> <size>      realloc
+    f <id>                          free
+
+libmyalloc.so writes traces in this format when MYALLOC_TRACE is set. */
+
+// One event from a trace, with its ids turned into slots of a pointer table
+typedef struct event_t
+{
+    char op;
+    size_t slot;
+    size_t size;
+    size_t alignment;
+} event;
+
+#pragma region Trace
+
+// Maps the ids of live pointers to their slots with open addressing. Freed ids are left as tombstones.
+typedef struct id_table_t
+{
+    uint64_t *ids;
+    size_t *slots;
+    size_t capacity;
+} id_table;
+
+// Slot value of an empty entry and of a freed one
+#define EMPTY_SLOT SIZE_MAX
+#define FREED_SLOT (SIZE_MAX - 1)
+
+/* Returns the entry for the id, or the first entry it could be inserted at if it is not live. */
+size_t find_id(id_table *table, uint64_t id)
+{
+    size_t index = (id * 0x9E3779B97F4A7C15UL) & (table->capacity - 1);
+    size_t insert_at = EMPTY_SLOT;
+    while (table->slots[index] != EMPTY_SLOT)
+    {
+        if (table->slots[index] == FREED_SLOT)
+        {
+            insert_at = insert_at == EMPTY_SLOT ? index : insert_at;
+        }
+        else if (table->ids[index] == id)
+        {
+            return index;
+        }
+        index = (index + 1) & (table->capacity - 1);
+    }
+    return insert_at == EMPTY_SLOT ? index : insert_at;
+}
+
+/* Reads a trace, giving each live id a slot. Slots are reused once freed, so there are only as many as the most pointers
+live at once. Events that free an id that was never allocated are dropped, since the recording may have started after it
+was. Returns the number of events, or -1 if the file can't be read. */
+long read_trace(const char *path, event **events, size_t *num_slots)
+{
+    FILE *file = fopen(path, "r");
+    if (!file)
+    {
+        return -1;
+    }
+
+    size_t lines = 0;
+    for (int c = fgetc(file); c != EOF; c = fgetc(file))
+    {
+        lines += c == '\n';
+    }
+    rewind(file);
+
+    *events = malloc((lines + 1) * sizeof(event));
+    id_table table = {.capacity = 16};
+    while (table.capacity < 2 * lines)
+    {
+        table.capacity *= 2;
+    }
+    table.ids = malloc(table.capacity * sizeof(uint64_t));
+    table.slots = malloc(table.capacity * sizeof(size_t));
+    memset(table.slots, 0xFF, table.capacity * sizeof(size_t));
+
+    size_t *free_slots = malloc((lines + 1) * sizeof(size_t));
+    size_t num_free_slots = 0;
+    *num_slots = 0;
+
+    long num_events = 0;
+    char line[256];
+    while (fgets(line, sizeof(line), file))
+    {
+        event e = {.op = line[0]};
+        uint64_t id = 0;
+        uint64_t new_id = 0;
+        bool parsed = false;
+        switch (e.op)
+        {
+        case 'm':
+        case 'c':
+            parsed = sscanf(line + 1, "%" SCNu64 " %zu", &id, &e.size) == 2;
+            break;
+        case 'a':
+            parsed = sscanf(line + 1, "%" SCNu64 " %zu %zu", &id, &e.alignment, &e.size) == 3;
+            break;
+        case 'r':
+            parsed = sscanf(line + 1, "%" SCNu64 " %" SCNu64 " %zu", &id, &new_id, &e.size) == 3;
+            break;
+        case 'f':
+            parsed = sscanf(line + 1, "%" SCNu64, &id) == 1;
+            break;
+        }
+        if (!parsed)
+        {
+            continue;
+        }
+
+        size_t index = find_id(&table, id);
+        bool live = table.slots[index] < FREED_SLOT && table.ids[index] == id;
+
+        if (e.op == 'f' || e.op == 'r')
+        {
+            if (!live)
+            {
+                // Resizing something allocated before the recording started is as good as allocating it
+                if (e.op == 'f')
+                {
+                    continue;
+                }
+                e.op = 'm';
+                id = new_id;
+            }
+            else
+            {
+                e.slot = table.slots[index];
+                table.slots[index] = FREED_SLOT;
+                if (e.op == 'f')
+                {
+                    free_slots[num_free_slots++] = e.slot;
+                }
+                else
+                {
+                    // The new id takes over the slot, wherever realloc put it
+                    index = find_id(&table, new_id);
+                    table.ids[index] = new_id;
+                    table.slots[index] = e.slot;
+                }
+                (*events)[num_events++] = e;
+                continue;
+            }
+        }
+
+        // Allocations take a free slot, ignoring ids that are already live
+        index = find_id(&table, id);
+        if (table.slots[index] < FREED_SLOT && table.ids[index] == id)
+        {
+            continue;
+        }
+        e.slot = num_free_slots ? free_slots[--num_free_slots] : (*num_slots)++;
+        table.ids[index] = id;
+        table.slots[index] = e.slot;
+        (*events)[num_events++] = e;
+    }
+
+    fclose(file);
+    free(table.ids);
+    free(table.slots);
+    free(free_slots);
+    return num_events;
+}
+
+/* Writes a random trace of the given number of events to stdout. Mostly small sizes with some bigger ones, and a mix of
+short and long lived pointers. */
+void generate_trace(size_t num_events)
+{
+    size_t live[4096];
+    size_t num_live = 0;
+    size_t next_id = 1;
+    unsigned int seed = 1;
+
+    for (size_t i = 0; i < num_events; i++)
+    {
+        int roll = rand_r(&seed) % 100;
+        size_t size = rand_r(&seed) % 10 ? 1 + rand_r(&seed) % 256 : 1 + rand_r(&seed) % 16384;
+
+        if (num_live && (roll < 45 || num_live == 4096))
+        {
+            // Newer pointers are more likely to die first
+            size_t pick = num_live - 1 - (rand_r(&seed) % num_live) * (rand_r(&seed) % num_live) / num_live;
+            printf("f %zu\n", live[pick]);
+            live[pick] = live[--num_live];
+        }
+        else if (num_live && roll < 55)
+        {
+            size_t pick = rand_r(&seed) % num_live;
+            printf("r %zu %zu %zu\n", live[pick], next_id, size);
+            live[pick] = next_id++;
+        }
+        else
+        {
+            char op = roll < 60 ? 'c' : 'm';
+            printf("%c %zu %zu\n", op, next_id, size);
+            live[num_live++] = next_id++;
+        }
+    }
+}
+
+#pragma endregion Trace
+
+#pragma region Replay
+
+// File the heap map is written to every map_every events with -m, or -1 when not writing one
+static int map_fd = -1;
+static size_t map_every;
+
+/* Returns the time in nanoseconds from a monotonic clock. */
+uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Returns what glibc has mapped for its heaps and its mmapped chunks. */
+size_t glibc_footprint()
+{
+    struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+}
+
+int compare_latencies(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Makes the call for one event and returns the pointer it gave, or NULL for a free. */
+void *apply_event(allocator *alloc, event *e, void **slots)
+{
+    switch (e->op)
+    {
+    case 'm':
+        return alloc->malloc(e->size);
+    case 'c':
+        return alloc->calloc(1, e->size);
+    case 'a':
+        return alloc->aligned_alloc(e->alignment, e->size);
+    case 'r':
+        return alloc->realloc(slots[e->slot], e->size);
+    case 'f':
+        alloc->free(slots[e->slot]);
+        break;
+    }
+    return NULL;
+}
+
+/* Frees every pointer left in the slots and clears them, leaving the allocator empty. */
+void free_slots(allocator *alloc, void **slots, size_t num_slots)
+{
+    for (size_t i = 0; i < num_slots; i++)
+    {
+        alloc->free(slots[i]);
+        slots[i] = NULL;
+    }
+}
+
+/* Replays the events with nothing around the calls and returns how long it took in nanoseconds. */
+uint64_t time_events(allocator *alloc, event *events, size_t num_events, void **slots, size_t num_slots)
+{
+    uint64_t start = now();
+    for (size_t i = 0; i < num_events; i++)
+    {
+        void *ptr = apply_event(alloc, &events[i], slots);
+        // A failed realloc leaves the old pointer alone
+        if (ptr || events[i].op == 'f')
+        {
+            slots[events[i].slot] = ptr;
+        }
+    }
+    uint64_t elapsed = now() - start;
+    free_slots(alloc, slots, num_slots);
+    return elapsed;
+}
+
+/* Replays the events against the allocator and prints the results. The first pass times each event on its own and checks
+the footprint after every allocation. Reading the clock twice an event and mallinfo2 for glibc cost about as much as the
+calls, so the throughput comes from a second pass that makes only the calls, on the heap the first one left behind. */
+void replay(allocator *alloc, event *events, size_t num_events, size_t num_slots)
+{
+    if (!num_events)
+    {
+        printf("The trace has no events\n");
+        return;
+    }
+
+    void **slots = calloc(num_slots + 1, sizeof(void *));
+    size_t *sizes = calloc(num_slots + 1, sizeof(size_t));
+    uint64_t *latencies = malloc((num_events + 1) * sizeof(uint64_t));
+    size_t live_bytes = 0;
+    size_t peak_live_bytes = 0;
+    size_t peak_footprint = 0;
+    size_t live_at_peak_footprint = 0;
+    size_t failed = 0;
+
+    for (size_t i = 0; i < num_events; i++)
+    {
+        event *e = &events[i];
+        uint64_t before = now();
+        void *ptr = apply_event(alloc, e, slots);
+        latencies[i] = now() - before;
+
+        if (map_fd >= 0 && (i + 1) % map_every == 0)
+        {
+            export_heap_map(map_fd);
+        }
+
+        // A failed realloc leaves the old pointer alone
+        if (!ptr && e->op != 'f')
+        {
+            failed++;
+            continue;
+        }
+
+        live_bytes -= sizes[e->slot];
+        sizes[e->slot] = e->op == 'f' ? 0 : e->size;
+        slots[e->slot] = ptr;
+        if (e->op == 'f')
+        {
+            continue;
+        }
+
+        live_bytes += e->size;
+        peak_live_bytes = live_bytes > peak_live_bytes ? live_bytes : peak_live_bytes;
+        size_t footprint = alloc->footprint();
+        if (footprint > peak_footprint)
+        {
+            peak_footprint = footprint;
+            live_at_peak_footprint = live_bytes;
+        }
+    }
+    free_slots(alloc, slots, num_slots);
+    uint64_t elapsed = time_events(alloc, events, num_events, slots, num_slots);
+
+    qsort(latencies, num_events, sizeof(uint64_t), compare_latencies);
+    double percentiles[] = {50, 90, 99, 99.9};
+
+    printf("Allocator: %s\n", alloc->name);
+    printf("Events: %zu (%zu failed)\n", num_events, failed);
+    printf("Throughput: %.0f ops/sec\n", num_events / (elapsed / 1e9));
+    for (size_t i = 0; i < 4; i++)
+    {
+        printf("p%g latency: %" PRIu64 " ns\n", percentiles[i], latencies[(size_t)(num_events * percentiles[i] / 100)]);
+    }
+    printf("Max latency: %" PRIu64 " ns\n", num_events ? latencies[num_events - 1] : 0);
+    printf("Peak live bytes: %zu\n", peak_live_bytes);
+    printf("Peak footprint: %zu bytes\n", peak_footprint);
+    // How much of the memory mapped at the peak was not holding anything the program asked for
+    printf("Fragmentation at peak footprint: %.1f%%\n", peak_footprint ? 100.0 * (peak_footprint - live_at_peak_footprint) / peak_footprint : 0);
+
+    free(slots);
+    free(sizes);
+    free(latencies);
+}
+
+#pragma endregion Replay
+
+void show_usage()
+{
+    printf("Usage:\n");
+    printf("bench.exe <trace> [allocator] [-H] [-c <options>] [-m <events> <file>] - replays a trace against segregated, first, next, best or worst fit, or glibc\n");
+    printf("    -H hardens the heap to measure what the checks cost\n");
+    printf("    -c sets heap options in the same format as %s, like heap_size:64k,defer_coalescing:true\n", HEAP_OPTIONS_ENV);
+    printf("    -m writes the heap map as a line of JSON to the file every so many events, to plot fragmentation over time\n");
+    printf("bench.exe generate <events> - writes a random trace to stdout\n");
+}
+
+int main(int argc, char const *argv[])
+{
+    if (argc < 2)
+    {
+        show_usage();
+        return 1;
+    }
+
+    if (!strcmp(argv[1], "generate") && argc > 2)
+    {
+        generate_trace(strtoul(argv[2], NULL, 10));
+        return 0;
+    }
+
+    event *events;
+    size_t num_slots;
+    long num_events = read_trace(argv[1], &events, &num_slots);
+    if (num_events < 0)
+    {
+        printf("Could not read trace %s\n", argv[1]);
+        return 1;
+    }
+
+    const char *which = policy_names[SEGREGATED_FIT];
+    const char *map_path = NULL;
+    const char *conf = NULL;
+    for (int i = 2; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-H"))
+        {
+            harden_heap = true;
+        }
+        else if (!strcmp(argv[i], "-m") && i + 2 < argc && strtoul(argv[i + 1], NULL, 10))
+        {
+            map_every = strtoul(argv[++i], NULL, 10);
+            map_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            conf = argv[++i];
+        }
+        else if (argv[i][0] != '-')
+        {
+            which = argv[i];
+        }
+        else
+        {
+            show_usage();
+            return 1;
+        }
+    }
+
+    allocator alloc = {which, my_malloc, my_free, my_calloc, my_realloc, my_aligned_alloc, heap_footprint};
+    if (!strcmp(which, "glibc"))
+    {
+        alloc = (allocator){which, malloc, free, calloc, realloc, aligned_alloc, glibc_footprint};
+    }
+    else
+    {
+        placement_policy policy = 0;
+        while (policy < NUM_POLICIES && strcmp(which, policy_names[policy]))
+        {
+            policy++;
+        }
+        if (policy == NUM_POLICIES)
+        {
+            show_usage();
+            return 1;
+        }
+        heap_options options;
+        get_heap_options(&options);
+        options.policy = policy;
+        if (!parse_heap_options(&options, conf))
+        {
+            printf("Bad heap options %s\n", conf);
+            return 1;
+        }
+        init_heap_with_options(&options);
+    }
+
+    // Only this allocator's arenas can be mapped
+    if (map_path && strcmp(which, "glibc"))
+    {
+        map_fd = open(map_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (map_fd < 0)
+        {
+            printf("Could not open %s\n", map_path);
+            return 1;
+        }
+    }
+
+    replay(&alloc, events, num_events, num_slots);
+    free(events);
+    if (map_fd >= 0)
+    {
+        close(map_fd);
+    }
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#if !defined(BENCH_H)
+#define BENCH_H
+
+#include <stddef.h>
+
+// The functions of an allocator being measured, so the benchmarks can run the same code against the system malloc
+typedef struct allocator_t
+{
+    const char *name;
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*calloc)(size_t count, size_t size);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*aligned_alloc)(size_t alignment, size_t size);
+    size_t (*footprint)();
+} allocator;
+
+#endif // BENCH_H
\ No newline at end of file
@@ -1,423 +1,814 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
-#include <inttypes.h>
-#include <assert.h>
-
-#include "main.h"
-#include "malloc_free.h"
-#include "tests.h"
-
-#pragma region Helpers
-
-/* Take an integer and print it in constant size format [* prefix:    number *] */
-void print_formatted(char *prefix, uint64_t number)
-{
-    size_t format_size = strlen("***********************");
-    char num_string[20];
-    sprintf(num_string, "%ld", number);
-    int spaces = (format_size - 4) - strlen(num_string) - strlen(prefix);
-
-    char formatted[50] = {0};
-
-    formatted[0] = '*';
-    formatted[1] = ' ';
-    strcat(formatted, prefix);
-    for (size_t i = 0; i < spaces; i++)
-    {
-        strcat(formatted, " ");
-    }
-    strcat(formatted, num_string);
-    strcat(formatted, " *");
-
-    printf("%s\n", formatted);
-}
-
-/* Walks through free list and prints out info */
-void walk_free_list()
-{
-    printf("Walking through free list...\n");
-
-    node *curr = free_list_head;
-    int num_free_chunks = 0;
-
-    printf("%p\n", curr);
-
-    while (curr)
-    {
-        num_free_chunks++;
-        printf("Free chunk at address %ld with size %ld and next %ld\n", (uint64_t)curr - offset, (uint64_t)curr->size, curr->next ? (uint64_t)curr->next - offset : 0);
-        curr = curr->next;
-    }
-    printf("There %s %d free chunk%s\n", num_free_chunks == 1 ? "is" : "are", num_free_chunks, num_free_chunks == 1 ? "" : "s");
-}
-
-/* Walks through allocated chunks and prints out info */
-void walk_allocated_chunks()
-{
-    printf("Walking through allocated chunks...\n");
-
-    void *address = heap_pointer;
-    node *last_free = free_list_head;
-
-    int num_allocated_chunks = 0;
-
-    while (address < heap_pointer + HEAP_SIZE)
-    {
-        // If it is free
-        // check if it is in free list
-        if (address == last_free)
-        {
-            node *chunk = (node *)address;
-
-            // next free chunk
-            last_free = last_free->next;
-            // next chunk
-            address += (chunk->size + sizeof(node));
-        }
-        // else it must be allocated
-        else
-        {
-            header *chunk = (header *)address;
-            // check magic number is right
-            assert(chunk->magic == MAGIC_NUMBER);
-
-            num_allocated_chunks++;
-
-            // print out allocated chunk info
-            printf("Allocated chunk at address %ld with size %ld and magic %d\n", (uint64_t)chunk - offset, chunk->size, chunk->magic);
-
-            // next chunk
-            address += (chunk->size + sizeof(header));
-        }
-    }
-    printf("There %s %d allocated chunk%s\n", num_allocated_chunks == 1 ? "is" : "are", num_allocated_chunks, num_allocated_chunks == 1 ? "" : "s");
-}
-
-/* Walk through heap and print everything in an ascii diagram. Verifies all memory is accounted for.*/
-void audit()
-{
-    printf("\n================\n");
-    printf("==  AUDITING  ==\n");
-    printf("================\n");
-
-    printf("Heap start: %ld\n", (uint64_t)heap_pointer - offset);
-    printf("Heap size: %ld\n", HEAP_SIZE);
-    printf("Free list start: %ld\n\n", (uint64_t)free_list_head - offset);
-
-    // WALK BY CHUNK
-    // SIMULTANEOUSLY WALK FREE LIST WHEN FINDING A FREE CHUNK
-
-    void *address = heap_pointer;
-    node *last_free = free_list_head;
-
-    int num_allocated_chunks = 0;
-    int num_free_chunks = 0;
-
-    while (address < heap_pointer + HEAP_SIZE)
-    {
-        // Check for alignment
-        assert(((uint64_t)address - offset) % 8 == 0);
-
-        // If it is free
-        // check if it is in free list
-        if (address == last_free)
-        {
-            num_free_chunks++;
-            node *chunk = (node *)address;
-
-            // print data
-            printf("***********************\n");
-            printf("*      FREE CHUNK     *\n");
-            print_formatted("Address: ", (uint64_t)address - offset);
-            printf("***********************\n");
-            print_formatted("Size: ", (uint64_t)chunk->size);
-            print_formatted("Next: ", chunk->next ? (uint64_t)chunk->next - offset : 0);
-            printf("*                     *\n");
-            printf("***********************\n");
-
-            // next free chunk
-            last_free = last_free->next;
-            // next chunk
-            address += (chunk->size + sizeof(node));
-        }
-        // else it must be allocated
-        else
-        {
-            num_allocated_chunks++;
-            header *chunk = (header *)address;
-            // check magic number is right
-            assert(chunk->magic == MAGIC_NUMBER);
-
-            // print data
-            printf("***********************\n");
-            printf("*   ALLOCATED CHUNK   *\n");
-            print_formatted("Address: ", (uint64_t)address - offset);
-            printf("***********************\n");
-            print_formatted("Size: ", chunk->size);
-            print_formatted("Magic: ", chunk->magic);
-            printf("*                     *\n");
-            printf("***********************\n");
-
-            // next chunk
-            address += (chunk->size + sizeof(header));
-        }
-        // Make it more legible
-        if (address < heap_pointer + HEAP_SIZE)
-        {
-            printf("        |    |        \n");
-            printf("        |    |        \n");
-        }
-    }
-
-    assert((uint64_t)address - offset == HEAP_SIZE);
-    printf("Accounted for %ld of %ld bytes in heap\n", (uint64_t)address - offset, HEAP_SIZE);
-    printf("There %s %d allocated chunk%s\n", num_allocated_chunks == 1 ? "is" : "are", num_allocated_chunks, num_allocated_chunks == 1 ? "" : "s");
-    printf("There %s %d free chunk%s\n\n", num_free_chunks == 1 ? "is" : "are", num_free_chunks, num_free_chunks == 1 ? "" : "s");
-}
-
-#pragma endregion Helpers
-
-#pragma region Shell
-
-/* NOT USED. Walks through the heap till finding an allocated chunk at the specified index. Prints an error message if there is no such allocated chunk. */
-void free_at_index(int index)
-{
-    // Return if index is less than 1
-    if (index < 1)
-    {
-        printf("Index must be at least 1\n");
-        return;
-    }
-
-    // WALK BY CHUNK
-    // SIMULTANEOUSLY WALK FREE LIST WHEN FINDING A FREE CHUNK
-
-    void *address = heap_pointer;
-    node *last_free = free_list_head;
-
-    int allocated_chunk_index = 0;
-
-    while (address < heap_pointer + HEAP_SIZE)
-    {
-        // If it is free
-        // check if it is in free list
-        if (address == last_free)
-        {
-            node *chunk = (node *)address;
-
-            // next free chunk
-            last_free = last_free->next;
-            // next chunk
-            address += (chunk->size + sizeof(node));
-        }
-        // else it must be allocated
-        else
-        {
-            header *chunk = (header *)address;
-            // check magic number is right
-            assert(chunk->magic == MAGIC_NUMBER);
-
-            allocated_chunk_index++;
-            // If this is the index to free then break out of loop
-            if (allocated_chunk_index == index)
-                break;
-
-            // next chunk
-            address += (chunk->size + sizeof(header));
-        }
-    }
-
-    if (index > allocated_chunk_index)
-    {
-        printf("Index is greater than the number of allocated chunks!\n");
-        printf("There are only %d allocated chunks\n", allocated_chunk_index);
-    }
-    else
-    {
-        printf("Freeing allocated chunk at index %d\n", allocated_chunk_index);
-        printf("Freeing allocated chunk at address %ld\n", (uint64_t)address - offset);
-
-        my_free(address + sizeof(header));
-    }
-}
-
-/* Show a list of commands for the interactive shell. */
-void show_commands()
-{
-    printf("\naudit - Audits the heap and displays it in diagram format\n");
-    printf("walk free - Walks through the free list and prints out info\n");
-    printf("walk allocated - Walks through the allocated chunks and prints out info\n");
-    printf("malloc - Allocates a chunk of a user specified size\n");
-    printf("free - Frees the allocated chunk at the address specified by the user\n");
-    printf("test - Select a test to run\n");
-    printf("reset - Clears the heap of allocated chunks\n");
-    printf("help - Displays this list of commands\n");
-    printf("quit - End the session\n\n");
-}
-
-/* Show the available tests. */
-void show_tests()
-{
-    printf("             AVAILABLE TESTS             \n");
-    printf("=========================================\n");
-    printf("Please note: running a test will clear the heap\n\n");
-    printf("all - run all tests in below order\n");
-    printf("reuse - run free chunk reuse tests\n");
-    printf("sorted - run sorted free list tests\n");
-    printf("splitting - run splitting free chunks tests\n");
-    printf("coalescing - run coalescing tests\n");
-    printf("alternating - run alternating sequence tests\n");
-    printf("fit - run worst fit tests\n");
-    printf("return - run malloc bad value tests\n\n");
-}
-
-/* Run the selected test. */
-void select_test(char *which)
-{
-    if (!strcmp(which, "all"))
-    {
-        test_all();
-    }
-    else if (!strcmp(which, "reuse"))
-    {
-        test_free_chunk_reuse();
-    }
-    else if (!strcmp(which, "sorted"))
-    {
-        test_sorted_free_list();
-    }
-    else if (!strcmp(which, "splitting"))
-    {
-        test_splitting_free_chunks();
-    }
-    else if (!strcmp(which, "coalescing"))
-    {
-        test_coalesce();
-    }
-    else if (!strcmp(which, "alternating"))
-    {
-        test_alternating_sequence();
-    }
-    else if (!strcmp(which, "fit"))
-    {
-        test_worst_fit();
-    }
-    else if (!strcmp(which, "return"))
-    {
-        test_malloc_bad_size();
-    }
-    else
-    {
-        printf("Unrecognized test selection. Type 'test' to see the list of available tests\n");
-    }
-}
-
-/* Start the interactive shell */
-void start_shell()
-{
-    char command[100];
-
-    show_commands();
-
-    while (strcmp(command, "quit"))
-    {
-        printf("> ");
-        scanf("%s", command);
-
-        // Which commands to execute
-        if (!strcmp(command, "audit"))
-        {
-            audit();
-        }
-        else if (!strcmp(command, "walk"))
-        {
-            char which[20];
-            scanf("%s", which);
-            if (!strcmp(which, "free"))
-            {
-                walk_free_list();
-            }
-            else if (!strcmp(which, "allocated"))
-            {
-                walk_allocated_chunks();
-            }
-            else
-            {
-                printf("Invalid command for 'walk'. Use 'free' or 'allocated'\n");
-            }
-        }
-        else if (!strcmp(command, "malloc"))
-        {
-            int size = 0;
-            printf("Size of chunk to allocate: ");
-            scanf("%d", &size);
-            printf("You requested to allocate a chunk of size %d\n", size);
-            my_malloc(size);
-        }
-        else if (!strcmp(command, "free"))
-        {
-            int address = -1;
-            printf("Address of allocated chunk to free (address displayed in audit): ");
-            scanf("%d", &address);
-            printf("You requested to free allocated chunk at address %d\n", address);
-
-            // Make sure it is valid
-            if (address < 0 || address + sizeof(header) > HEAP_SIZE)
-            {
-                printf("That address is not valid\n");
-                continue;
-            }
-
-            header *chunk = (header *)(address + offset);
-            if (chunk->magic == MAGIC_NUMBER)
-            {
-                my_free(chunk + 1);
-                printf("Freed chunk at address %d\n", address);
-            }
-            else
-            {
-                printf("No allocated chunk found at address %d\n", address);
-                printf("Try using 'audit' or 'walk allocated' to see the addresses of allocated chunks\n");
-            }
-        }
-        else if (!strcmp(command, "test"))
-        {
-            show_tests();
-            char which[20];
-            printf("Which test to run: ");
-            scanf("%s", which);
-            select_test(which);
-        }
-        else if (!strcmp(command, "reset"))
-        {
-            free_all_chunks();
-        }
-        else if (!strcmp(command, "help"))
-        {
-            show_commands();
-        }
-        else if (strcmp(command, "quit"))
-        {
-            printf("Unrecognized command. Type 'help' to see the list of commands.\n");
-        }
-    }
-    printf("\nSession ended\n");
-}
-
-#pragma endregion Shell
-
-int main(int argc, char const *argv[])
-{
-    init_heap();
-    init_tests();
-
-    if (argv[1])
-    {
-        test_all();
-    }
-    else
-    {
-        start_shell();
-    }
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "malloc_free.h"
+#include "slab.h"
+#include "tests.h"
+
+#pragma region Helpers
+
+/* Take an integer and print it in constant size format [* prefix:    number *] */
+void print_formatted(char *prefix, uint64_t number)
+{
+    size_t format_size = strlen("***********************");
+    char num_string[20];
+    sprintf(num_string, "%ld", number);
+    // Long numbers, like addresses far below the start of the heap, push the box out instead of overflowing it
+    int spaces = (int)(format_size - 4) - (int)strlen(num_string) - (int)strlen(prefix);
+
+    char formatted[64] = {0};
+
+    formatted[0] = '*';
+    formatted[1] = ' ';
+    strcat(formatted, prefix);
+    for (int i = 0; i < spaces; i++)
+    {
+        strcat(formatted, " ");
+    }
+    strcat(formatted, num_string);
+    strcat(formatted, " *");
+
+    printf("%s\n", formatted);
+}
+
+/* Walks through free list and prints out info */
+void walk_free_list()
+{
+    printf("Walking through free list...\n");
+
+    int num_free_chunks = 0;
+
+    for (size_t a = 0; a < active_arenas; a++)
+    {
+        if (active_arenas > 1 && arenas[a].regions)
+        {
+            printf("Arena %ld:\n", a);
+        }
+
+        node *curr = arenas[a].free_list_head;
+
+        while (curr)
+        {
+            num_free_chunks++;
+            printf("Free chunk at address %ld with size %ld and next %ld\n", (uint64_t)curr - offset, stored_size(curr), free_chunk_next(curr) ? (uint64_t)free_chunk_next(curr) - offset : 0);
+            curr = free_chunk_next(curr);
+        }
+
+        // Segregated fit keeps its free chunks in bins instead
+        for (size_t i = 0; i < NUM_BINS; i++)
+        {
+            if (arenas[a].bins[i])
+            {
+                printf("Bin %ld:\n", i);
+            }
+            for (curr = arenas[a].bins[i]; curr; curr = free_chunk_next(curr))
+            {
+                num_free_chunks++;
+                printf("Free chunk at address %ld with size %ld and next %ld\n", (uint64_t)curr - offset, stored_size(curr), free_chunk_next(curr) ? (uint64_t)free_chunk_next(curr) - offset : 0);
+            }
+        }
+    }
+    printf("There %s %d free chunk%s\n", num_free_chunks == 1 ? "is" : "are", num_free_chunks, num_free_chunks == 1 ? "" : "s");
+}
+
+/* Returns true if an allocated chunk that is not in a thread cache starts at the address. Headers have nothing to tell them
+apart from any other data, so this walks the region up to the address. */
+bool is_allocated_chunk(void *address)
+{
+    region *r = find_region(address);
+    if (!r)
+    {
+        return false;
+    }
+
+    void *chunk = region_start(r);
+    while (chunk < address)
+    {
+        chunk += chunk_size(chunk);
+    }
+    return chunk == address && !chunk_is_free(chunk) && !chunk_is_cached(chunk);
+}
+
+/* Walks through allocated chunks and prints out info */
+void walk_allocated_chunks()
+{
+    printf("Walking through allocated chunks...\n");
+
+    int num_allocated_chunks = 0;
+
+    for (size_t a = 0; a < active_arenas; a++)
+    {
+        for (region *r = arenas[a].regions; r; r = r->next)
+        {
+            for (void *address = region_start(r); address < (void *)r; address += chunk_size(address))
+            {
+                // If it is not free or cached it must be allocated
+                if (!chunk_is_free(address) && !chunk_is_cached(address))
+                {
+                    header *chunk = (header *)address;
+                    // check magic number is right
+                    CHECK_MAGIC(chunk);
+
+                    num_allocated_chunks++;
+
+                    // print out allocated chunk info
+                    printf("Allocated chunk at address %ld with size %ld\n", (uint64_t)chunk - offset, stored_size(chunk));
+                }
+            }
+        }
+    }
+    printf("There %s %d allocated chunk%s\n", num_allocated_chunks == 1 ? "is" : "are", num_allocated_chunks, num_allocated_chunks == 1 ? "" : "s");
+}
+
+/* Checks a subtree of the size tree is in order and balanced, counting its chunks and keeping the first chunk of the last
+size seen. Returns its black height. */
+static int audit_size_tree(tree_node *n, tree_node **last, tree_node **first_of_size, size_t *count)
+{
+    if (!n)
+    {
+        return 1;
+    }
+    // Children must point back at their parent, and a red node can't have a red child
+    assert(!n->left || n->left->parent == n);
+    assert(!n->right || n->right->parent == n);
+    assert(!n->red || ((!n->left || !n->left->red) && (!n->right || !n->right->red)));
+
+    int left_height = audit_size_tree(n->left, last, first_of_size, count);
+    // Chunks are ordered by size and then by address
+    assert(chunk_is_free(n) && chunk_size(n) >= TREE_MIN_CHUNK);
+    assert(!*last || chunk_size(*last) < chunk_size(n) || (chunk_size(*last) == chunk_size(n) && *last < n));
+    if (!*last || chunk_size(*last) != chunk_size(n))
+    {
+        *first_of_size = n;
+    }
+    *last = n;
+    (*count)++;
+    int right_height = audit_size_tree(n->right, last, first_of_size, count);
+
+    // Every path down has the same number of black nodes
+    assert(left_height == right_height);
+    return left_height + !n->red;
+}
+
+/* Walk through an arena and print everything in an ascii diagram. Verifies all its memory is accounted for.*/
+void audit_arena(arena *a)
+{
+    size_t heap_size = 0;
+    int num_regions = 0;
+    for (region *r = a->regions; r; r = r->next)
+    {
+        heap_size += r->size;
+        num_regions++;
+    }
+
+    printf("Heap start: %ld\n", (uint64_t)a->heap_pointer - offset);
+    printf("Heap size: %ld in %d region%s\n", heap_size, num_regions, num_regions == 1 ? "" : "s");
+    printf("Free list start: %ld\n\n", (uint64_t)a->free_list_head - offset);
+
+    // WALK BY CHUNK, ONE REGION AT A TIME
+    // SIMULTANEOUSLY WALK FREE LIST WHEN FINDING A FREE CHUNK IF IT IS SORTED
+
+    node *last_free = a->free_list_head;
+    size_t accounted = 0;
+    size_t free_space = 0;
+
+    int num_allocated_chunks = 0;
+    int num_free_chunks = 0;
+    size_t treed_chunks = 0;
+
+    for (region *r = a->regions; r; r = r->next)
+    {
+        // Regions are kept in address order
+        assert(r->next == NULL || r->next > r);
+
+        if (num_regions > 1)
+        {
+            printf("=======================\n");
+            printf("*        REGION       *\n");
+            print_formatted("Address: ", (uint64_t)region_start(r) - offset);
+            print_formatted("Size: ", r->size);
+            printf("=======================\n");
+        }
+
+        void *address = region_start(r);
+        bool prev_free = false;
+
+        while (address < (void *)r)
+        {
+            // Check for alignment
+            assert(((uint64_t)address - offset) % 8 == 0);
+            // Check the boundary tag bit agrees with the chunk before
+            assert(((((header *)address)->size_flags & PREV_FREE) != 0) == prev_free);
+
+            // If it is free
+            if (chunk_is_free(address))
+            {
+                num_free_chunks++;
+                node *chunk = (node *)address;
+                free_space += chunk_size(chunk);
+
+                // Free chunks should have been coalesced
+                assert(!prev_free);
+                // Footer must match the size in the node
+                assert(*chunk_footer(chunk) == stored_size(chunk));
+                // A sorted free list is walked alongside the heap
+                if (fit_policy != SEGREGATED_FIT && !lifo_free_list)
+                {
+                    assert(address == last_free);
+                    last_free = free_chunk_next(last_free);
+                }
+                treed_chunks++;
+
+                // print data
+                printf("***********************\n");
+                printf("*      FREE CHUNK     *\n");
+                print_formatted("Address: ", (uint64_t)address - offset);
+                printf("***********************\n");
+                print_formatted("Size: ", stored_size(chunk));
+                print_formatted("Next: ", free_chunk_next(chunk) ? (uint64_t)free_chunk_next(chunk) - offset : 0);
+                printf("*                     *\n");
+                printf("***********************\n");
+
+                // next chunk
+                address += chunk_size(chunk);
+                prev_free = true;
+            }
+            // else it must be allocated
+            else
+            {
+                num_allocated_chunks++;
+                header *chunk = (header *)address;
+                // check magic number is right
+                CHECK_MAGIC(chunk);
+                // The chunk must point back to this arena
+                assert(chunk_arena(chunk) == a);
+
+                // print data
+                printf("***********************\n");
+                printf(chunk_is_cached(chunk) ? "*     CACHED CHUNK    *\n" : "*   ALLOCATED CHUNK   *\n");
+                print_formatted("Address: ", (uint64_t)address - offset);
+                printf("***********************\n");
+                print_formatted("Size: ", stored_size(chunk));
+#if defined(HEAP_DEBUG)
+                print_formatted("Magic: ", chunk->magic);
+#endif
+                printf("*                     *\n");
+                printf("***********************\n");
+
+                // next chunk
+                address += chunk_size(chunk);
+                prev_free = false;
+            }
+            // Make it more legible
+            if (address < (void *)r)
+            {
+                printf("        |    |        \n");
+                printf("        |    |        \n");
+            }
+        }
+
+        // Last chunk must end exactly at the fence, which is never free
+        assert(address == (void *)r);
+        assert(!chunk_is_free(&r->fence) && (r->fence.size_flags & REGION_FENCE));
+        assert(((r->fence.size_flags & PREV_FREE) != 0) == prev_free);
+        accounted += address - region_start(r);
+    }
+
+    assert(accounted == heap_size);
+    assert(a->mapped_bytes == heap_size + num_regions * sizeof(region));
+    // The running count of free space must match what was found
+    assert(free_space == a->free_bytes);
+
+    // Every free chunk found in the heap must be in the free list or a bin and nothing else
+    int free_list_length = 0;
+    for (node *curr = a->free_list_head; curr; curr = free_chunk_next(curr))
+    {
+        assert(chunk_is_free(curr));
+        assert(free_chunk_next(curr) == NULL || free_chunk_next(curr)->prev == curr);
+        free_list_length++;
+    }
+    // Each bin must only hold chunks of its size class, and be marked in the bitmap if it has any
+    for (size_t i = 0; i < NUM_BINS; i++)
+    {
+        assert(!a->bins[i] == !(a->bin_bitmap & (1UL << i)));
+        for (node *curr = a->bins[i]; curr; curr = free_chunk_next(curr))
+        {
+            assert(chunk_is_free(curr));
+            assert(bin_index(chunk_size(curr)) == i);
+            assert(free_chunk_next(curr) == NULL || free_chunk_next(curr)->prev == curr);
+            free_list_length++;
+        }
+    }
+    assert(free_list_length == num_free_chunks);
+    // So must the running count of free chunks
+    assert(a->free_chunks == (size_t)num_free_chunks);
+
+    // Quick lists only hold cached chunks of this arena and their own size, and their running total must match
+    size_t quick_bytes = 0;
+    for (size_t i = 0; i < SMALL_BINS; i++)
+    {
+        for (header *curr = a->quick_lists[i]; curr; curr = cache_next(curr))
+        {
+            assert(chunk_is_cached(curr) && chunk_arena(curr) == a);
+            assert(chunk_size(curr) == i * ALIGN_TO);
+            quick_bytes += chunk_size(curr);
+        }
+    }
+    assert(quick_bytes == a->quick_bytes);
+    // The walk a batch of frees picks up from is only kept while the batch holds the lock
+    assert(!a->insert_hint);
+    // Arenas are only bound to a node with by node assignment, and then arena i is on node i % numa_nodes
+    assert(arena_policy == BY_NODE ? a->node == (int)(a->index % numa_nodes) : a->node == -1);
+
+    // Best and worst fit also keep every free chunk big enough in the size tree, and count the rest
+    if (fit_policy == BEST_FIT || fit_policy == WORST_FIT)
+    {
+        assert(!a->size_tree || (!a->size_tree->parent && !a->size_tree->red));
+        tree_node *last = NULL;
+        tree_node *biggest = NULL;
+        size_t tree_count = 0;
+        audit_size_tree(a->size_tree, &last, &biggest, &tree_count);
+        assert(tree_count == treed_chunks);
+        // The biggest chunk is the first of the last size in order
+        assert(a->largest == biggest);
+    }
+
+    printf("Accounted for %ld of %ld bytes in heap\n", accounted, heap_size);
+    printf("There %s %d allocated chunk%s\n", num_allocated_chunks == 1 ? "is" : "are", num_allocated_chunks, num_allocated_chunks == 1 ? "" : "s");
+    printf("There %s %d free chunk%s\n\n", num_free_chunks == 1 ? "is" : "are", num_free_chunks, num_free_chunks == 1 ? "" : "s");
+}
+
+/* Audits every arena that has been used. */
+void audit()
+{
+    printf("\n================\n");
+    printf("==  AUDITING  ==\n");
+    printf("================\n");
+
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        // Arenas only get memory once a thread uses them
+        if (!arenas[i].regions)
+        {
+            continue;
+        }
+        if (active_arenas > 1)
+        {
+            printf("Arena %ld\n", i);
+        }
+        audit_arena(&arenas[i]);
+    }
+}
+
+#pragma endregion Helpers
+
+#pragma region Shell
+
+/* NOT USED. Walks through the heap till finding an allocated chunk at the specified index. Prints an error message if there is no such allocated chunk. */
+void free_at_index(int index)
+{
+    // Return if index is less than 1
+    if (index < 1)
+    {
+        printf("Index must be at least 1\n");
+        return;
+    }
+
+    // WALK BY CHUNK
+
+    void *address = NULL;
+
+    int allocated_chunk_index = 0;
+
+    for (size_t a = 0; a < active_arenas && allocated_chunk_index < index; a++)
+    {
+        for (region *r = arenas[a].regions; r && allocated_chunk_index < index; r = r->next)
+        {
+            for (address = region_start(r); address < (void *)r; address += chunk_size(address))
+            {
+                // If it is not free or cached it must be allocated
+                if (!chunk_is_free(address) && !chunk_is_cached(address))
+                {
+                    // check magic number is right
+                    CHECK_MAGIC((header *)address);
+
+                    allocated_chunk_index++;
+                    // If this is the index to free then break out of loop
+                    if (allocated_chunk_index == index)
+                        break;
+                }
+            }
+        }
+    }
+
+    if (index > allocated_chunk_index)
+    {
+        printf("Index is greater than the number of allocated chunks!\n");
+        printf("There are only %d allocated chunks\n", allocated_chunk_index);
+    }
+    else
+    {
+        printf("Freeing allocated chunk at index %d\n", allocated_chunk_index);
+        printf("Freeing allocated chunk at address %ld\n", (uint64_t)address - offset);
+
+        my_free(address + sizeof(header));
+    }
+}
+
+/* Prints the settings the heap was initialized with. */
+void show_heap()
+{
+    printf("\nHeap initialized with size %ld using %s fit and %ld arena%s\n", heap_size, policy_names[fit_policy], active_arenas, active_arenas == 1 ? "" : "s");
+}
+
+/* Prints the statistics from my_malloc_stats() and the fragmentation, skipping bins nothing was allocated from and bins
+with no free chunks. */
+void show_stats()
+{
+    heap_stats stats;
+    my_malloc_stats(&stats);
+    fragmentation frag;
+    heap_fragmentation(&frag);
+
+    printf("\nIn use: %ld bytes in %ld allocation%s\n", stats.in_use_bytes, stats.in_use_count, stats.in_use_count == 1 ? "" : "s");
+    printf("Free: %ld bytes in %ld chunk%s, the largest %ld bytes\n", stats.free_bytes, stats.free_chunks, stats.free_chunks == 1 ? "" : "s", stats.largest_free_chunk);
+    printf("Footprint: %ld bytes\n", stats.footprint);
+    printf("Failed allocations: %ld\n", stats.failed_allocations);
+    printf("Searches: %ld taking %ld ns\n", stats.searches, stats.search_ns);
+    printf("Remote frees: %ld\n", stats.remote_frees);
+    printf("Allocations by bin:\n");
+    for (size_t i = 0; i < NUM_BINS; i++)
+    {
+        if (stats.allocations[i])
+        {
+            printf("    %2ld: %ld\n", i, stats.allocations[i]);
+        }
+    }
+    printf("External fragmentation: %.1f%%\n", 100 * frag.external);
+    printf("Free chunks by bin:\n");
+    for (size_t i = 0; i < NUM_BINS; i++)
+    {
+        if (frag.free_chunks_by_bin[i])
+        {
+            printf("    %2ld: %ld\n", i, frag.free_chunks_by_bin[i]);
+        }
+    }
+    printf("\n");
+}
+
+/* Writes the heap map from export_heap_map() to a file the user names. */
+void save_heap_map()
+{
+    char path[256];
+    printf("File to write the heap map to: ");
+    scanf("%255s", path);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("Could not open %s\n", path);
+        return;
+    }
+    export_heap_map(fd);
+    close(fd);
+    printf("Wrote the heap map to %s\n", path);
+}
+
+/* Show a list of commands for the interactive shell. */
+void show_commands()
+{
+    printf("\naudit - Audits the heap and displays it in diagram format\n");
+    printf("walk free - Walks through the free list and prints out info\n");
+    printf("walk allocated - Walks through the allocated chunks and prints out info\n");
+    printf("stats - Shows the counters kept by the allocator and the fragmentation of the heap\n");
+    printf("map - Writes the layout of the heap to a file as JSON\n");
+    printf("malloc - Allocates a chunk of a user specified size\n");
+    printf("free - Frees the allocated chunk at the address specified by the user\n");
+    printf("test - Select a test to run\n");
+    printf("reset - Clears the heap of allocated chunks\n");
+    printf("policy - Starts over with a fresh heap using the placement policy specified by the user\n");
+    printf("help - Displays this list of commands\n");
+    printf("quit - End the session\n\n");
+}
+
+/* Show the available tests. */
+void show_tests()
+{
+    printf("             AVAILABLE TESTS             \n");
+    printf("=========================================\n");
+    printf("Please note: running a test will clear the heap\n\n");
+    printf("all - run all tests in below order\n");
+    printf("reuse - run free chunk reuse tests\n");
+    printf("sorted - run sorted free list tests\n");
+    printf("splitting - run splitting free chunks tests\n");
+    printf("coalescing - run coalescing tests\n");
+    printf("alternating - run alternating sequence tests\n");
+    printf("fit - run worst fit tests\n");
+    printf("return - run malloc bad value tests\n");
+    printf("tags - run boundary tag tests\n");
+    printf("bins - run segregated fit tests\n");
+    printf("policies - run placement policy tests\n");
+    printf("growth - run heap growth tests\n");
+    printf("trim - run trim tests\n");
+    printf("threads - run thread cache tests\n");
+    printf("arenas - run arena tests\n");
+    printf("family - run realloc, calloc and aligned alloc tests\n");
+    printf("slabs - run slab tests\n");
+    printf("mapped - run mapped chunk tests\n");
+    printf("hardening - run hardening tests\n");
+    printf("stats - run heap statistics tests\n");
+    printf("fragmentation - run fragmentation and heap map tests\n");
+    printf("tree - run size tree tests\n");
+    printf("deferred - run deferred coalescing tests\n");
+    printf("batch - run batch allocation tests\n");
+    printf("scoped - run scoped region tests\n");
+    printf("options - run heap options tests\n");
+    printf("huge - run huge page tests\n");
+    printf("numa - run NUMA arena tests\n");
+    printf("profile - run heap profiler tests\n\n");
+}
+
+/* Run the selected test. */
+void select_test(char *which)
+{
+    if (!strcmp(which, "all"))
+    {
+        test_all();
+    }
+    else if (!strcmp(which, "reuse"))
+    {
+        test_free_chunk_reuse();
+    }
+    else if (!strcmp(which, "sorted"))
+    {
+        test_sorted_free_list();
+    }
+    else if (!strcmp(which, "splitting"))
+    {
+        test_splitting_free_chunks();
+    }
+    else if (!strcmp(which, "coalescing"))
+    {
+        test_coalesce();
+    }
+    else if (!strcmp(which, "alternating"))
+    {
+        test_alternating_sequence();
+    }
+    else if (!strcmp(which, "fit"))
+    {
+        test_worst_fit();
+    }
+    else if (!strcmp(which, "return"))
+    {
+        test_malloc_bad_size();
+    }
+    else if (!strcmp(which, "tags"))
+    {
+        test_boundary_tags();
+    }
+    else if (!strcmp(which, "bins"))
+    {
+        test_segregated_fit();
+    }
+    else if (!strcmp(which, "policies"))
+    {
+        test_placement_policies();
+    }
+    else if (!strcmp(which, "growth"))
+    {
+        test_heap_growth();
+    }
+    else if (!strcmp(which, "trim"))
+    {
+        test_trim();
+    }
+    else if (!strcmp(which, "threads"))
+    {
+        test_thread_cache();
+    }
+    else if (!strcmp(which, "arenas"))
+    {
+        test_arenas();
+    }
+    else if (!strcmp(which, "family"))
+    {
+        test_malloc_family();
+    }
+    else if (!strcmp(which, "slabs"))
+    {
+        test_slabs();
+    }
+    else if (!strcmp(which, "mapped"))
+    {
+        test_mapped_chunks();
+    }
+    else if (!strcmp(which, "hardening"))
+    {
+        test_hardening();
+    }
+    else if (!strcmp(which, "stats"))
+    {
+        test_stats();
+    }
+    else if (!strcmp(which, "fragmentation"))
+    {
+        test_fragmentation();
+    }
+    else if (!strcmp(which, "tree"))
+    {
+        test_size_tree();
+    }
+    else if (!strcmp(which, "deferred"))
+    {
+        test_deferred_coalescing();
+    }
+    else if (!strcmp(which, "batch"))
+    {
+        test_batch();
+    }
+    else if (!strcmp(which, "scoped"))
+    {
+        test_scoped_regions();
+    }
+    else if (!strcmp(which, "options"))
+    {
+        test_options();
+    }
+    else if (!strcmp(which, "huge"))
+    {
+        test_huge_pages();
+    }
+    else if (!strcmp(which, "numa"))
+    {
+        test_numa();
+    }
+    else if (!strcmp(which, "profile"))
+    {
+        test_profile();
+    }
+    else
+    {
+        printf("Unrecognized test selection. Type 'test' to see the list of available tests\n");
+    }
+}
+
+/* Start the interactive shell */
+void start_shell()
+{
+    char command[100];
+
+    show_commands();
+
+    while (strcmp(command, "quit"))
+    {
+        printf("> ");
+        scanf("%s", command);
+
+        // Which commands to execute
+        if (!strcmp(command, "audit"))
+        {
+            audit();
+        }
+        else if (!strcmp(command, "walk"))
+        {
+            char which[20];
+            scanf("%s", which);
+            if (!strcmp(which, "free"))
+            {
+                walk_free_list();
+            }
+            else if (!strcmp(which, "allocated"))
+            {
+                walk_allocated_chunks();
+            }
+            else
+            {
+                printf("Invalid command for 'walk'. Use 'free' or 'allocated'\n");
+            }
+        }
+        else if (!strcmp(command, "stats"))
+        {
+            show_stats();
+        }
+        else if (!strcmp(command, "map"))
+        {
+            save_heap_map();
+        }
+        else if (!strcmp(command, "malloc"))
+        {
+            int size = 0;
+            printf("Size of chunk to allocate: ");
+            scanf("%d", &size);
+            printf("You requested to allocate a chunk of size %d\n", size);
+            void *ptr = my_malloc(size);
+            if (!ptr)
+            {
+                printf("Could not allocate a chunk of size %d\n", size);
+                printf("Did you try to allocate a negative size or more than the heap can hold?\n");
+            }
+            else if (is_slab_object(ptr))
+            {
+                printf("It was small enough to come from a slab, which is not part of the heap audit shows\n");
+            }
+            else if (((header *)ptr - 1)->size_flags & CHUNK_MAPPED)
+            {
+                printf("It was big enough to get a mapping of its own, which is not part of the heap audit shows\n");
+            }
+        }
+        else if (!strcmp(command, "free"))
+        {
+            long address = -1;
+            printf("Address of allocated chunk to free (address displayed in audit): ");
+            scanf("%ld", &address);
+            printf("You requested to free allocated chunk at address %ld\n", address);
+
+            // Make sure it is valid
+            if (!find_region((void *)(address + offset)))
+            {
+                printf("That address is not valid\n");
+                continue;
+            }
+
+            header *chunk = (header *)(address + offset);
+            if (is_allocated_chunk(chunk))
+            {
+                my_free(chunk + 1);
+                printf("Freed chunk at address %ld\n", address);
+            }
+            else
+            {
+                printf("No allocated chunk found at address %ld\n", address);
+                printf("Try using 'audit' or 'walk allocated' to see the addresses of allocated chunks\n");
+            }
+        }
+        else if (!strcmp(command, "test"))
+        {
+            show_tests();
+            char which[20];
+            printf("Which test to run: ");
+            scanf("%s", which);
+            select_test(which);
+        }
+        else if (!strcmp(command, "reset"))
+        {
+            free_all_chunks();
+        }
+        else if (!strcmp(command, "policy"))
+        {
+            char which[20];
+            printf("Placement policy (segregated, first, next, best or worst): ");
+            scanf("%s", which);
+
+            placement_policy policy = 0;
+            while (policy < NUM_POLICIES && strcmp(which, policy_names[policy]))
+            {
+                policy++;
+            }
+
+            if (policy == NUM_POLICIES)
+            {
+                printf("Unrecognized placement policy\n");
+            }
+            else
+            {
+                init_heap_with_policy(policy);
+                show_heap();
+            }
+        }
+        else if (!strcmp(command, "help"))
+        {
+            show_commands();
+        }
+        else if (strcmp(command, "quit"))
+        {
+            printf("Unrecognized command. Type 'help' to see the list of commands.\n");
+        }
+    }
+    printf("\nSession ended\n");
+}
+
+#pragma endregion Shell
+
+int main(int argc, char const *argv[])
+{
+    init_heap();
+    show_heap();
+    init_tests();
+
+    if (argv[1])
+    {
+        test_all();
+    }
+    else
+    {
+        start_shell();
+    }
 }
\ No newline at end of file
@@ -1,8 +1,8 @@
-#if !defined(MAIN_H)
-#define MAIN_H
-
-void walk_free_list();
-void walk_allocated_chunks();
-void audit();
-
+#if !defined(MAIN_H)
+#define MAIN_H
+
+void walk_free_list();
+void walk_allocated_chunks();
+void audit();
+
 #endif // MAIN_H
\ No newline at end of file
@@ -1,206 +1,2884 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include <sys/mman.h>
-#include <inttypes.h>
-#include <assert.h>
-
-#include "malloc_free.h"
-
-// Size of heap
-const size_t HEAP_SIZE = 4096;
-// Magic number to verify integrity of allocated chunk
-const int MAGIC_NUMBER = 123456789;
-// Align to 64-bit word which is 8 bytes
-const size_t ALIGN_TO = 8;
-// Pointer to start of heap
-void *heap_pointer;
-// Pointer to first node in free list
-node *free_list_head;
-// Offset for displaying understandable values
-uint64_t offset;
-
-/* Given a requested size, returns the total aligned size needed. */
-size_t align(size_t raw)
-{
-    size_t aligned = ALIGN_TO * ((raw - 1 + ALIGN_TO + sizeof(header)) / ALIGN_TO);
-    return aligned;
-}
-
-/* Check for available coalescing around the recently freed chunk */
-void coalesce(node *prev, node *freed)
-{
-    // Check chunk after freed
-    if (freed->next && (uint64_t)freed + sizeof(node) + freed->size == (uint64_t)freed->next)
-    {
-        node *temp = freed->next;
-        freed->next = temp->next;
-        freed->size = freed->size + temp->size + sizeof(node);
-    }
-
-    // Check previous chunk
-    if (prev && (uint64_t)prev + sizeof(node) + prev->size == (uint64_t)prev->next)
-    {
-        node *temp = prev->next;
-        prev->next = temp->next;
-        prev->size = prev->size + temp->size + sizeof(node);
-    }
-}
-
-/* Returns pointer to memory. Returns NULL if there is not enough space. */
-void *my_malloc(size_t size)
-{
-    // If there are no free chunks
-    if (!free_list_head)
-    {
-        printf("There are no free chunks!\n");
-        return NULL;
-    }
-
-    // If they enter a negative number the size will overflow to the max integer so this will fire
-    if (size > HEAP_SIZE)
-    {
-        printf("REQUESTED SIZE EXCEEDS HEAP SIZE\n");
-        printf("Did you try to allocate a negative size?\n");
-        return NULL;
-    }
-    // Not sure if this is supposed to happen but it makes sense to deny a request of size 0
-    else if (size == 0)
-    {
-        printf("REFUSING TO ALLOCATE SIZE 0\n");
-        return NULL;
-    }
-
-    size_t needed_size = align(size);
-
-    // WORST FIT
-    // Search for biggest chunk for worst fit
-    node *curr = free_list_head;
-    node *biggest_chunk_prev = curr;
-    node *biggest_chunk = curr;
-    while (curr)
-    {
-        if (curr->next && curr->next->size > biggest_chunk->size)
-        {
-            biggest_chunk_prev = curr;
-            biggest_chunk = curr->next;
-        }
-        curr = curr->next;
-    }
-
-    // If there is no chunk big enough return NULL
-    if (needed_size > biggest_chunk->size + sizeof(node))
-    {
-        printf("NO CHUNK BIG ENOUGH\n");
-        return NULL;
-    }
-
-    size_t prev_size = biggest_chunk->size;
-    node *prev_next = biggest_chunk->next;
-
-    // Split free chunk
-    // If the chunk to be split is the head
-    if (biggest_chunk == free_list_head)
-    {
-        // If the needed size requires the overhead space too
-        if (needed_size > biggest_chunk->size)
-        {
-            free_list_head = biggest_chunk->next;
-        }
-        else
-        {
-            free_list_head = (node *)((void *)biggest_chunk + needed_size);
-            free_list_head->size = prev_size - needed_size;
-            free_list_head->next = prev_next;
-        }
-    }
-    else
-    {
-        // If the needed size requires the overhead space too
-        if (needed_size > biggest_chunk->size)
-        {
-            biggest_chunk_prev->next = biggest_chunk->next;
-        }
-        else
-        {
-            node *split_free_chunk = (node *)((void *)biggest_chunk + needed_size);
-            split_free_chunk->size = prev_size - needed_size;
-            biggest_chunk_prev->next = split_free_chunk;
-        }
-    }
-
-    // Create header
-    header *allocated_header = (header *)biggest_chunk;
-    allocated_header->size = needed_size - sizeof(header);
-    allocated_header->magic = MAGIC_NUMBER;
-
-    // Cut big chunk down to size
-    header *allocated_address = (header *)biggest_chunk + 1;
-
-    return (void *)allocated_address;
-}
-
-/* Frees the allocated chunk starting at the pointer passed in. Orders and coalesces the free list afterwards. */
-void my_free(void *ptr)
-{
-    header *hptr = (header *)ptr - 1;
-    assert(hptr->magic == MAGIC_NUMBER);
-    node *new_free_chunk = (node *)hptr;
-    size_t new_size = hptr->size - sizeof(header) + sizeof(node);
-
-    // Edge case where there is no free list
-    if (!free_list_head)
-    {
-        free_list_head = new_free_chunk;
-        free_list_head->next = NULL;
-        free_list_head->size = new_size;
-        return;
-    }
-
-    // Insert into free list at the right place so no need for reordering
-    node *prev = free_list_head;
-    node *curr = free_list_head;
-
-    // Loop through list to find correct placement
-    while (curr < new_free_chunk)
-    {
-        prev = curr;
-        curr = curr->next;
-    }
-
-    // If it is at the start
-    if (curr == free_list_head)
-    {
-        // Add new free chunk to head of free list
-        new_free_chunk->next = free_list_head;
-        new_free_chunk->size = new_size;
-        free_list_head = new_free_chunk;
-    }
-    else
-    {
-        prev->next = new_free_chunk;
-        new_free_chunk->next = curr;
-        new_free_chunk->size = new_size;
-    }
-
-    // Try to coalesce around freed chunk
-    coalesce(prev, new_free_chunk);
-}
-
-/* Initializes the heap and all global variables. */
-void init_heap()
-{
-    // mmap() returns a pointer to a chunk of free space
-    // Set heap pointer to start of heap
-    heap_pointer = mmap(NULL, HEAP_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
-
-    // Set offset for displaying
-    offset = (uint64_t)heap_pointer;
-
-    // Initialize free list
-    // Set free_list_head to point to start of heap
-    free_list_head = (node *)heap_pointer;
-    free_list_head->size = HEAP_SIZE - sizeof(node);
-    free_list_head->next = NULL;
-
-    printf("\nHeap initialized with size %ld\n", HEAP_SIZE);
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#include "malloc_free.h"
+#include "slab.h"
+#include "profile.h"
+
+// Default size of the first region of each arena
+const size_t HEAP_SIZE = 4096;
+// Size of the first region of each arena, and of the whole heap when it can't grow. Set before calling init_heap().
+size_t heap_size = HEAP_SIZE;
+// New regions double in size until they reach this
+const size_t MAX_REGION_SIZE = 1UL << 30;
+// Magic number to verify integrity of allocated chunk, only kept with HEAP_DEBUG
+const int MAGIC_NUMBER = 123456789;
+// Magic number the chunks of this heap get, set by init_heap() and random when the heap is hardened
+size_t magic_number;
+// Align to 64-bit word which is 8 bytes
+const size_t ALIGN_TO = 8;
+// Smallest chunk that can hold a node and footer once it is freed
+const size_t MIN_CHUNK_SIZE = sizeof(node) + sizeof(footer);
+// Every arena, only the first active_arenas of which are used. Locks are ready before init_heap() so threads can take them at any time.
+arena arenas[MAX_ARENAS] = {[0 ... MAX_ARENAS - 1] = {.lock = PTHREAD_MUTEX_INITIALIZER}};
+// Arena used by the thread that initialized the heap. Holds the heap as it was before there were arenas.
+arena *const main_arena = &arenas[0];
+// Number of arenas to use, or 0 for one per CPU. Set before calling init_heap().
+size_t num_arenas = 0;
+// Number of arenas in use, found when initializing the heap
+size_t active_arenas;
+// How threads are given an arena. Set before calling init_heap().
+arena_assignment arena_policy = ROUND_ROBIN;
+// Offset for displaying understandable values
+uint64_t offset;
+// Boundary tag mode: push freed chunks on the front of the free list instead of keeping it sorted by address.
+// Set before calling init_heap().
+bool lifo_free_list = false;
+// Map more regions when no free chunk is big enough. Set before calling init_heap().
+bool grow_heap = true;
+// Give free pages back to the OS, and unmap regions that become entirely free
+bool trim_heap = true;
+// Release pages with MADV_FREE where available, which is cheaper but only drops RSS when the system needs the memory
+bool trim_lazily = false;
+// Pages are only released once a free adds at least this many bytes of whole pages, to keep madvise calls rare
+size_t trim_threshold = 64 * 1024;
+// Free regions are only unmapped if at least this much free space is left mapped, so a burst right after doesn't map them again
+size_t trim_keep = 256 * 1024;
+// Size of a page, found when initializing the heap
+static size_t page_size;
+// Back regions and slabs with huge pages, so a big heap takes far fewer TLB entries. Regions are then whole huge pages
+// aligned to one. Set before calling init_heap().
+bool huge_pages = false;
+// Keep a cache of freed small chunks in each thread. Set before calling init_heap().
+bool thread_cache = true;
+// Most chunks each thread cache keeps for a single size
+size_t thread_cache_limit = 7;
+// Put freed small chunks that miss the thread cache on a quick list of their arena for their exact size, to be used again
+// as they are, and only coalesce them in a batch when an allocation fails or the quick lists outgrow their budget. Set
+// before calling init_heap().
+bool defer_coalescing = false;
+// Most bytes of chunks the quick lists of one arena hold before they are all coalesced
+size_t quick_list_budget = 64 * 1024;
+// Serve requests up to SLAB_MAX_SIZE from slabs instead of the heap. Set before calling init_heap().
+bool use_slabs = true;
+// Requests of at least this many bytes get a mapping of their own instead of a chunk in an arena
+size_t mmap_threshold = 128 * 1024;
+// Total size of the mappings of mapped chunks
+static size_t mapped_chunk_bytes;
+// Mangle free list links and check every free, aborting on a double free or a corrupted list. Set before calling init_heap().
+bool harden_heap = false;
+// Random key free list links are mangled with when hardened, picked by init_heap()
+static uintptr_t heap_key;
+// Arena each thread allocates from with round robin assignment
+static __thread arena *assigned_arena __attribute__((tls_model("initial-exec")));
+// Next arena to hand out with round robin assignment
+static size_t next_arena;
+// Most CPUs whose NUMA node is known. Any others count as being on the first node.
+#define MAX_NUMA_CPUS 4096
+// Number of NUMA nodes, found when initializing the heap. Machines without NUMA have one.
+size_t numa_nodes = 1;
+// Node of each CPU, found when initializing the heap
+static uint8_t cpu_nodes[MAX_NUMA_CPUS];
+// Next of its arenas each node hands out with by node assignment
+static size_t next_node_arena[MAX_NUMA_NODES];
+// Used to initialize the heap on first use if init_heap() was not called
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+// Freed small chunks kept by one thread, one stack per small bin size. Chunks stay allocated as far as the heap
+// is concerned, and are linked through the first word of their data.
+typedef struct thread_cache_t
+{
+    header *entries[SMALL_BINS];
+    size_t counts[SMALL_BINS];
+    bool registered;
+} thread_cache_t;
+
+// Initial exec TLS is set up when the library is loaded, where the default model could call malloc on first use
+static __thread thread_cache_t cache __attribute__((tls_model("initial-exec")));
+// Used to flush a thread's cache when it exits
+static pthread_key_t cache_key;
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+// Counters each thread keeps for my_malloc_stats(). Only the thread itself writes them, so counting needs no atomics, and
+// they are summed when read.
+typedef struct thread_stats_t
+{
+    size_t allocations[NUM_BINS];
+    size_t failed_allocations;
+    size_t frees;
+    // Both only ever grow, and the difference is what is in use
+    size_t allocated_bytes;
+    size_t freed_bytes;
+    size_t searches;
+    uint64_t search_ns;
+    size_t remote_frees;
+    // Links in the list of every thread's counters
+    struct thread_stats_t *next;
+    struct thread_stats_t *prev;
+    bool registered;
+} thread_stats;
+
+static __thread thread_stats stats __attribute__((tls_model("initial-exec")));
+// Counters of every thread that has any
+static thread_stats *all_stats;
+// Sum of the counters of threads that exited
+static thread_stats retired_stats;
+// Guards the list of counters, but never the counting itself
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+// Used to retire a thread's counters when it exits
+static pthread_key_t stats_key;
+static pthread_once_t stats_key_once = PTHREAD_ONCE_INIT;
+// Placement policy used by my_malloc. Chosen with init_heap_with_policy().
+placement_policy fit_policy = SEGREGATED_FIT;
+// Names of the placement policies for display
+const char *policy_names[NUM_POLICIES] = {
+    [SEGREGATED_FIT] = "segregated",
+    [FIRST_FIT] = "first",
+    [NEXT_FIT] = "next",
+    [BEST_FIT] = "best",
+    [WORST_FIT] = "worst",
+};
+
+/* Returns true if the placement policy keeps the size tree. */
+static bool size_indexed()
+{
+    return fit_policy == BEST_FIT || fit_policy == WORST_FIT;
+}
+
+/* Returns the smallest chunk the placement policy makes. Best and worst fit keep every free chunk in the size tree, so
+their chunks have to be able to hold the tree links once they are freed. */
+static size_t min_chunk_size()
+{
+    return size_indexed() ? TREE_MIN_CHUNK : MIN_CHUNK_SIZE;
+}
+
+/* Given a requested size, returns the total aligned size needed. */
+size_t align(size_t raw)
+{
+    size_t aligned = ALIGN_TO * ((raw - 1 + ALIGN_TO + sizeof(header)) / ALIGN_TO);
+    // Every chunk has to be able to hold its free links and footer once it is freed
+    if (aligned < min_chunk_size())
+    {
+        aligned = min_chunk_size();
+    }
+    return aligned;
+}
+
+/* Returns the size class bin for a chunk of the given total size. Small sizes get a bin each, bigger sizes are split into halves of each power of two. */
+size_t bin_index(size_t size)
+{
+    size_t small_bin_limit = SMALL_BINS * ALIGN_TO;
+    if (size < small_bin_limit)
+    {
+        return size / ALIGN_TO;
+    }
+
+    int power = 63 - __builtin_clzl(size);
+    int half = (size >> (power - 1)) & 1;
+    size_t index = SMALL_BINS + 2 * (power - __builtin_ctzl(small_bin_limit)) + half;
+
+    // The last bin takes everything too big for the others
+    return index < NUM_BINS ? index : NUM_BINS - 1;
+}
+
+/* Returns true if the chunk starting at the address is free. */
+bool chunk_is_free(void *chunk)
+{
+    return ((header *)chunk)->size_flags & CHUNK_FREE;
+}
+
+/* Returns true if the chunk starting at the address is allocated but sitting in a thread cache. */
+bool chunk_is_cached(void *chunk)
+{
+    return ((header *)chunk)->size_flags & CHUNK_CACHED;
+}
+
+/* Returns the size in the header or node of the chunk starting at the address, without the flags. */
+size_t stored_size(void *chunk)
+{
+    return ((header *)chunk)->size_flags & SIZE_MASK;
+}
+
+/* Sets the size in the header or node of a chunk, keeping its flags. */
+static void set_size(void *chunk, size_t size)
+{
+    header *h = chunk;
+    h->size_flags = (h->size_flags & ~SIZE_MASK) | size;
+}
+
+/* Returns the total size of the chunk starting at the address, including its header or node. */
+size_t chunk_size(void *chunk)
+{
+    if (chunk_is_free(chunk))
+    {
+        return stored_size(chunk) + sizeof(node);
+    }
+    return stored_size(chunk) + sizeof(header);
+}
+
+/* Returns the boundary tag in the last word of a free chunk. */
+footer *chunk_footer(node *chunk)
+{
+    return (footer *)((void *)chunk + sizeof(node) + stored_size(chunk)) - 1;
+}
+
+/* Returns the address of the first chunk in a region. */
+void *region_start(region *r)
+{
+    return (void *)r - r->size;
+}
+
+/* Returns the region holding the address, or NULL if it is not in any arena. */
+region *find_region(void *address)
+{
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        for (region *r = arenas[i].regions; r; r = r->next)
+        {
+            if (address >= region_start(r) && address < (void *)r)
+            {
+                return r;
+            }
+        }
+    }
+    return NULL;
+}
+
+/* Returns the total size of the regions mapped by every arena, of the slabs carved so far and of the mapped chunks. Only a snapshot if other threads are allocating. */
+size_t heap_footprint()
+{
+    size_t footprint = 0;
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        footprint += arenas[i].mapped_bytes;
+    }
+    return footprint + slab_footprint() + __atomic_load_n(&mapped_chunk_bytes, __ATOMIC_RELAXED);
+}
+
+/* Returns the arena an allocated chunk came from, which is kept in its flags. */
+arena *chunk_arena(void *chunk)
+{
+    return &arenas[(((header *)chunk)->size_flags >> ARENA_SHIFT) & (MAX_ARENAS - 1)];
+}
+
+/* Prints what was found wrong with the heap and aborts. Writes straight to stderr, since printf can call malloc. */
+void heap_corrupted(const char *message)
+{
+    write(STDERR_FILENO, "myalloc: ", 9);
+    write(STDERR_FILENO, message, strlen(message));
+    write(STDERR_FILENO, "\n", 1);
+    abort();
+}
+
+/* Mangles a free list link with where it is stored and the heap's key, like glibc's safe-linking, so a link overwritten
+through a dangling pointer only goes somewhere chosen by someone who knows both. Mangling twice gives the link back. Does
+nothing unless the heap is hardened. */
+static void *protect_link(void *position, void *link)
+{
+    return harden_heap ? (void *)((uintptr_t)link ^ ((uintptr_t)position >> 12) ^ heap_key) : link;
+}
+
+/* Returns the chunk after a free chunk in its free list or bin. Aborts if a hardened heap finds the link was corrupted. */
+node *free_chunk_next(node *chunk)
+{
+    node *next = protect_link(&chunk->next, chunk->next);
+    if (harden_heap && (uintptr_t)next % ALIGN_TO)
+    {
+        heap_corrupted("corrupted free list");
+    }
+    return next;
+}
+
+/* Links a free chunk to the chunk after it in its free list or bin. */
+static void set_free_chunk_next(node *chunk, node *next)
+{
+    chunk->next = protect_link(&chunk->next, next);
+}
+
+/* Returns true if chunk x comes before chunk y in the size tree, which orders by size and then by address, so best fit
+finds the same chunk walking the tree as walking the free list. */
+static bool tree_before(void *x, void *y)
+{
+    return chunk_size(x) < chunk_size(y) || (chunk_size(x) == chunk_size(y) && x < y);
+}
+
+/* Returns the first chunk in the size tree of at least size bytes, or NULL if there is none. */
+static tree_node *tree_lower_bound(arena *a, size_t size)
+{
+    tree_node *found = NULL;
+    for (tree_node *curr = a->size_tree; curr;)
+    {
+        if (chunk_size(curr) >= size)
+        {
+            found = curr;
+            curr = curr->left;
+        }
+        else
+        {
+            curr = curr->right;
+        }
+    }
+    return found;
+}
+
+/* Rotates the subtree at x to the left, moving its right child up, or to the right. */
+static void rotate(arena *a, tree_node *x, bool left)
+{
+    tree_node *y = left ? x->right : x->left;
+    tree_node *inner = left ? y->left : y->right;
+    if (left)
+    {
+        x->right = inner;
+    }
+    else
+    {
+        x->left = inner;
+    }
+    if (inner)
+    {
+        inner->parent = x;
+    }
+
+    y->parent = x->parent;
+    if (!x->parent)
+    {
+        a->size_tree = y;
+    }
+    else if (x == x->parent->left)
+    {
+        x->parent->left = y;
+    }
+    else
+    {
+        x->parent->right = y;
+    }
+    if (left)
+    {
+        y->left = x;
+    }
+    else
+    {
+        y->right = x;
+    }
+    x->parent = y;
+}
+
+/* Puts subtree v where subtree u hangs from its parent. */
+static void transplant(arena *a, tree_node *u, tree_node *v)
+{
+    if (!u->parent)
+    {
+        a->size_tree = v;
+    }
+    else if (u == u->parent->left)
+    {
+        u->parent->left = v;
+    }
+    else
+    {
+        u->parent->right = v;
+    }
+    if (v)
+    {
+        v->parent = u->parent;
+    }
+}
+
+/* Adds a free chunk to the size tree. */
+static void index_free_chunk(arena *a, node *chunk)
+{
+    tree_node *n = (tree_node *)chunk;
+    tree_node *parent = NULL;
+    tree_node **link = &a->size_tree;
+    while (*link)
+    {
+        parent = *link;
+        link = tree_before(n, parent) ? &parent->left : &parent->right;
+    }
+    n->left = n->right = NULL;
+    n->parent = parent;
+    n->red = true;
+    *link = n;
+
+    if (!a->largest || chunk_size(n) > chunk_size(a->largest) || (chunk_size(n) == chunk_size(a->largest) && n < a->largest))
+    {
+        a->largest = n;
+    }
+
+    // Fix two reds in a row by recoloring while the uncle is red, then with at most two rotations
+    while (n->parent && n->parent->red)
+    {
+        tree_node *p = n->parent;
+        tree_node *g = p->parent;
+        bool p_left = p == g->left;
+        tree_node *uncle = p_left ? g->right : g->left;
+        if (uncle && uncle->red)
+        {
+            p->red = false;
+            uncle->red = false;
+            g->red = true;
+            n = g;
+            continue;
+        }
+        if (n == (p_left ? p->right : p->left))
+        {
+            n = p;
+            rotate(a, n, p_left);
+            p = n->parent;
+        }
+        p->red = false;
+        g->red = true;
+        rotate(a, g, !p_left);
+    }
+    a->size_tree->red = false;
+}
+
+/* Takes a free chunk out of the size tree. Must be done before anything is written over the tree links at the start of
+the chunk. */
+static void unindex_free_chunk(arena *a, node *chunk)
+{
+    tree_node *z = (tree_node *)chunk;
+    // A node its parent doesn't point at means the tree was written over
+    if (harden_heap && (z->parent ? z->parent->left != z && z->parent->right != z : a->size_tree != z))
+    {
+        heap_corrupted("corrupted size tree");
+    }
+
+    // The node taking z's place, which may be empty, and its parent
+    tree_node *x;
+    tree_node *x_parent;
+    bool removed_red = z->red;
+    if (!z->left || !z->right)
+    {
+        x = z->left ? z->left : z->right;
+        x_parent = z->parent;
+        transplant(a, z, x);
+    }
+    else
+    {
+        // Move the next node in order into z's place
+        tree_node *y = z->right;
+        while (y->left)
+        {
+            y = y->left;
+        }
+        removed_red = y->red;
+        x = y->right;
+        x_parent = y;
+        if (y->parent != z)
+        {
+            x_parent = y->parent;
+            transplant(a, y, x);
+            y->right = z->right;
+            y->right->parent = y;
+        }
+        transplant(a, z, y);
+        y->left = z->left;
+        y->left->parent = y;
+        y->red = z->red;
+    }
+
+    // Taking out a black node leaves its side a black short, made up by recoloring and rotating on the way up
+    while (!removed_red && x != a->size_tree && (!x || !x->red))
+    {
+        // x's sibling can't be empty, since its side has the extra black
+        bool x_left = x == x_parent->left;
+        tree_node *w = x_left ? x_parent->right : x_parent->left;
+        if (w->red)
+        {
+            w->red = false;
+            x_parent->red = true;
+            rotate(a, x_parent, x_left);
+            w = x_left ? x_parent->right : x_parent->left;
+        }
+        tree_node *near = x_left ? w->left : w->right;
+        tree_node *far = x_left ? w->right : w->left;
+        if ((!near || !near->red) && (!far || !far->red))
+        {
+            w->red = true;
+            x = x_parent;
+            x_parent = x->parent;
+            continue;
+        }
+        if (!far || !far->red)
+        {
+            near->red = false;
+            w->red = true;
+            rotate(a, w, !x_left);
+            w = x_left ? x_parent->right : x_parent->left;
+            far = x_left ? w->right : w->left;
+        }
+        w->red = x_parent->red;
+        x_parent->red = false;
+        far->red = false;
+        rotate(a, x_parent, x_left);
+        x = a->size_tree;
+    }
+    if (x)
+    {
+        x->red = false;
+    }
+
+    // The new biggest chunk is the first of the biggest size
+    if (a->largest == z)
+    {
+        tree_node *last = a->size_tree;
+        while (last && last->right)
+        {
+            last = last->right;
+        }
+        a->largest = last ? tree_lower_bound(a, chunk_size(last)) : NULL;
+    }
+}
+
+/* Removes a chunk from the free list, or from its bin. */
+static void unlink_free_chunk(arena *a, node *chunk)
+{
+    node *next = free_chunk_next(chunk);
+    // A chunk whose neighbours don't point back at it means the list was written over
+    if (harden_heap && ((next && next->prev != chunk) || (chunk->prev && free_chunk_next(chunk->prev) != chunk)))
+    {
+        heap_corrupted("corrupted free list");
+    }
+
+    // Next fit carries on from the chunk after
+    if (a->rover == chunk)
+    {
+        a->rover = next;
+    }
+
+    if (fit_policy == SEGREGATED_FIT && !chunk->prev)
+    {
+        size_t index = bin_index(chunk_size(chunk));
+        a->bins[index] = next;
+        if (!a->bins[index])
+        {
+            a->bin_bitmap &= ~(1UL << index);
+        }
+    }
+    else if (chunk->prev)
+    {
+        set_free_chunk_next(chunk->prev, next);
+    }
+    else
+    {
+        a->free_list_head = next;
+    }
+    if (next)
+    {
+        next->prev = chunk->prev;
+    }
+    if (size_indexed())
+    {
+        unindex_free_chunk(a, chunk);
+    }
+    a->free_chunks--;
+}
+
+/* Pushes a chunk on the front of the bin for its size. */
+static void insert_binned_chunk(arena *a, node *chunk)
+{
+    size_t index = bin_index(chunk_size(chunk));
+    chunk->prev = NULL;
+    set_free_chunk_next(chunk, a->bins[index]);
+    if (a->bins[index])
+    {
+        a->bins[index]->prev = chunk;
+    }
+    a->bins[index] = chunk;
+    a->bin_bitmap |= 1UL << index;
+    a->free_chunks++;
+}
+
+/* Puts a chunk in the free list position of another one. With the size tree, the old chunk must already be out of it. */
+static void replace_free_chunk(arena *a, node *old, node *new)
+{
+    // Sizes differ so the new chunk may belong in another bin
+    if (fit_policy == SEGREGATED_FIT)
+    {
+        unlink_free_chunk(a, old);
+        insert_binned_chunk(a, new);
+        return;
+    }
+
+    if (a->rover == old)
+    {
+        a->rover = new;
+    }
+
+    node *next = free_chunk_next(old);
+    set_free_chunk_next(new, next);
+    new->prev = old->prev;
+    if (new->prev)
+    {
+        set_free_chunk_next(new->prev, new);
+    }
+    else
+    {
+        a->free_list_head = new;
+    }
+    if (next)
+    {
+        next->prev = new;
+    }
+    if (size_indexed())
+    {
+        index_free_chunk(a, new);
+    }
+}
+
+/* Adds a chunk to the free list, in address order unless in boundary tag mode. */
+static void insert_free_chunk(arena *a, node *chunk)
+{
+    if (fit_policy == SEGREGATED_FIT)
+    {
+        insert_binned_chunk(a, chunk);
+        return;
+    }
+
+    node *prev = NULL;
+    node *curr = a->free_list_head;
+    // A batch of frees sorted by address picks up the walk where the last chunk of the batch went in
+    if (!lifo_free_list && a->insert_hint && a->insert_hint < chunk)
+    {
+        prev = a->insert_hint;
+        curr = free_chunk_next(prev);
+    }
+
+    // Loop through list to find correct placement
+    while (!lifo_free_list && curr && curr < chunk)
+    {
+        prev = curr;
+        curr = free_chunk_next(curr);
+    }
+
+    chunk->prev = prev;
+    set_free_chunk_next(chunk, curr);
+    if (prev)
+    {
+        set_free_chunk_next(prev, chunk);
+    }
+    else
+    {
+        a->free_list_head = chunk;
+    }
+    if (curr)
+    {
+        curr->prev = chunk;
+    }
+    if (size_indexed())
+    {
+        index_free_chunk(a, chunk);
+    }
+    a->free_chunks++;
+}
+
+/* Grows a chunk that is already free, moving it to its new bin if needed. */
+static void grow_free_chunk(arena *a, node *chunk, size_t extra)
+{
+    if (fit_policy == SEGREGATED_FIT)
+    {
+        unlink_free_chunk(a, chunk);
+        set_size(chunk, stored_size(chunk) + extra);
+        insert_binned_chunk(a, chunk);
+        return;
+    }
+    // The chunk moves along the size tree
+    if (size_indexed())
+    {
+        unindex_free_chunk(a, chunk);
+        set_size(chunk, stored_size(chunk) + extra);
+        index_free_chunk(a, chunk);
+        return;
+    }
+    set_size(chunk, stored_size(chunk) + extra);
+}
+
+/* Unmaps a region that is entirely one free chunk. */
+static void unmap_region(arena *a, region *r)
+{
+    unlink_free_chunk(a, (node *)region_start(r));
+    a->free_bytes -= r->size;
+    a->mapped_bytes -= r->size + sizeof(region);
+
+    region **link = &a->regions;
+    while (*link != r)
+    {
+        link = &(*link)->next;
+    }
+    *link = r->next;
+
+    // Map the same size again if the heap has to grow back
+    if (r->size < a->next_region_size)
+    {
+        a->next_region_size = r->size;
+    }
+
+    munmap(region_start(r), r->size + sizeof(region));
+}
+
+/* Gives pages of a merged free chunk back to the OS. Only the pages around the part that was just freed are released,
+since the rest of the chunk was dealt with when it was freed. Unmaps the region instead if it is now entirely free and
+not the first one. Returns NULL if the chunk was unmapped. */
+static node *trim(arena *a, node *chunk, void *freed_start, void *freed_end)
+{
+    region *after = (region *)((void *)chunk + chunk_size(chunk));
+    if ((after->fence.size_flags & REGION_FENCE) && chunk_size(chunk) == after->size && (void *)chunk != a->heap_pointer && a->free_bytes - after->size >= trim_keep)
+    {
+        unmap_region(a, after);
+        return NULL;
+    }
+
+    // Whole pages between the size tree links and footer, near what was just freed. The pages on either side of it may
+    // have only just become whole pages of free space. Releasing part of a huge page would split it, so with huge pages
+    // only whole ones are released.
+    size_t unit = huge_pages ? HUGE_PAGE_SIZE : page_size;
+    uint64_t chunk_start = (uint64_t)chunk + sizeof(tree_node);
+    uint64_t chunk_end = (uint64_t)chunk_footer(chunk);
+    uint64_t start = (uint64_t)freed_start - unit > chunk_start ? (uint64_t)freed_start - unit : chunk_start;
+    uint64_t end = (uint64_t)freed_end + unit < chunk_end ? (uint64_t)freed_end + unit : chunk_end;
+    start = (start + unit - 1) / unit * unit;
+    end = end / unit * unit;
+
+    if (end > start && end - start >= trim_threshold)
+    {
+#if defined(MADV_FREE)
+        madvise((void *)start, end - start, trim_lazily ? MADV_FREE : MADV_DONTNEED);
+#else
+        madvise((void *)start, end - start, MADV_DONTNEED);
+#endif
+    }
+    return chunk;
+}
+
+/* Merges the recently freed chunk with its free neighbours, found through the boundary tags, and links the result into the free list.
+Returns the merged chunk, or NULL if it made a whole region free and the region was unmapped. */
+node *coalesce(arena *a, node *freed)
+{
+    void *freed_start = freed;
+    void *freed_end = (void *)freed + chunk_size(freed);
+    a->free_bytes += chunk_size(freed);
+
+    // The footer right before this chunk is only valid if the previous chunk is free
+    node *prev = NULL;
+    if (freed->size_flags & PREV_FREE)
+    {
+        footer prev_size = *((footer *)freed - 1);
+        prev = (node *)((void *)freed - prev_size - sizeof(node));
+    }
+
+    // At the end of a region this is the fence, which is never free
+    node *next = (node *)((void *)freed + chunk_size(freed));
+    if (!chunk_is_free(next))
+    {
+        next = NULL;
+    }
+
+    if (prev && next)
+    {
+        // Previous chunk is already in the list, swallow both
+        unlink_free_chunk(a, next);
+        grow_free_chunk(a, prev, chunk_size(freed) + chunk_size(next));
+        freed = prev;
+    }
+    else if (prev)
+    {
+        grow_free_chunk(a, prev, chunk_size(freed));
+        freed = prev;
+    }
+    else if (next)
+    {
+        // Take the place of the next chunk so the list order holds
+        if (size_indexed())
+        {
+            unindex_free_chunk(a, next);
+        }
+        set_size(freed, stored_size(freed) + chunk_size(next));
+        replace_free_chunk(a, next, freed);
+    }
+    else
+    {
+        insert_free_chunk(a, freed);
+    }
+
+    *chunk_footer(freed) = stored_size(freed);
+
+    // Let the chunk after know its footer can be used. Another thread may be setting the cached flag of that chunk
+    // without the lock, so neither can write the whole word.
+    header *after = (header *)((void *)freed + chunk_size(freed));
+    __atomic_fetch_or(&after->size_flags, PREV_FREE, __ATOMIC_RELAXED);
+
+    if (trim_heap)
+    {
+        return trim(a, freed, freed_start, freed_end);
+    }
+    return freed;
+}
+
+/* Carves an allocated chunk of needed_size bytes from the start of a free chunk. Splits off the rest if it is big enough to be its own chunk. */
+static header *split(arena *a, node *chunk, size_t needed_size)
+{
+    size_t total_size = chunk_size(chunk);
+
+    // If the leftover space is too small to hold a free chunk, allocate all of it
+    if (total_size - needed_size < min_chunk_size())
+    {
+        unlink_free_chunk(a, chunk);
+        needed_size = total_size;
+
+        header *after = (header *)((void *)chunk + total_size);
+        __atomic_fetch_and(&after->size_flags, ~PREV_FREE, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        node *split_free_chunk = (node *)((void *)chunk + needed_size);
+        // The rest's node can land on the tree links of the chunk it is cut from
+        if (size_indexed())
+        {
+            unindex_free_chunk(a, chunk);
+        }
+        split_free_chunk->size_flags = (total_size - needed_size - sizeof(node)) | CHUNK_FREE;
+        SET_MAGIC(split_free_chunk, 0);
+        replace_free_chunk(a, chunk, split_free_chunk);
+        *chunk_footer(split_free_chunk) = stored_size(split_free_chunk);
+    }
+
+    // Create header
+    // Free chunks are always coalesced, so the chunk before this one can't be free
+    // The arena goes in the top bits so my_free can find it without searching
+    header *allocated_header = (header *)chunk;
+    allocated_header->size_flags = (needed_size - sizeof(header)) | a->index << ARENA_SHIFT;
+    SET_MAGIC(allocated_header, magic_number);
+    a->free_bytes -= needed_size;
+
+    return allocated_header;
+}
+
+/* Searches the free list for the first chunk big enough. Returns NULL if there is none. */
+static node *find_first_fit(arena *a, size_t needed_size)
+{
+    for (node *curr = a->free_list_head; curr; curr = free_chunk_next(curr))
+    {
+        if (chunk_size(curr) >= needed_size)
+        {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+/* Searches the free list for the first chunk big enough, starting where the last search left off and wrapping around. Returns NULL if there is none. */
+static node *find_next_fit(arena *a, size_t needed_size)
+{
+    node *start = a->rover ? a->rover : a->free_list_head;
+
+    for (node *curr = start; curr; curr = free_chunk_next(curr))
+    {
+        if (chunk_size(curr) >= needed_size)
+        {
+            return a->rover = curr;
+        }
+    }
+    for (node *curr = a->free_list_head; curr != start; curr = free_chunk_next(curr))
+    {
+        if (chunk_size(curr) >= needed_size)
+        {
+            return a->rover = curr;
+        }
+    }
+    return NULL;
+}
+
+/* Finds the smallest chunk big enough, the lowest addressed of them if there is a tie. Returns NULL if there is none. */
+static node *find_best_fit(arena *a, size_t needed_size)
+{
+    return (node *)tree_lower_bound(a, needed_size);
+}
+
+/* Finds the biggest chunk, the lowest addressed of them if there is a tie. Returns NULL if it is not big enough. */
+static node *find_worst_fit(arena *a, size_t needed_size)
+{
+    return !a->largest || needed_size > chunk_size(a->largest) ? NULL : (node *)a->largest;
+}
+
+/* Finds the first chunk in the smallest non-empty bin that is sure to fit. Returns NULL if no chunk is big enough. */
+static node *find_segregated_fit(arena *a, size_t needed_size)
+{
+    // Every chunk in a small bin is the same size, so the request's own bin fits. Bigger bins can hold chunks
+    // smaller than the request, so start from the next one up
+    size_t index = bin_index(needed_size);
+    size_t first_fit_bin = index < SMALL_BINS ? index : index + 1;
+    uint64_t fitting_bins = first_fit_bin < NUM_BINS ? a->bin_bitmap & (~0UL << first_fit_bin) : 0;
+
+    if (fitting_bins)
+    {
+        return a->bins[__builtin_ctzl(fitting_bins)];
+    }
+
+    // Last chance is a chunk in the request's own bin that happens to be big enough
+    for (node *curr = a->bins[index]; curr; curr = free_chunk_next(curr))
+    {
+        if (chunk_size(curr) >= needed_size)
+        {
+            return curr;
+        }
+    }
+    return NULL;
+}
+
+// Search function for each placement policy. Each returns a free chunk of at least the needed size, or NULL.
+static node *(*const find_fit[NUM_POLICIES])(arena *a, size_t needed_size) = {
+    [SEGREGATED_FIT] = find_segregated_fit,
+    [FIRST_FIT] = find_first_fit,
+    [NEXT_FIT] = find_next_fit,
+    [BEST_FIT] = find_best_fit,
+    [WORST_FIT] = find_worst_fit,
+};
+
+/* Maps length bytes for a region, a whole number of huge pages aligned to one with huge_pages set. Those come from the
+reserved huge pages if there are any, and are otherwise transparent huge pages the kernel backs them with as they are
+touched. Returns NULL if the mapping fails. */
+static void *map_region_pages(size_t length)
+{
+    if (!huge_pages)
+    {
+        void *start = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        return start == MAP_FAILED ? NULL : start;
+    }
+
+#if defined(MAP_HUGETLB)
+    void *reserved = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+    if (reserved != MAP_FAILED)
+    {
+        return reserved;
+    }
+#endif
+
+    // Map a huge page more than needed and cut off what lies outside the aligned range in it
+    void *start = mmap(NULL, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (start == MAP_FAILED)
+    {
+        return NULL;
+    }
+    size_t before = (HUGE_PAGE_SIZE - (uint64_t)start % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (before)
+    {
+        munmap(start, before);
+    }
+    munmap(start + before + length, HUGE_PAGE_SIZE - before);
+    start += before;
+#if defined(MADV_HUGEPAGE)
+    madvise(start, length, MADV_HUGEPAGE);
+#endif
+    return start;
+}
+
+/* Asks for the pages of a new mapping to come from the given NUMA node, unless it is -1 or there is only one node. The node
+is preferred rather than required, so when it runs out of memory the pages come from another node instead of the
+allocation failing. */
+static void bind_to_node(void *start, size_t length, int node)
+{
+#if defined(SYS_mbind)
+    if (node >= 0 && numa_nodes > 1)
+    {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, start, length, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+    }
+#endif
+}
+
+/* Maps a region with room for size bytes of chunks, adds it to the region list and puts its space in the free list. Returns NULL if the mapping fails. */
+static region *map_region(arena *a, size_t size)
+{
+    // The region struct goes after the chunks. mmap hands out whole pages anyway, so give the chunks the rest of the last page.
+    size_t unit = huge_pages ? HUGE_PAGE_SIZE : page_size;
+    size_t length = (size + sizeof(region) + unit - 1) / unit * unit;
+    void *start = map_region_pages(length);
+    if (!start)
+    {
+        return NULL;
+    }
+    // Nothing has touched the pages yet, so they are all placed by the policy
+    bind_to_node(start, length, a->node);
+
+    // The first region keeps its exact size so the heap size stays predictable, unless it is made of huge pages, which
+    // are only any use whole
+    if (!a->regions && !huge_pages)
+    {
+        length = size + sizeof(region);
+    }
+
+    region *new_region = (region *)(start + length - sizeof(region));
+    new_region->size = length - sizeof(region);
+    // Never free, but has the free chunk below it
+    new_region->fence.size_flags = REGION_FENCE | PREV_FREE;
+    SET_MAGIC(&new_region->fence, 0);
+
+    // Keep regions in address order so walking them follows a sorted free list
+    region **link = &a->regions;
+    while (*link && *link < new_region)
+    {
+        link = &(*link)->next;
+    }
+    new_region->next = *link;
+    *link = new_region;
+
+    // The whole region starts as one free chunk
+    node *chunk = (node *)start;
+    chunk->size_flags = (new_region->size - sizeof(node)) | CHUNK_FREE;
+    SET_MAGIC(chunk, 0);
+    *chunk_footer(chunk) = stored_size(chunk);
+    insert_free_chunk(a, chunk);
+    a->free_bytes += new_region->size;
+    a->mapped_bytes += length;
+
+    return new_region;
+}
+
+/* Grows the heap by mapping a region big enough for the needed size. Regions double in size each time, so the number of mmap calls only grows with the log of the heap size. Returns the new region, or NULL if the mapping fails. */
+static region *grow(arena *a, size_t needed_size)
+{
+    size_t size = a->next_region_size;
+    while (size < needed_size)
+    {
+        size *= 2;
+    }
+
+    region *new_region = map_region(a, size);
+    if (!new_region)
+    {
+        return NULL;
+    }
+
+    // Huge pages round regions up, so carry on doubling from what was really mapped
+    size_t mapped = huge_pages ? new_region->size : size;
+    a->next_region_size = mapped * 2 < MAX_REGION_SIZE ? mapped * 2 : MAX_REGION_SIZE;
+    return new_region;
+}
+
+/* Returns the biggest size that can be requested. */
+static size_t max_request_size()
+{
+    // Leaves room for the header and alignment below the top bits of the size word
+    return grow_heap ? SIZE_MASK / 2 : heap_size;
+}
+
+// Adds to a counter of the calling thread. Other threads only ever read it, so a plain add is enough, and the relaxed
+// store keeps them from seeing a torn value.
+#define BUMP(counter, amount) __atomic_store_n(&(counter), (counter) + (amount), __ATOMIC_RELAXED)
+// One search in this many is timed
+#define SEARCH_SAMPLE 64
+
+/* Moves the counters of a thread that is exiting into the retired counters. */
+static void retire_thread_stats(__attribute__((unused)) void *unused)
+{
+    pthread_mutex_lock(&stats_lock);
+    for (size_t i = 0; i < NUM_BINS; i++)
+    {
+        retired_stats.allocations[i] += stats.allocations[i];
+    }
+    retired_stats.failed_allocations += stats.failed_allocations;
+    retired_stats.frees += stats.frees;
+    retired_stats.allocated_bytes += stats.allocated_bytes;
+    retired_stats.freed_bytes += stats.freed_bytes;
+    retired_stats.searches += stats.searches;
+    retired_stats.search_ns += stats.search_ns;
+    retired_stats.remote_frees += stats.remote_frees;
+
+    if (stats.prev)
+    {
+        stats.prev->next = stats.next;
+    }
+    else
+    {
+        all_stats = stats.next;
+    }
+    if (stats.next)
+    {
+        stats.next->prev = stats.prev;
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    // Anything counted by a later destructor starts over on a new entry
+    memset(&stats, 0, sizeof(stats));
+}
+
+static void create_stats_key()
+{
+    pthread_key_create(&stats_key, retire_thread_stats);
+}
+
+/* Adds the calling thread's counters to the list of every thread's. */
+static void register_thread_stats()
+{
+    pthread_once(&stats_key_once, create_stats_key);
+    pthread_setspecific(stats_key, &stats);
+    pthread_mutex_lock(&stats_lock);
+    stats.prev = NULL;
+    stats.next = all_stats;
+    if (all_stats)
+    {
+        all_stats->prev = &stats;
+    }
+    all_stats = &stats;
+    stats.registered = true;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Counts an allocation of the given size that returned ptr, which failed if ptr is NULL. Returns ptr. */
+static void *count_allocation(void *ptr, size_t size)
+{
+    if (!stats.registered)
+    {
+        register_thread_stats();
+    }
+    if (!ptr)
+    {
+        BUMP(stats.failed_allocations, 1);
+        return NULL;
+    }
+    BUMP(stats.allocations[bin_index(align(size))], 1);
+    BUMP(stats.allocated_bytes, my_malloc_usable_size(ptr));
+    return ptr;
+}
+
+/* Counts a free of an allocation with usable_size bytes. */
+static void count_free(size_t usable_size)
+{
+    if (!stats.registered)
+    {
+        register_thread_stats();
+    }
+    BUMP(stats.frees, 1);
+    BUMP(stats.freed_bytes, usable_size);
+}
+
+/* Counts an allocation resized in place from old_size usable bytes to new_size. */
+static void count_resize(size_t old_size, size_t new_size)
+{
+    if (!stats.registered)
+    {
+        register_thread_stats();
+    }
+    BUMP(stats.freed_bytes, old_size);
+    BUMP(stats.allocated_bytes, new_size);
+}
+
+/* Searches an arena for a free chunk with the placement policy. Reading the clock costs as much as a short search, so only
+one search in SEARCH_SAMPLE is timed, and it stands for the others. */
+static node *search(arena *a, size_t needed_size)
+{
+    if (!stats.registered)
+    {
+        register_thread_stats();
+    }
+    BUMP(stats.searches, 1);
+    if (stats.searches % SEARCH_SAMPLE)
+    {
+        return find_fit[fit_policy](a, needed_size);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    node *chunk = find_fit[fit_policy](a, needed_size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    BUMP(stats.search_ns, ((end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec) * SEARCH_SAMPLE);
+    return chunk;
+}
+
+/* Returns the size of the biggest free chunk in an arena. Only bins that could hold it are looked through, but the other
+policies have to walk the whole free list. Must hold the arena's lock. */
+static size_t largest_free_chunk(arena *a)
+{
+    if (size_indexed())
+    {
+        return a->largest ? chunk_size(a->largest) : 0;
+    }
+
+    node *first = a->free_list_head;
+    if (fit_policy == SEGREGATED_FIT)
+    {
+        first = a->bin_bitmap ? a->bins[63 - __builtin_clzl(a->bin_bitmap)] : NULL;
+    }
+
+    size_t largest = 0;
+    for (node *curr = first; curr; curr = free_chunk_next(curr))
+    {
+        largest = chunk_size(curr) > largest ? chunk_size(curr) : largest;
+    }
+    return largest;
+}
+
+/* Fills in statistics of the heap. Allocation counters are summed over every thread, and each arena is locked in turn
+for its free chunks, so it is only a snapshot if other threads are allocating. */
+void my_malloc_stats(heap_stats *out)
+{
+    thread_stats total;
+    pthread_mutex_lock(&stats_lock);
+    total = retired_stats;
+    for (thread_stats *s = all_stats; s; s = s->next)
+    {
+        for (size_t i = 0; i < NUM_BINS; i++)
+        {
+            total.allocations[i] += __atomic_load_n(&s->allocations[i], __ATOMIC_RELAXED);
+        }
+        total.failed_allocations += __atomic_load_n(&s->failed_allocations, __ATOMIC_RELAXED);
+        total.frees += __atomic_load_n(&s->frees, __ATOMIC_RELAXED);
+        total.allocated_bytes += __atomic_load_n(&s->allocated_bytes, __ATOMIC_RELAXED);
+        total.freed_bytes += __atomic_load_n(&s->freed_bytes, __ATOMIC_RELAXED);
+        total.searches += __atomic_load_n(&s->searches, __ATOMIC_RELAXED);
+        total.search_ns += __atomic_load_n(&s->search_ns, __ATOMIC_RELAXED);
+        total.remote_frees += __atomic_load_n(&s->remote_frees, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&stats_lock);
+
+    memset(out, 0, sizeof(*out));
+    size_t allocations = 0;
+    for (size_t i = 0; i < NUM_BINS; i++)
+    {
+        out->allocations[i] = total.allocations[i];
+        allocations += total.allocations[i];
+    }
+    out->in_use_bytes = total.allocated_bytes - total.freed_bytes;
+    out->in_use_count = allocations - total.frees;
+    out->failed_allocations = total.failed_allocations;
+    out->searches = total.searches;
+    out->search_ns = total.search_ns;
+    out->remote_frees = total.remote_frees;
+
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        out->free_bytes += a->free_bytes;
+        out->free_chunks += a->free_chunks;
+        size_t largest = largest_free_chunk(a);
+        out->largest_free_chunk = largest > out->largest_free_chunk ? largest : out->largest_free_chunk;
+        pthread_mutex_unlock(&a->lock);
+    }
+    out->footprint = heap_footprint();
+}
+
+/* Adds a chunk found walking the heap to the fragmentation. */
+static void count_fragment(fragmentation *frag, void *chunk)
+{
+    if (!chunk_is_free(chunk))
+    {
+        return;
+    }
+    size_t size = chunk_size(chunk);
+    frag->free_bytes += size;
+    frag->free_chunks++;
+    frag->largest_free_chunk = size > frag->largest_free_chunk ? size : frag->largest_free_chunk;
+    frag->free_chunks_by_bin[bin_index(size)]++;
+}
+
+/* Works out the ratios once every chunk has been counted. */
+static void finish_fragmentation(fragmentation *frag)
+{
+    frag->largest_to_free = frag->free_bytes ? (double)frag->largest_free_chunk / frag->free_bytes : 1;
+    frag->external = 1 - frag->largest_to_free;
+}
+
+/* Measures the fragmentation of the free space by walking every chunk of every arena, the same walk the audit makes, so
+it does not depend on the placement policy. Chunks in thread caches and quick lists count as allocated, and slab objects and mapped chunks
+are not part of the arenas. */
+void heap_fragmentation(fragmentation *frag)
+{
+    memset(frag, 0, sizeof(*frag));
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        for (region *r = a->regions; r; r = r->next)
+        {
+            for (void *chunk = region_start(r); chunk < (void *)r; chunk += chunk_size(chunk))
+            {
+                count_fragment(frag, chunk);
+            }
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    finish_fragmentation(frag);
+}
+
+// Buffers the heap map on the stack. stdio could call malloc and deadlock on the arena lock held during the walk.
+typedef struct map_writer_t
+{
+    int fd;
+    size_t length;
+    char buffer[4096];
+} map_writer;
+
+static void flush_map(map_writer *w)
+{
+    size_t written = 0;
+    while (written < w->length)
+    {
+        ssize_t result = write(w->fd, w->buffer + written, w->length - written);
+        if (result <= 0)
+        {
+            break;
+        }
+        written += result;
+    }
+    w->length = 0;
+}
+
+/* Appends formatted text to the map, which is never longer than 256 bytes at a time. */
+static void write_map(map_writer *w, const char *format, ...)
+{
+    if (w->length + 256 > sizeof(w->buffer))
+    {
+        flush_map(w);
+    }
+    va_list args;
+    va_start(args, format);
+    w->length += vsnprintf(w->buffer + w->length, sizeof(w->buffer) - w->length, format, args);
+    va_end(args);
+}
+
+/* Writes the layout of every arena as one line of JSON, so a file of snapshots taken over time can be read a line at a
+time. Each region has its address and size, and its chunks in address order as [offset in the region, size, state], where
+the state is "a" for allocated, "c" for in a thread cache or quick list and "f" for free. The fragmentation found on the same walk comes
+last. Arenas are locked one at a time, so the map is only a consistent snapshot while other threads are not allocating. */
+void export_heap_map(int fd)
+{
+    map_writer w = {.fd = fd};
+    fragmentation frag;
+    memset(&frag, 0, sizeof(frag));
+
+    write_map(&w, "{\"footprint\": %zu, \"arenas\": [", heap_footprint());
+    bool first_arena = true;
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        arena *a = &arenas[i];
+        pthread_mutex_lock(&a->lock);
+        if (a->regions)
+        {
+            write_map(&w, "%s{\"index\": %zu, \"regions\": [", first_arena ? "" : ", ", i);
+            first_arena = false;
+        }
+        for (region *r = a->regions; r; r = r->next)
+        {
+            write_map(&w, "{\"address\": %" PRIuPTR ", \"size\": %zu, \"chunks\": [", (uintptr_t)region_start(r), r->size);
+            for (void *chunk = region_start(r); chunk < (void *)r; chunk += chunk_size(chunk))
+            {
+                const char *state = chunk_is_free(chunk) ? "f" : chunk_is_cached(chunk) ? "c" : "a";
+                write_map(&w, "%s[%zu, %zu, \"%s\"]", chunk == region_start(r) ? "" : ", ", (size_t)(chunk - region_start(r)), chunk_size(chunk), state);
+                count_fragment(&frag, chunk);
+            }
+            write_map(&w, "]}%s", r->next ? ", " : "");
+        }
+        if (a->regions)
+        {
+            write_map(&w, "]}");
+        }
+        pthread_mutex_unlock(&a->lock);
+    }
+    finish_fragmentation(&frag);
+
+    write_map(&w, "], \"fragmentation\": {\"free_bytes\": %zu, \"free_chunks\": %zu, \"largest_free_chunk\": %zu, ", frag.free_bytes, frag.free_chunks, frag.largest_free_chunk);
+    write_map(&w, "\"external\": %.6f, \"largest_to_free\": %.6f, \"free_chunks_by_bin\": [", frag.external, frag.largest_to_free);
+    for (size_t i = 0; i < NUM_BINS; i++)
+    {
+        write_map(&w, "%s%zu", i ? ", " : "", frag.free_chunks_by_bin[i]);
+    }
+    write_map(&w, "]}}\n");
+    flush_map(&w);
+}
+
+/* Zeroes the counters of every thread. Must not be called while other threads are using the heap. */
+static void reset_stats()
+{
+    pthread_mutex_lock(&stats_lock);
+    for (thread_stats *s = all_stats; s; s = s->next)
+    {
+        thread_stats *next = s->next;
+        thread_stats *prev = s->prev;
+        memset(s, 0, sizeof(*s));
+        s->next = next;
+        s->prev = prev;
+        s->registered = true;
+    }
+    memset(&retired_stats, 0, sizeof(retired_stats));
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/* Frees a chunk back to the arena it came from. Returns the free chunk it was merged into, or NULL if that made its
+region entirely free and the region was unmapped. Must hold the arena's lock. */
+static node *heap_free(arena *a, void *ptr)
+{
+    header *hptr = (header *)ptr - 1;
+    CHECK_MAGIC(hptr);
+
+    // The node overlaps the header, so the boundary tag bit carries over
+    node *new_free_chunk = (node *)hptr;
+    new_free_chunk->size_flags = (stored_size(hptr) + sizeof(header) - sizeof(node)) | (hptr->size_flags & PREV_FREE) | CHUNK_FREE;
+    SET_MAGIC(new_free_chunk, 0);
+
+    // Merge with neighbours and link into free list
+    return coalesce(a, new_free_chunk);
+}
+
+/* Returns the chunk after a chunk in a thread cache or quick list, which is linked through the first word of its data. */
+header *cache_next(header *chunk)
+{
+    header *next = protect_link(chunk + 1, *(header **)(chunk + 1));
+    if (harden_heap && (uintptr_t)next % ALIGN_TO)
+    {
+        heap_corrupted("corrupted chunk cache");
+    }
+    return next;
+}
+
+/* Coalesces every chunk in the arena's quick lists and puts them in its free lists, in one pass. Must hold the arena's lock. */
+static void consolidate(arena *a)
+{
+    for (size_t i = 0; i < SMALL_BINS; i++)
+    {
+        while (a->quick_lists[i])
+        {
+            header *chunk = a->quick_lists[i];
+            a->quick_lists[i] = cache_next(chunk);
+            __atomic_fetch_and(&chunk->size_flags, ~CHUNK_CACHED, __ATOMIC_RELAXED);
+            heap_free(a, chunk + 1);
+        }
+    }
+    a->quick_bytes = 0;
+}
+
+/* Puts a freed small chunk on its arena's quick list for its exact size instead of coalescing it, coalescing the whole of
+the quick lists once they outgrow their budget. Must hold the arena's lock. */
+static void quick_free(arena *a, header *chunk)
+{
+    size_t index = chunk_size(chunk) / ALIGN_TO;
+    __atomic_fetch_or(&chunk->size_flags, CHUNK_CACHED, __ATOMIC_RELAXED);
+    *(header **)(chunk + 1) = protect_link(chunk + 1, a->quick_lists[index]);
+    a->quick_lists[index] = chunk;
+    a->quick_bytes += chunk_size(chunk);
+
+    if (a->quick_bytes > quick_list_budget)
+    {
+        consolidate(a);
+    }
+}
+
+/* Takes a chunk of exactly needed_size bytes from the arena's quick lists. Returns NULL if there is none. Must hold the
+arena's lock. */
+static void *quick_malloc(arena *a, size_t needed_size)
+{
+    size_t index = needed_size / ALIGN_TO;
+    header *chunk = index < SMALL_BINS ? a->quick_lists[index] : NULL;
+    if (!chunk)
+    {
+        return NULL;
+    }
+    a->quick_lists[index] = cache_next(chunk);
+    a->quick_bytes -= needed_size;
+    __atomic_fetch_and(&chunk->size_flags, ~CHUNK_CACHED, __ATOMIC_RELAXED);
+    return chunk + 1;
+}
+
+/* Maps the first region of an arena. Arenas other than the main one get it when a thread first uses them. Returns NULL if
+the mapping fails. */
+static region *map_first_region(arena *a)
+{
+    region *r = map_region(a, heap_size);
+    if (r)
+    {
+        a->heap_pointer = region_start(r);
+        a->next_region_size = 2 * r->size;
+    }
+    return r;
+}
+
+/* Allocates from an arena. If fresh is not NULL, it is set when the chunk came from a region mapped by this call, so
+the OS has zeroed it. Must hold the arena's lock. */
+static void *heap_malloc(arena *a, size_t size, bool *fresh)
+{
+    region *mapped = NULL;
+    if (!a->regions && !(mapped = map_first_region(a)))
+    {
+        return NULL;
+    }
+
+    // Nothing here prints, since printf can call malloc when this is standing in for it
+    // If there are no free chunks and no way to get more
+    if (!grow_heap && !a->free_list_head && !a->bin_bitmap && !a->quick_bytes)
+    {
+        return NULL;
+    }
+
+    // If they enter a negative number the size will overflow to the max integer so this will fire
+    if (size > max_request_size())
+    {
+        return NULL;
+    }
+    // Not sure if this is supposed to happen but it makes sense to deny a request of size 0
+    else if (size == 0)
+    {
+        return NULL;
+    }
+
+    size_t needed_size = align(size);
+
+    // A chunk of the same size freed a moment ago is used as it is
+    void *quick = a->quick_bytes ? quick_malloc(a, needed_size) : NULL;
+    if (quick)
+    {
+        if (fresh)
+        {
+            *fresh = false;
+        }
+        return quick;
+    }
+
+    node *chunk = search(a, needed_size);
+
+    // The quick lists may hold the space needed in pieces, so coalesce them before asking for more
+    if (!chunk && a->quick_bytes)
+    {
+        consolidate(a);
+        chunk = search(a, needed_size);
+    }
+
+    // Map another region if nothing fits
+    if (!chunk && grow_heap && (mapped = grow(a, needed_size)))
+    {
+        chunk = search(a, needed_size);
+    }
+
+    // If there is no chunk big enough return NULL
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    if (fresh)
+    {
+        *fresh = mapped && (void *)chunk == region_start(mapped);
+    }
+
+    // Cut chunk down to size
+    header *allocated_address = split(a, chunk, needed_size) + 1;
+
+    return (void *)allocated_address;
+}
+
+/* Cuts an allocated chunk down to needed_size bytes, freeing the rest if it is big enough to be its own chunk. Must hold the arena's lock. */
+static void shrink(arena *a, header *chunk, size_t needed_size)
+{
+    size_t total_size = chunk_size(chunk);
+    if (total_size - needed_size < min_chunk_size())
+    {
+        return;
+    }
+
+    // Give the rest a header of its own and free it, which merges it with the chunk after if that is free
+    header *rest = (header *)((void *)chunk + needed_size);
+    rest->size_flags = (total_size - needed_size - sizeof(header)) | a->index << ARENA_SHIFT;
+    SET_MAGIC(rest, magic_number);
+    set_size(chunk, needed_size - sizeof(header));
+    heap_free(a, rest + 1);
+}
+
+/* Grows an allocated chunk to at least needed_size bytes by taking space from the free chunk after it.
+Returns false if that chunk is not free or not big enough. Must hold the arena's lock. */
+static bool expand(arena *a, header *chunk, size_t needed_size)
+{
+    size_t total_size = chunk_size(chunk);
+    node *next = (node *)((void *)chunk + total_size);
+    if (!chunk_is_free(next) || total_size + chunk_size(next) < needed_size)
+    {
+        return false;
+    }
+
+    // Take at least a whole chunk, so the part left free doesn't overlap the node it replaces in the free list
+    size_t extra = needed_size - total_size;
+    extra = extra < min_chunk_size() ? min_chunk_size() : extra;
+    extra = extra > chunk_size(next) ? chunk_size(next) : extra;
+    set_size(chunk, stored_size(chunk) + chunk_size(split(a, next, extra)));
+    return true;
+}
+
+/* Gives every chunk in the calling thread's cache back to the arena it came from. */
+void flush_thread_cache()
+{
+    for (size_t i = 0; i < SMALL_BINS; i++)
+    {
+        while (cache.entries[i])
+        {
+            header *chunk = cache.entries[i];
+            cache.entries[i] = cache_next(chunk);
+            arena *a = chunk_arena(chunk);
+            pthread_mutex_lock(&a->lock);
+            __atomic_fetch_and(&chunk->size_flags, ~CHUNK_CACHED, __ATOMIC_RELAXED);
+            heap_free(a, chunk + 1);
+            pthread_mutex_unlock(&a->lock);
+        }
+        cache.counts[i] = 0;
+    }
+}
+
+/* Coalesces the chunks in the quick lists of every arena, so all the free space is in the free lists. */
+void consolidate_heap()
+{
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        pthread_mutex_lock(&arenas[i].lock);
+        consolidate(&arenas[i]);
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+}
+
+/* Flushes the cache of a thread that is exiting. */
+static void flush_exiting_thread_cache(__attribute__((unused)) void *unused)
+{
+    flush_thread_cache();
+}
+
+static void create_cache_key()
+{
+    pthread_key_create(&cache_key, flush_exiting_thread_cache);
+}
+
+/* Initializes the heap unless init_heap() was already called, with the options in the HEAP_OPTIONS_ENV environment
+variable on top of those already set. Nothing can be printed here, so a bad entry gets a plain write to stderr. */
+static void init_heap_once()
+{
+    if (!active_arenas)
+    {
+        heap_options options;
+        get_heap_options(&options);
+        if (!parse_heap_options(&options, getenv(HEAP_OPTIONS_ENV)))
+        {
+            const char message[] = "Ignoring bad entries in " HEAP_OPTIONS_ENV "\n";
+            write(STDERR_FILENO, message, sizeof(message) - 1);
+        }
+        init_heap_with_options(&options);
+    }
+}
+
+/* Returns the NUMA node the calling thread is running on, which is 0 on machines without NUMA. */
+int numa_node()
+{
+    int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < MAX_NUMA_CPUS ? cpu_nodes[cpu] : 0;
+}
+
+/* Returns the arena the calling thread should allocate from, initializing the heap first if nothing has yet. Threads keep
+the arena they are first handed with round robin assignment, or use the arena of the CPU they are running on. With by
+node assignment, they keep the arena they are handed until they find themselves on another node. */
+static arena *current_arena()
+{
+    pthread_once(&heap_once, init_heap_once);
+
+    if (active_arenas == 1)
+    {
+        return main_arena;
+    }
+
+    if (arena_policy == BY_CPU)
+    {
+        int cpu = sched_getcpu();
+        return &arenas[cpu < 0 ? 0 : cpu % active_arenas];
+    }
+
+    if (arena_policy == BY_NODE)
+    {
+        // Arena i is on node i % numa_nodes, so hand out the node's arenas in turn
+        int node = numa_node();
+        if (!assigned_arena || assigned_arena->node != node || assigned_arena->index >= active_arenas)
+        {
+            size_t node_arenas = (active_arenas - node + numa_nodes - 1) / numa_nodes;
+            size_t turn = __atomic_fetch_add(&next_node_arena[node], 1, __ATOMIC_RELAXED) % node_arenas;
+            assigned_arena = &arenas[node + turn * numa_nodes];
+        }
+        return assigned_arena;
+    }
+
+    // The heap may have been initialized again with fewer arenas since
+    if (!assigned_arena || assigned_arena->index >= active_arenas)
+    {
+        assigned_arena = &arenas[__atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % active_arenas];
+    }
+    return assigned_arena;
+}
+
+/* Takes a chunk for a small request from the calling thread's cache without taking a lock. Returns NULL if there is none. */
+static void *cache_malloc(size_t size)
+{
+    if (thread_cache && size > 0 && size < SMALL_BINS * ALIGN_TO)
+    {
+        size_t index = align(size) / ALIGN_TO;
+        header *chunk = index < SMALL_BINS ? cache.entries[index] : NULL;
+        if (chunk)
+        {
+            cache.entries[index] = cache_next(chunk);
+            cache.counts[index]--;
+            __atomic_fetch_and(&chunk->size_flags, ~CHUNK_CACHED, __ATOMIC_RELAXED);
+            return chunk + 1;
+        }
+    }
+    return NULL;
+}
+
+/* Returns true if a request is big enough to get a mapping of its own. Requests too big for any heap are still refused, and
+so are requests for 0 bytes, even with a threshold of 0. */
+static bool use_mapping(size_t size)
+{
+    return size > 0 && size >= mmap_threshold && size <= SIZE_MASK / 2;
+}
+
+/* Returns the length of the mapping for a mapped chunk of the given size, in whole pages. */
+static size_t mapping_length(size_t size)
+{
+    return (size + sizeof(header) + page_size - 1) / page_size * page_size;
+}
+
+/* Gives a request a mapping of its own, with a header at the start marking it as mapped. Such chunks never touch an arena,
+so they take no lock and leave no hole in the heap when freed. Returns NULL if the mapping fails. */
+static void *mapped_malloc(size_t size)
+{
+    // The page size is only known once the heap is initialized
+    pthread_once(&heap_once, init_heap_once);
+
+    size_t length = mapping_length(size);
+    header *chunk = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (chunk == MAP_FAILED)
+    {
+        return NULL;
+    }
+    chunk->size_flags = (length - sizeof(header)) | CHUNK_MAPPED;
+    SET_MAGIC(chunk, magic_number);
+    __atomic_add_fetch(&mapped_chunk_bytes, length, __ATOMIC_RELAXED);
+    return chunk + 1;
+}
+
+/* Unmaps a mapped chunk. */
+static void mapped_free(header *chunk)
+{
+    size_t length = stored_size(chunk) + sizeof(header);
+    __atomic_sub_fetch(&mapped_chunk_bytes, length, __ATOMIC_RELAXED);
+    munmap(chunk, length);
+}
+
+/* Resizes a mapped chunk with mremap, which moves the pages to a new address instead of copying them if it can't grow in
+place. Returns NULL if that fails, in which case the chunk is left alone. */
+static void *mapped_realloc(header *chunk, size_t size)
+{
+    size_t old_length = stored_size(chunk) + sizeof(header);
+    size_t length = mapping_length(size);
+    if (length == old_length)
+    {
+        return chunk + 1;
+    }
+
+    header *moved = mremap(chunk, old_length, length, MREMAP_MAYMOVE);
+    if (moved == MAP_FAILED)
+    {
+        return NULL;
+    }
+    moved->size_flags = (length - sizeof(header)) | CHUNK_MAPPED;
+    __atomic_add_fetch(&mapped_chunk_bytes, length - old_length, __ATOMIC_RELAXED);
+    return moved + 1;
+}
+
+/* Aborts unless the header is that of an allocated chunk. Freeing or caching a chunk always sets a bit in its header or in
+the header of the chunk after it, so a double free is caught in constant time. */
+static void check_allocated(header *chunk)
+{
+    if ((uintptr_t)chunk % ALIGN_TO || stored_size(chunk) < MIN_CHUNK_SIZE - sizeof(header))
+    {
+        heap_corrupted("free(): invalid pointer");
+    }
+    if (chunk_is_free(chunk) || chunk_is_cached(chunk))
+    {
+        heap_corrupted("free(): double free detected");
+    }
+    if (chunk->size_flags & CHUNK_MAPPED)
+    {
+        return;
+    }
+    // A chunk merged into the free chunk before it keeps its own stale header, but the chunk after then sees a free neighbour
+    if (chunk_arena(chunk)->index >= active_arenas || ((header *)((void *)chunk + chunk_size(chunk)))->size_flags & PREV_FREE)
+    {
+        heap_corrupted("free(): double free or corruption");
+    }
+}
+
+/* Allocates a chunk the heap profiler sampled, zeroed if asked. It always comes from an arena or a mapping, even if it would
+fit a slab or the thread cache, so it has a header to carry the flag that tells my_free to drop the sample. Kept out of line,
+since it is rare and the paths it is called from are not. */
+__attribute__((noinline)) static void *sampled_malloc(size_t size, bool zero)
+{
+    void *ptr;
+    if (use_mapping(size))
+    {
+        ptr = mapped_malloc(size);
+    }
+    else
+    {
+        arena *a = current_arena();
+        pthread_mutex_lock(&a->lock);
+        ptr = heap_malloc(a, size, NULL);
+        pthread_mutex_unlock(&a->lock);
+        if (ptr && zero)
+        {
+            memset(ptr, 0, size);
+        }
+    }
+    if (ptr)
+    {
+        // Other threads can update the previous free flag of an allocated chunk when its neighbours are freed
+        __atomic_fetch_or(&((header *)ptr - 1)->size_flags, CHUNK_SAMPLED, __ATOMIC_RELAXED);
+        record_sample(ptr, size);
+    }
+    return ptr;
+}
+
+/* Returns pointer to memory. Returns NULL if there is not enough space. */
+void *my_malloc(size_t size)
+{
+    // The only cost of the profiler when it is off
+    if (__builtin_expect(profile_interval != 0, 0) && sample_allocation(size))
+    {
+        return count_allocation(sampled_malloc(size, false), size);
+    }
+
+    // Small requests are served from slabs, then from the thread cache
+    void *ptr = use_slabs ? slab_malloc(size) : NULL;
+    if (!ptr)
+    {
+        ptr = cache_malloc(size);
+    }
+    if (!ptr && use_mapping(size))
+    {
+        ptr = mapped_malloc(size);
+    }
+    else if (!ptr)
+    {
+        arena *a = current_arena();
+        pthread_mutex_lock(&a->lock);
+        ptr = heap_malloc(a, size, NULL);
+        pthread_mutex_unlock(&a->lock);
+    }
+    return count_allocation(ptr, size);
+}
+
+/* Frees the allocated chunk starting at the pointer passed in. Slab objects go back to their slab and mapped chunks are unmapped. Small chunks go in the thread cache if it has room, otherwise
+the chunk is coalesced with its neighbours and put in the free list of the arena it came from, or with deferred coalescing
+small chunks go on the arena's quick list for their size. Chunks can be freed from any thread.
+Does nothing if ptr is NULL. */
+void my_free(void *ptr)
+{
+    if (!ptr)
+    {
+        return;
+    }
+    if (is_slab_object(ptr))
+    {
+        count_free(slab_object_size(ptr));
+        slab_free(ptr);
+        return;
+    }
+
+    header *hptr = (header *)ptr - 1;
+    CHECK_MAGIC(hptr);
+    if (harden_heap)
+    {
+        check_allocated(hptr);
+    }
+    count_free(stored_size(hptr));
+    if (hptr->size_flags & CHUNK_SAMPLED)
+    {
+        forget_sample(ptr);
+        __atomic_fetch_and(&hptr->size_flags, ~CHUNK_SAMPLED, __ATOMIC_RELAXED);
+    }
+    if (hptr->size_flags & CHUNK_MAPPED)
+    {
+        mapped_free(hptr);
+        return;
+    }
+    if (arena_policy == BY_NODE && chunk_arena(hptr)->node != numa_node())
+    {
+        BUMP(stats.remote_frees, 1);
+    }
+
+    // The cached flag is set atomically, since other threads can update the previous free flag of an allocated chunk
+    // when its neighbours are freed
+    size_t index = chunk_size(hptr) / ALIGN_TO;
+    if (thread_cache && index < SMALL_BINS && cache.counts[index] < thread_cache_limit)
+    {
+        if (!cache.registered)
+        {
+            pthread_once(&cache_key_once, create_cache_key);
+            pthread_setspecific(cache_key, &cache);
+            cache.registered = true;
+        }
+        __atomic_fetch_or(&hptr->size_flags, CHUNK_CACHED, __ATOMIC_RELAXED);
+        *(header **)ptr = protect_link(ptr, cache.entries[index]);
+        cache.entries[index] = hptr;
+        cache.counts[index]++;
+        return;
+    }
+
+    // The arena bits never change while the chunk is allocated, so they can be read before taking the lock
+    arena *a = chunk_arena(hptr);
+    pthread_mutex_lock(&a->lock);
+    if (defer_coalescing && index < SMALL_BINS)
+    {
+        quick_free(a, hptr);
+    }
+    else
+    {
+        heap_free(a, ptr);
+    }
+    pthread_mutex_unlock(&a->lock);
+}
+
+/* Carves up to max chunks of needed_size bytes from the start of a free chunk with a single split, and stores pointers to
+them in out. The last one keeps any space left over that is too small to be a free chunk. Returns how many were carved.
+Must hold the arena's lock. */
+static size_t carve(arena *a, node *chunk, size_t needed_size, size_t max, void **out)
+{
+    size_t count = chunk_size(chunk) / needed_size;
+    count = count < max ? count : max;
+    header *run = split(a, chunk, count * needed_size);
+    size_t run_size = chunk_size(run);
+
+    // The chunk before the run is never free, and neither is any chunk inside it
+    for (size_t i = 0; i < count; i++)
+    {
+        header *piece = (header *)((void *)run + i * needed_size);
+        size_t piece_size = i == count - 1 ? run_size - i * needed_size : needed_size;
+        piece->size_flags = (piece_size - sizeof(header)) | a->index << ARENA_SHIFT;
+        SET_MAGIC(piece, magic_number);
+        out[i] = piece + 1;
+    }
+    return count;
+}
+
+/* Finds a free chunk to carve count chunks of needed_size bytes from, preferring one that holds them all, then coalescing
+the quick lists, then one that holds at least one, then mapping a region big enough for all of them. Returns NULL if
+nothing fits. Must hold the arena's lock. */
+static node *find_run(arena *a, size_t needed_size, size_t count)
+{
+    // A single chunk that aligns to more than the biggest request still only asks for itself
+    size_t most = max_request_size() / needed_size;
+    most = most ? most : 1;
+    size_t run_size = (count < most ? count : most) * needed_size;
+
+    node *chunk = search(a, run_size);
+    if (!chunk && a->quick_bytes)
+    {
+        consolidate(a);
+        chunk = search(a, run_size);
+    }
+    if (!chunk)
+    {
+        chunk = search(a, needed_size);
+    }
+    if (!chunk && grow_heap && grow(a, run_size))
+    {
+        chunk = search(a, run_size);
+    }
+    return chunk;
+}
+
+/* Allocates count chunks of size bytes at once and stores pointers to them in out. They are carved from as few free chunks
+as possible, each with a single search and split under one lock, so a batch of chunks sits side by side. Requests that
+would come from slabs, get a mapping of their own or be sampled by the profiler are allocated one at a time as usual.
+Returns how many were allocated, which is less than count if the heap ran out. */
+size_t my_malloc_batch(size_t size, size_t count, void **out)
+{
+    size_t allocated = 0;
+    if (__builtin_expect(profile_interval != 0, 0) || (use_slabs && size <= SLAB_MAX_SIZE) || use_mapping(size) || size == 0 || size > max_request_size())
+    {
+        while (allocated < count && (out[allocated] = my_malloc(size)))
+        {
+            allocated++;
+        }
+        return allocated;
+    }
+
+    size_t needed_size = align(size);
+    arena *a = current_arena();
+    pthread_mutex_lock(&a->lock);
+    if (a->regions || map_first_region(a))
+    {
+        node *chunk;
+        while (allocated < count && (chunk = find_run(a, needed_size, count - allocated)))
+        {
+            allocated += carve(a, chunk, needed_size, count - allocated, out + allocated);
+        }
+    }
+    pthread_mutex_unlock(&a->lock);
+
+    for (size_t i = 0; i < allocated; i++)
+    {
+        count_allocation(out[i], size);
+    }
+    if (allocated < count)
+    {
+        count_allocation(NULL, size);
+    }
+    return allocated;
+}
+
+/* Moves the pointer at index root of a binary max heap of count pointers down until it is bigger than its children. */
+static void sift_down(void **ptrs, size_t root, size_t count)
+{
+    void *moving = ptrs[root];
+    for (size_t child; (child = 2 * root + 1) < count; root = child)
+    {
+        if (child + 1 < count && ptrs[child + 1] > ptrs[child])
+        {
+            child++;
+        }
+        if (ptrs[child] <= moving)
+        {
+            break;
+        }
+        ptrs[root] = ptrs[child];
+    }
+    ptrs[root] = moving;
+}
+
+/* Sorts pointers by address in place with heapsort, which needs no memory of its own, unlike qsort, and compares inline. */
+static void sort_addresses(void **ptrs, size_t count)
+{
+    // A batch is often freed in the order it was allocated, which is already sorted
+    size_t sorted = 1;
+    while (sorted < count && ptrs[sorted - 1] <= ptrs[sorted])
+    {
+        sorted++;
+    }
+    if (sorted >= count)
+    {
+        return;
+    }
+
+    for (size_t i = count / 2; i-- > 0;)
+    {
+        sift_down(ptrs, i, count);
+    }
+    for (size_t end = count; end-- > 1;)
+    {
+        void *largest = ptrs[0];
+        ptrs[0] = ptrs[end];
+        ptrs[end] = largest;
+        sift_down(ptrs, 0, end);
+    }
+}
+
+/* Frees count allocations at once, skipping NULLs. The pointers are sorted by address in place, and what is left in ptrs
+afterwards is not meaningful. Chunks of the batch that sit side by side are merged with each other before they are freed,
+and the sorted free list of each arena is walked once for the whole batch instead of once for each chunk. Slab objects
+and mapped chunks are freed as usual, and nothing goes in a thread cache or quick list. */
+void my_free_batch(void **ptrs, size_t count)
+{
+    sort_addresses(ptrs, count);
+
+    // Deal with everything that doesn't go back to an arena first, keeping the rest at the front of the array. Only
+    // entries before the one being looked at are overwritten, and each with itself or one before it, so ptrs[i - 1] is
+    // still the previous pointer in sorted order.
+    int node = arena_policy == BY_NODE ? numa_node() : -1;
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        void *ptr = ptrs[i];
+        if (!ptr)
+        {
+            continue;
+        }
+        // Sorting puts a pointer freed twice in the same batch next to itself. Its header may already be unmapped, so this
+        // is checked before anything reads it.
+        if (i > 0 && ptrs[i - 1] == ptr)
+        {
+            if (harden_heap)
+            {
+                heap_corrupted("free(): double free detected");
+            }
+            continue;
+        }
+        if (is_slab_object(ptr))
+        {
+            count_free(slab_object_size(ptr));
+            slab_free(ptr);
+            continue;
+        }
+
+        header *hptr = (header *)ptr - 1;
+        CHECK_MAGIC(hptr);
+        if (harden_heap)
+        {
+            check_allocated(hptr);
+        }
+        count_free(stored_size(hptr));
+        if (hptr->size_flags & CHUNK_SAMPLED)
+        {
+            forget_sample(ptr);
+            __atomic_fetch_and(&hptr->size_flags, ~CHUNK_SAMPLED, __ATOMIC_RELAXED);
+        }
+        if (hptr->size_flags & CHUNK_MAPPED)
+        {
+            mapped_free(hptr);
+            continue;
+        }
+        if (node >= 0 && chunk_arena(hptr)->node != node)
+        {
+            BUMP(stats.remote_frees, 1);
+        }
+        ptrs[kept++] = ptr;
+    }
+
+    // Arenas are locked in turn as the batch moves through their regions
+    arena *locked = NULL;
+    for (size_t i = 0; i < kept;)
+    {
+        header *first = (header *)ptrs[i] - 1;
+        arena *a = chunk_arena(first);
+        if (a != locked)
+        {
+            if (locked)
+            {
+                locked->insert_hint = NULL;
+                pthread_mutex_unlock(&locked->lock);
+            }
+            pthread_mutex_lock(&a->lock);
+            locked = a;
+        }
+
+        // Chunks right after it in the batch and on the heap become part of it, so they are coalesced once
+        for (i++; i < kept && (header *)ptrs[i] - 1 == (header *)((void *)first + chunk_size(first)); i++)
+        {
+            set_size(first, stored_size(first) + chunk_size((header *)ptrs[i] - 1));
+        }
+        a->insert_hint = heap_free(a, first + 1);
+    }
+    if (locked)
+    {
+        locked->insert_hint = NULL;
+        pthread_mutex_unlock(&locked->lock);
+    }
+}
+
+/* Allocates total_size bytes set to zero, skipping the zeroing where the memory is known to be fresh. */
+static void *zeroed_malloc(size_t total_size)
+{
+    void *ptr = use_slabs ? slab_malloc(total_size) : NULL;
+    if (ptr)
+    {
+        memset(ptr, 0, total_size);
+        return ptr;
+    }
+
+    // Mapped chunks are fresh pages, which are already zero
+    if (use_mapping(total_size))
+    {
+        return mapped_malloc(total_size);
+    }
+
+    ptr = cache_malloc(total_size);
+    bool fresh = false;
+    if (!ptr)
+    {
+        arena *a = current_arena();
+        pthread_mutex_lock(&a->lock);
+        ptr = heap_malloc(a, total_size, &fresh);
+        pthread_mutex_unlock(&a->lock);
+    }
+    if (!ptr)
+    {
+        return NULL;
+    }
+
+    // A freshly mapped region is already zero, apart from the links and footer written while it was one free chunk, and
+    // the size tree links too with best and worst fit
+    if (fresh)
+    {
+        size_t usable = my_malloc_usable_size(ptr);
+        size_t links = (size_indexed() ? sizeof(tree_node) : sizeof(node)) - sizeof(header);
+        memset(ptr, 0, links < usable ? links : usable);
+        *(footer *)(ptr + usable - sizeof(footer)) = 0;
+    }
+    else
+    {
+        memset(ptr, 0, total_size);
+    }
+    return ptr;
+}
+
+/* Returns pointer to memory for count objects of the given size, all set to zero. Returns NULL if there is not enough space or the total size overflows. */
+void *my_calloc(size_t count, size_t size)
+{
+    size_t total_size;
+    if (__builtin_mul_overflow(count, size, &total_size))
+    {
+        return count_allocation(NULL, 0);
+    }
+    if (__builtin_expect(profile_interval != 0, 0) && sample_allocation(total_size))
+    {
+        return count_allocation(sampled_malloc(total_size, true), total_size);
+    }
+    return count_allocation(zeroed_malloc(total_size), total_size);
+}
+
+/* Resizes the allocated chunk at ptr, keeping its contents up to the smaller of the two sizes. Grows in place by taking space
+from the free chunk after it and shrinks in place by freeing the end, and only moves the chunk if neither works. Returns the
+pointer to the resized memory, or NULL if there is not enough space, in which case ptr is left alone. */
+void *my_realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return my_malloc(size);
+    }
+    if (size == 0)
+    {
+        my_free(ptr);
+        return NULL;
+    }
+    if (size > max_request_size() && !use_mapping(size))
+    {
+        return count_allocation(NULL, size);
+    }
+
+    // Slab objects can't grow, but anything up to the size of their class fits
+    if (is_slab_object(ptr))
+    {
+        size_t object_size = slab_object_size(ptr);
+        if (size <= object_size)
+        {
+            return ptr;
+        }
+        void *new_ptr = my_malloc(size);
+        if (new_ptr)
+        {
+            memcpy(new_ptr, ptr, object_size);
+            my_free(ptr);
+        }
+        return new_ptr;
+    }
+
+    header *hptr = (header *)ptr - 1;
+    CHECK_MAGIC(hptr);
+    if (harden_heap)
+    {
+        check_allocated(hptr);
+    }
+
+    // A sampled chunk is moved, so its sample is dropped and the new size is counted towards the next sample like any other
+    if (hptr->size_flags & CHUNK_SAMPLED)
+    {
+        void *new_ptr = my_malloc(size);
+        if (new_ptr)
+        {
+            memcpy(new_ptr, ptr, size < stored_size(hptr) ? size : stored_size(hptr));
+            my_free(ptr);
+        }
+        return new_ptr;
+    }
+
+    // Mapped chunks are remapped while they stay big enough, and moved into an arena when they don't
+    if (hptr->size_flags & CHUNK_MAPPED)
+    {
+        if (use_mapping(size))
+        {
+            size_t old_size = stored_size(hptr);
+            void *new_ptr = mapped_realloc(hptr, size);
+            if (!new_ptr)
+            {
+                return count_allocation(NULL, size);
+            }
+            count_resize(old_size, my_malloc_usable_size(new_ptr));
+            return new_ptr;
+        }
+        void *new_ptr = my_malloc(size);
+        if (new_ptr)
+        {
+            memcpy(new_ptr, ptr, size);
+            my_free(ptr);
+        }
+        return new_ptr;
+    }
+
+    size_t needed_size = align(size);
+
+    // The chunk stays in its own arena whichever thread resizes it
+    size_t old_size = stored_size(hptr);
+    arena *a = chunk_arena(hptr);
+    pthread_mutex_lock(&a->lock);
+    bool in_place = needed_size <= chunk_size(hptr) || expand(a, hptr, needed_size);
+    if (in_place)
+    {
+        shrink(a, hptr, needed_size);
+    }
+    pthread_mutex_unlock(&a->lock);
+    if (in_place)
+    {
+        count_resize(old_size, stored_size(hptr));
+        return ptr;
+    }
+
+    // Fall back to copying into a new chunk
+    void *new_ptr = my_malloc(size);
+    if (new_ptr)
+    {
+        memcpy(new_ptr, ptr, stored_size(hptr));
+        my_free(ptr);
+    }
+    return new_ptr;
+}
+
+/* Allocates memory aligned to a power of two alignment bigger than ALIGN_TO. */
+static void *aligned_malloc(size_t alignment, size_t size)
+{
+    // Every slab object is aligned to the slab step
+    void *slab_object = use_slabs && alignment <= SLAB_STEP ? slab_malloc(size) : NULL;
+    if (slab_object)
+    {
+        return slab_object;
+    }
+    if (size == 0 || size > max_request_size() || alignment + min_chunk_size() > max_request_size() - size)
+    {
+        return NULL;
+    }
+
+    size_t needed_size = align(size);
+    arena *a = current_arena();
+    pthread_mutex_lock(&a->lock);
+
+    // Leave room to move the start up to an aligned address with a gap big enough to be freed as its own chunk
+    void *ptr = heap_malloc(a, needed_size + alignment + min_chunk_size(), NULL);
+    if (ptr && (uint64_t)ptr % alignment)
+    {
+        header *hptr = (header *)ptr - 1;
+        uint64_t aligned = ((uint64_t)ptr + min_chunk_size() + alignment - 1) / alignment * alignment;
+        size_t gap = aligned - (uint64_t)ptr;
+
+        header *aligned_header = (header *)aligned - 1;
+        aligned_header->size_flags = (chunk_size(hptr) - gap - sizeof(header)) | a->index << ARENA_SHIFT;
+        SET_MAGIC(aligned_header, magic_number);
+        set_size(hptr, gap - sizeof(header));
+        heap_free(a, ptr);
+        ptr = (void *)aligned;
+    }
+    if (ptr)
+    {
+        shrink(a, (header *)ptr - 1, needed_size);
+    }
+
+    pthread_mutex_unlock(&a->lock);
+    return ptr;
+}
+
+/* Returns pointer to memory aligned to a power of two alignment, which can be bigger than ALIGN_TO. Returns NULL if the
+alignment is not a power of two or there is not enough space. */
+void *my_aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)))
+    {
+        return count_allocation(NULL, size);
+    }
+    if (alignment <= ALIGN_TO)
+    {
+        return my_malloc(size);
+    }
+    return count_allocation(aligned_malloc(alignment, size), size);
+}
+
+/* Stores a pointer to memory aligned to the given alignment in memptr. Returns EINVAL if the alignment is not a power of two
+multiple of the pointer size, or ENOMEM if there is not enough space. */
+int my_posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment == 0 || alignment % sizeof(void *) || (alignment & (alignment - 1)))
+    {
+        return EINVAL;
+    }
+
+    void *ptr = my_aligned_alloc(alignment, size);
+    if (!ptr)
+    {
+        return ENOMEM;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+/* Returns how many bytes can be used at ptr, which can be more than was asked for. */
+size_t my_malloc_usable_size(void *ptr)
+{
+    if (!ptr)
+    {
+        return 0;
+    }
+    if (is_slab_object(ptr))
+    {
+        return slab_object_size(ptr);
+    }
+    return stored_size((header *)ptr - 1);
+}
+
+/* Returns random bits for a hardened heap's key. */
+static uintptr_t random_key()
+{
+    uintptr_t key;
+    if (getrandom(&key, sizeof(key), GRND_NONBLOCK) != sizeof(key))
+    {
+        // There may be no entropy yet early in boot, so fall back on where the stack is and the time
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        key = ((uintptr_t)&key ^ ts.tv_sec) * 0x9E3779B97F4A7C15UL ^ ts.tv_nsec;
+    }
+    return key;
+}
+
+// Run around the fork handlers for a wrapper that holds a lock of its own across calls, set by set_fork_hooks()
+static void (*fork_prepare)();
+static void (*fork_parent)();
+static void (*fork_child)();
+
+/* Has the fork handlers call prepare before they take the allocator's locks, and parent or child after they let them go.
+Code that holds a lock of its own while calling into the allocator, like the tracing in preload.c, must take and release it
+through these hooks. Handlers it registered with pthread_atfork itself could run after the allocator's, taking its lock
+after the allocator's locks, the opposite order to its calls, and a fork could deadlock. Any of them can be NULL. */
+void set_fork_hooks(void (*prepare)(), void (*parent)(), void (*child)())
+{
+    fork_prepare = prepare;
+    fork_parent = parent;
+    fork_child = child;
+}
+
+/* Takes every lock of the allocator before a fork, so none of them is copied into the child while a thread that doesn't
+exist there holds it. They are taken in the order the allocator itself nests them: a wrapper's lock from the prepare hook
+first, since it is held across whole calls, then the profiler's lock, which is held while dumping, which can allocate, and
+searches register their stats under an arena's lock. */
+static void before_fork()
+{
+    if (fork_prepare)
+    {
+        fork_prepare();
+    }
+    lock_heap_profile();
+    for (size_t i = 0; i < MAX_ARENAS; i++)
+    {
+        pthread_mutex_lock(&arenas[i].lock);
+    }
+    pthread_mutex_lock(&stats_lock);
+}
+
+/* Lets go of the locks taken before a fork. The thread that forked holds them in both the parent and the child, so both
+can unlock them. */
+static void unlock_after_fork()
+{
+    pthread_mutex_unlock(&stats_lock);
+    for (size_t i = MAX_ARENAS; i-- > 0;)
+    {
+        pthread_mutex_unlock(&arenas[i].lock);
+    }
+    unlock_heap_profile();
+}
+
+static void after_fork_in_parent()
+{
+    unlock_after_fork();
+    if (fork_parent)
+    {
+        fork_parent();
+    }
+}
+
+static void after_fork_in_child()
+{
+    unlock_after_fork();
+    if (fork_child)
+    {
+        fork_child();
+    }
+}
+
+/* Registers the fork handlers when the program or library is loaded, whether or not the heap is ever used. */
+__attribute__((constructor)) static void register_fork_handlers()
+{
+    pthread_atfork(before_fork, after_fork_in_parent, after_fork_in_child);
+}
+
+/* Reads a small sysfs file into the buffer as a string, without allocating. Returns false if it can't be read. */
+static bool read_sysfs(const char *path, char *buffer, size_t size)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    ssize_t length = read(fd, buffer, size - 1);
+    close(fd);
+    if (length <= 0)
+    {
+        return false;
+    }
+    buffer[length] = '\0';
+    return true;
+}
+
+/* Reads the next range of a sysfs list like "0-3,8-11" into first and last, where a lone number is a range of one, and
+moves the cursor past it. Returns false at the end of the list. */
+static bool next_range(const char **cursor, size_t *first, size_t *last)
+{
+    char *end;
+    *first = strtoul(*cursor, &end, 10);
+    if (end == *cursor)
+    {
+        return false;
+    }
+    *last = *end == '-' ? strtoul(end + 1, &end, 10) : *first;
+    *cursor = *end == ',' ? end + 1 : end;
+    return true;
+}
+
+/* Finds how many NUMA nodes there are and which node each CPU is on. Without NUMA, or without sysfs to read it from,
+there is one node that every CPU is on. */
+static void find_numa_nodes()
+{
+    numa_nodes = 1;
+    memset(cpu_nodes, 0, sizeof(cpu_nodes));
+
+    char list[1024];
+    if (!read_sysfs("/sys/devices/system/node/online", list, sizeof(list)))
+    {
+        return;
+    }
+    const char *cursor = list;
+    size_t first, last;
+    while (next_range(&cursor, &first, &last))
+    {
+        numa_nodes = last >= numa_nodes ? last + 1 : numa_nodes;
+    }
+    numa_nodes = numa_nodes < MAX_NUMA_NODES ? numa_nodes : MAX_NUMA_NODES;
+
+    for (size_t node = 1; node < numa_nodes; node++)
+    {
+        // Built by hand, since snprintf is not promised not to allocate. Nodes have at most two digits.
+        char path[64] = "/sys/devices/system/node/node";
+        char *digits = path + strlen(path);
+        if (node >= 10)
+        {
+            *digits++ = '0' + node / 10;
+        }
+        *digits++ = '0' + node % 10;
+        strcpy(digits, "/cpulist");
+        if (!read_sysfs(path, list, sizeof(list)))
+        {
+            continue;
+        }
+        cursor = list;
+        while (next_range(&cursor, &first, &last))
+        {
+            for (size_t cpu = first; cpu <= last && cpu < MAX_NUMA_CPUS; cpu++)
+            {
+                cpu_nodes[cpu] = node;
+            }
+        }
+    }
+}
+
+/* Initializes the heap and all global variables. The main arena gets its first region now and the others when a thread first
+uses them. Must not be called while other threads are using the heap. */
+void init_heap()
+{
+    // The first region has to hold at least one chunk of the placement policy
+    if (heap_size < min_chunk_size())
+    {
+        heap_size = min_chunk_size();
+    }
+
+    // Give back the old heap if this is a reset
+    for (size_t i = 0; i < MAX_ARENAS; i++)
+    {
+        arena *a = &arenas[i];
+        while (a->regions)
+        {
+            region *old_region = a->regions;
+            a->regions = a->regions->next;
+            munmap(region_start(old_region), old_region->size + sizeof(region));
+        }
+
+        a->index = i;
+        a->node = -1;
+        a->heap_pointer = NULL;
+        a->free_list_head = NULL;
+        a->rover = NULL;
+        a->free_bytes = 0;
+        a->free_chunks = 0;
+        a->mapped_bytes = 0;
+        for (size_t j = 0; j < NUM_BINS; j++)
+        {
+            a->bins[j] = NULL;
+        }
+        a->bin_bitmap = 0;
+        a->size_tree = NULL;
+        a->largest = NULL;
+        memset(a->quick_lists, 0, sizeof(a->quick_lists));
+        a->quick_bytes = 0;
+        a->insert_hint = NULL;
+    }
+
+    // A new key for every heap, so a link leaked from one doesn't help against the next
+    if (harden_heap)
+    {
+        heap_key = random_key();
+        magic_number = heap_key >> 32;
+    }
+    else
+    {
+        heap_key = 0;
+        magic_number = MAGIC_NUMBER;
+    }
+
+    // Objects in the old slabs go with the heap
+    init_slabs(harden_heap, huge_pages, heap_key);
+    reset_stats();
+    forget_all_samples();
+
+    // Chunks cached by this thread belonged to the old heap
+    for (size_t i = 0; i < SMALL_BINS; i++)
+    {
+        cache.entries[i] = NULL;
+        cache.counts[i] = 0;
+    }
+
+    page_size = sysconf(_SC_PAGESIZE);
+    // One arena for each CPU, or a single one if the count can't be read
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    active_arenas = num_arenas ? num_arenas : cpus > 0 ? (size_t)cpus : 1;
+    if (active_arenas < 1 || active_arenas > MAX_ARENAS)
+    {
+        active_arenas = active_arenas < 1 ? 1 : MAX_ARENAS;
+    }
+
+    // With by node assignment, every node has at least one arena, and arena i is bound to node i % numa_nodes
+    find_numa_nodes();
+    if (arena_policy == BY_NODE)
+    {
+        active_arenas = active_arenas < numa_nodes ? numa_nodes : active_arenas;
+        for (size_t i = 0; i < active_arenas; i++)
+        {
+            arenas[i].node = i % numa_nodes;
+        }
+        memset(next_node_arena, 0, sizeof(next_node_arena));
+    }
+
+    // This thread keeps the main arena, the others are handed out after it
+    assigned_arena = main_arena;
+    next_arena = 1;
+
+    // mmap() returns a pointer to a chunk of free space
+    // Set heap pointer to start of heap
+    map_first_region(main_arena);
+
+    // Set offset for displaying
+    offset = (uint64_t)main_arena->heap_pointer;
+}
+
+/* Initializes the heap with the given placement policy. */
+void init_heap_with_policy(placement_policy policy)
+{
+    fit_policy = policy;
+    init_heap();
+}
+
+// Kinds of value a heap option takes
+typedef enum option_type_t
+{
+    BOOL_OPTION,
+    SIZE_OPTION,
+    POLICY_OPTION,
+    ARENA_POLICY_OPTION
+} option_type;
+
+// Name of each option in a configuration string, and the field of heap_options it sets
+static const struct
+{
+    const char *name;
+    option_type type;
+    size_t field;
+} option_table[] = {
+    {"policy", POLICY_OPTION, offsetof(heap_options, policy)},
+    {"heap_size", SIZE_OPTION, offsetof(heap_options, heap_size)},
+    {"grow", BOOL_OPTION, offsetof(heap_options, grow)},
+    {"lifo", BOOL_OPTION, offsetof(heap_options, lifo_free_list)},
+    {"trim", BOOL_OPTION, offsetof(heap_options, trim)},
+    {"trim_lazily", BOOL_OPTION, offsetof(heap_options, trim_lazily)},
+    {"trim_threshold", SIZE_OPTION, offsetof(heap_options, trim_threshold)},
+    {"trim_keep", SIZE_OPTION, offsetof(heap_options, trim_keep)},
+    {"thread_cache", BOOL_OPTION, offsetof(heap_options, thread_cache)},
+    {"thread_cache_limit", SIZE_OPTION, offsetof(heap_options, thread_cache_limit)},
+    {"slabs", BOOL_OPTION, offsetof(heap_options, slabs)},
+    {"mmap_threshold", SIZE_OPTION, offsetof(heap_options, mmap_threshold)},
+    {"huge_pages", BOOL_OPTION, offsetof(heap_options, huge_pages)},
+    {"harden", BOOL_OPTION, offsetof(heap_options, harden)},
+    {"arenas", SIZE_OPTION, offsetof(heap_options, arenas)},
+    {"arena_policy", ARENA_POLICY_OPTION, offsetof(heap_options, arena_policy)},
+    {"defer_coalescing", BOOL_OPTION, offsetof(heap_options, defer_coalescing)},
+    {"quick_list_budget", SIZE_OPTION, offsetof(heap_options, quick_list_budget)},
+};
+
+/* Fills in the options the heap is set to use, which are the defaults until they are changed. */
+void get_heap_options(heap_options *options)
+{
+    *options = (heap_options){
+        .policy = fit_policy,
+        .heap_size = heap_size,
+        .grow = grow_heap,
+        .lifo_free_list = lifo_free_list,
+        .trim = trim_heap,
+        .trim_lazily = trim_lazily,
+        .trim_threshold = trim_threshold,
+        .trim_keep = trim_keep,
+        .thread_cache = thread_cache,
+        .thread_cache_limit = thread_cache_limit,
+        .slabs = use_slabs,
+        .mmap_threshold = mmap_threshold,
+        .huge_pages = huge_pages,
+        .harden = harden_heap,
+        .arenas = num_arenas,
+        .arena_policy = arena_policy,
+        .defer_coalescing = defer_coalescing,
+        .quick_list_budget = quick_list_budget,
+    };
+}
+
+/* Returns true if the length bytes at value spell out word. */
+static bool value_is(const char *value, size_t length, const char *word)
+{
+    return strlen(word) == length && !strncmp(value, word, length);
+}
+
+/* Reads one value into the option it is for. Returns false if it is not a value the option takes. */
+static bool parse_option_value(void *field, option_type type, const char *value, size_t length)
+{
+    switch (type)
+    {
+    case BOOL_OPTION:
+        if (value_is(value, length, "true") || value_is(value, length, "1"))
+        {
+            *(bool *)field = true;
+            return true;
+        }
+        if (value_is(value, length, "false") || value_is(value, length, "0"))
+        {
+            *(bool *)field = false;
+            return true;
+        }
+        return false;
+
+    case SIZE_OPTION:
+    {
+        // A number with an optional k, m or g for KiB, MiB or GiB
+        char *end;
+        size_t number = strtoul(value, &end, 10);
+        int shift = 0;
+        if (end < value + length)
+        {
+            shift = *end == 'k' || *end == 'K' ? 10 : *end == 'm' || *end == 'M' ? 20 : *end == 'g' || *end == 'G' ? 30 : -1;
+            end++;
+        }
+        if (end == value || end != value + length || shift < 0 || number > SIZE_MASK >> shift)
+        {
+            return false;
+        }
+        *(size_t *)field = number << shift;
+        return true;
+    }
+
+    case POLICY_OPTION:
+        for (placement_policy policy = 0; policy < NUM_POLICIES; policy++)
+        {
+            if (value_is(value, length, policy_names[policy]))
+            {
+                *(placement_policy *)field = policy;
+                return true;
+            }
+        }
+        return false;
+
+    case ARENA_POLICY_OPTION:
+        if (value_is(value, length, "round_robin") || value_is(value, length, "cpu"))
+        {
+            *(arena_assignment *)field = value_is(value, length, "cpu") ? BY_CPU : ROUND_ROBIN;
+            return true;
+        }
+        if (value_is(value, length, "node"))
+        {
+            *(arena_assignment *)field = BY_NODE;
+            return true;
+        }
+        return false;
+    }
+    return false;
+}
+
+/* Reads a configuration string like "policy:best,heap_size:64k,harden:true" into the options, leaving the ones it doesn't
+name alone. Sizes take a k, m or g suffix, and flags are true or false. Nothing here allocates, so it can run before the
+heap exists. Returns false if any entry has an unknown name or a bad value, in which case the good entries are still read. */
+bool parse_heap_options(heap_options *options, const char *conf)
+{
+    bool ok = true;
+    while (conf && *conf)
+    {
+        const char *entry_end = strchrnul(conf, ',');
+        const char *colon = memchr(conf, ':', entry_end - conf);
+        size_t i = 0;
+        while (colon && i < sizeof(option_table) / sizeof(option_table[0]) && !value_is(conf, colon - conf, option_table[i].name))
+        {
+            i++;
+        }
+        if (!colon || i == sizeof(option_table) / sizeof(option_table[0]) || !parse_option_value((char *)options + option_table[i].field, option_table[i].type, colon + 1, entry_end - colon - 1))
+        {
+            ok = false;
+        }
+        conf = *entry_end ? entry_end + 1 : entry_end;
+    }
+    return ok;
+}
+
+/* Starts over with a fresh heap using the options. */
+void init_heap_with_options(const heap_options *options)
+{
+    // The heap has to hold at least one chunk, and its size is a whole number of chunks
+    heap_size = options->heap_size < MIN_CHUNK_SIZE ? MIN_CHUNK_SIZE : (options->heap_size + ALIGN_TO - 1) & ~(ALIGN_TO - 1);
+    grow_heap = options->grow;
+    lifo_free_list = options->lifo_free_list;
+    trim_heap = options->trim;
+    trim_lazily = options->trim_lazily;
+    trim_threshold = options->trim_threshold;
+    trim_keep = options->trim_keep;
+    thread_cache = options->thread_cache;
+    thread_cache_limit = options->thread_cache_limit;
+    use_slabs = options->slabs;
+    mmap_threshold = options->mmap_threshold;
+    huge_pages = options->huge_pages;
+    harden_heap = options->harden;
+    num_arenas = options->arenas;
+    arena_policy = options->arena_policy;
+    defer_coalescing = options->defer_coalescing;
+    quick_list_budget = options->quick_list_budget;
+    init_heap_with_policy(options->policy);
 }
\ No newline at end of file
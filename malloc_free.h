@@ -1,33 +1,283 @@
-#if !defined(MALLOC_FREE_H)
-#define MALLOC_FREE_H
-
-#include <inttypes.h>
-
-// Represents an allocated chunk header
-typedef struct header_t
-{
-    size_t size;
-    int magic;
-} header;
-
-// Represents a free chunk
-typedef struct node_t
-{
-    size_t size;
-    struct node_t *next;
-} node;
-
-extern const size_t HEAP_SIZE;
-extern const int MAGIC_NUMBER;
-extern const size_t ALIGN_TO;
-extern void *heap_pointer;
-extern node *free_list_head;
-extern uint64_t offset;
-
-size_t align(size_t raw);
-void coalesce();
-void *my_malloc(size_t size);
-void my_free(void *ptr);
-void init_heap();
-
+#if !defined(MALLOC_FREE_H)
+#define MALLOC_FREE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+// Flags share a word with the size of each chunk. Sizes are always a multiple of ALIGN_TO, which leaves the low bits
+// free, and are never anywhere near big enough to reach the top bits.
+
+// Flag set on chunks that are in the free list
+#define CHUNK_FREE 0x1UL
+// Flag set when the chunk physically before this one is free, meaning its footer can be read
+#define PREV_FREE 0x2UL
+// Flag set on chunks with a mapping of their own, which are unmapped when freed instead of going back to an arena
+#define CHUNK_MAPPED 0x4UL
+// Flag set on allocated chunks the heap profiler sampled, so freeing them drops the sample
+#define CHUNK_SAMPLED (1UL << 55)
+// Bits of an allocated chunk from this one up to the cached flag hold the index of the arena it came from
+#define ARENA_SHIFT 56
+// Flag set on allocated chunks sitting in a thread cache or a quick list
+#define CHUNK_CACHED (1UL << 62)
+// Flag set on the fence at the end of each region
+#define REGION_FENCE (1UL << 63)
+// Bits of the word holding the size
+#define SIZE_MASK ((CHUNK_SAMPLED - 1) & ~0x7UL)
+
+// Build with HEAP_DEBUG defined to give every chunk a magic number, checked whenever a chunk is freed or resized
+#if defined(HEAP_DEBUG)
+#define CHECK_MAGIC(chunk) assert(((header *)(chunk))->magic == magic_number)
+#define SET_MAGIC(chunk, value) (((header *)(chunk))->magic = (value))
+#else
+#define CHECK_MAGIC(chunk) ((void)0)
+#define SET_MAGIC(chunk, value) ((void)0)
+#endif
+
+// Represents an allocated chunk header, a single word holding the size of the data after it and the flags
+typedef struct header_t
+{
+#if defined(HEAP_DEBUG)
+    size_t magic;
+#endif
+    size_t size_flags;
+} header;
+
+// Represents a free chunk. Starts with the same fields as the header so flags can be read from either.
+typedef struct node_t
+{
+#if defined(HEAP_DEBUG)
+    size_t magic;
+#endif
+    size_t size_flags;
+    struct node_t *next;
+    struct node_t *prev;
+} node;
+
+// Boundary tag at the end of every free chunk holding a copy of its size
+typedef size_t footer;
+
+// Free chunk that also sits in the red-black tree of free chunks by size that best and worst fit search.
+typedef struct tree_node_t
+{
+    node chunk;
+    struct tree_node_t *left;
+    struct tree_node_t *right;
+    struct tree_node_t *parent;
+    bool red;
+} tree_node;
+
+// Smallest chunk with best and worst fit, which keep every free chunk in the size tree
+#define TREE_MIN_CHUNK (sizeof(tree_node) + sizeof(footer))
+
+// Represents a region of memory mapped for the heap. Sits right after the last chunk in the region, and starts
+// with a header that is never free so chunks are never merged past the end of the region.
+typedef struct region_t
+{
+    header fence;
+    size_t size;
+    struct region_t *next;
+} region;
+
+// How my_malloc picks which free chunk to use
+typedef enum placement_policy_t
+{
+    SEGREGATED_FIT,
+    FIRST_FIT,
+    NEXT_FIT,
+    BEST_FIT,
+    WORST_FIT,
+    NUM_POLICIES
+} placement_policy;
+
+// Number of size class bins, one per bit in the bitmap
+#define NUM_BINS 64
+// Bins below this one hold a single chunk size each
+#define SMALL_BINS 32
+// Most arenas the heap can have
+#define MAX_ARENAS 64
+// Most NUMA nodes arenas are placed on. Nodes past this are never used.
+#define MAX_NUMA_NODES 64
+// Size and alignment of a huge page, which regions are made of when huge_pages is set
+#define HUGE_PAGE_SIZE (2UL * 1024 * 1024)
+
+// How threads are given an arena
+typedef enum arena_assignment_t
+{
+    ROUND_ROBIN,
+    BY_CPU,
+    // Each arena is bound to a NUMA node, and threads use the arenas of the node they are running on
+    BY_NODE
+} arena_assignment;
+
+// Represents an arena, a heap of its own with its own regions, free lists and lock. Threads on different arenas
+// never wait on each other to allocate.
+typedef struct arena_t
+{
+    pthread_mutex_t lock;
+    size_t index;
+    // NUMA node the arena's regions are bound to with by node assignment, or -1
+    int node;
+    // Regions of the arena sorted by address
+    region *regions;
+    // Pointer to start of the first region, which is never unmapped
+    void *heap_pointer;
+    // Pointer to first node in free list
+    node *free_list_head;
+    // Free lists for each size class, used instead of free_list_head by the segregated fit policy
+    node *bins[NUM_BINS];
+    // Bit i is set when bins[i] is not empty
+    uint64_t bin_bitmap;
+    // Roving pointer for next fit, where the last search left off
+    node *rover;
+    // Free chunks ordered by size and then address, kept by best and worst fit alongside the free list
+    tree_node *size_tree;
+    // Biggest chunk in the size tree, the lowest addressed of them if there is a tie
+    tree_node *largest;
+    // Freed small chunks waiting to be coalesced with deferred coalescing, one stack for each exact size. Like chunks in a
+    // thread cache they stay allocated as far as the heap is concerned, and are linked through the first word of their data.
+    header *quick_lists[SMALL_BINS];
+    // Total size of the chunks in the quick lists
+    size_t quick_bytes;
+    // Free chunk my_free_batch() last freed into, where the sorted insert of the next chunk in the batch starts walking
+    node *insert_hint;
+    // Total size of all free chunks
+    size_t free_bytes;
+    // Number of free chunks
+    size_t free_chunks;
+    // Total size of all regions, including the region structs
+    size_t mapped_bytes;
+    // Size of the next region to map
+    size_t next_region_size;
+} arena;
+
+// Heap statistics filled in by my_malloc_stats()
+typedef struct heap_stats_t
+{
+    // Usable bytes of every live allocation, and how many there are
+    size_t in_use_bytes;
+    size_t in_use_count;
+    // Free chunks of every arena, their total size and the biggest of them
+    size_t free_bytes;
+    size_t free_chunks;
+    size_t largest_free_chunk;
+    // Same as heap_footprint()
+    size_t footprint;
+    // Allocations by the bin of their aligned size, and allocations that returned NULL
+    size_t allocations[NUM_BINS];
+    size_t failed_allocations;
+    // Searches of the free lists or bins, and the time spent in them
+    size_t searches;
+    uint64_t search_ns;
+    // Frees of chunks from an arena bound to a different NUMA node than the one the freeing thread is running on
+    size_t remote_frees;
+} heap_stats;
+
+// Fragmentation of the free space in the arenas, filled in by heap_fragmentation()
+typedef struct fragmentation_t
+{
+    size_t free_bytes;
+    size_t free_chunks;
+    size_t largest_free_chunk;
+    // 1 - largest / free: 0 when the free space is one chunk, near 1 when it is scattered in small ones
+    double external;
+    // largest / free, the share of the free space one allocation could use
+    double largest_to_free;
+    // Free chunks by the bin of their size
+    size_t free_chunks_by_bin[NUM_BINS];
+} fragmentation;
+
+// Options for init_heap_with_options(), one for each setting that is otherwise set before calling init_heap()
+typedef struct heap_options_t
+{
+    placement_policy policy;
+    size_t heap_size;
+    bool grow;
+    bool lifo_free_list;
+    bool trim;
+    bool trim_lazily;
+    size_t trim_threshold;
+    size_t trim_keep;
+    bool thread_cache;
+    size_t thread_cache_limit;
+    bool slabs;
+    size_t mmap_threshold;
+    bool huge_pages;
+    bool harden;
+    size_t arenas;
+    arena_assignment arena_policy;
+    bool defer_coalescing;
+    size_t quick_list_budget;
+} heap_options;
+
+// Environment variable holding options for a heap that is initialized on first use, in the format of parse_heap_options()
+#define HEAP_OPTIONS_ENV "MYALLOC_CONF"
+
+extern const size_t HEAP_SIZE;
+extern size_t heap_size;
+extern const int MAGIC_NUMBER;
+extern size_t magic_number;
+extern const size_t ALIGN_TO;
+extern const size_t MIN_CHUNK_SIZE;
+extern arena arenas[MAX_ARENAS];
+extern arena *const main_arena;
+extern size_t num_arenas;
+extern size_t active_arenas;
+extern arena_assignment arena_policy;
+extern size_t numa_nodes;
+extern uint64_t offset;
+extern bool lifo_free_list;
+extern bool grow_heap;
+extern bool trim_heap;
+extern bool trim_lazily;
+extern size_t trim_threshold;
+extern size_t trim_keep;
+extern bool thread_cache;
+extern size_t thread_cache_limit;
+extern bool defer_coalescing;
+extern size_t quick_list_budget;
+extern bool use_slabs;
+extern size_t mmap_threshold;
+extern bool huge_pages;
+extern bool harden_heap;
+extern placement_policy fit_policy;
+extern const char *policy_names[NUM_POLICIES];
+
+size_t align(size_t raw);
+size_t bin_index(size_t size);
+bool chunk_is_free(void *chunk);
+bool chunk_is_cached(void *chunk);
+size_t stored_size(void *chunk);
+size_t chunk_size(void *chunk);
+footer *chunk_footer(node *chunk);
+node *free_chunk_next(node *chunk);
+header *cache_next(header *chunk);
+void *region_start(region *r);
+region *find_region(void *address);
+arena *chunk_arena(void *chunk);
+void heap_corrupted(const char *message);
+int numa_node();
+size_t heap_footprint();
+node *coalesce(arena *a, node *freed);
+void *my_malloc(size_t size);
+void my_free(void *ptr);
+size_t my_malloc_batch(size_t size, size_t count, void **out);
+void my_free_batch(void **ptrs, size_t count);
+void *my_calloc(size_t count, size_t size);
+void *my_realloc(void *ptr, size_t size);
+void *my_aligned_alloc(size_t alignment, size_t size);
+int my_posix_memalign(void **memptr, size_t alignment, size_t size);
+size_t my_malloc_usable_size(void *ptr);
+void flush_thread_cache();
+void consolidate_heap();
+void my_malloc_stats(heap_stats *stats);
+void heap_fragmentation(fragmentation *frag);
+void export_heap_map(int fd);
+void init_heap();
+void init_heap_with_policy(placement_policy policy);
+void get_heap_options(heap_options *options);
+bool parse_heap_options(heap_options *options, const char *conf);
+void init_heap_with_options(const heap_options *options);
+void set_fork_hooks(void (*prepare)(), void (*parent)(), void (*child)());
+
 #endif // MALLOC_FREE_H
\ No newline at end of file
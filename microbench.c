@@ -0,0 +1,425 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "malloc_free.h"
+#include "bench.h"
+
+/* Multithreaded microbenchmarks, each run at 1 up to the given number of threads against both this allocator and the
+system malloc. Results are printed as CSV, or JSON with -j, one row per benchmark, allocator and thread count.
+
+    larson      each thread replaces random objects in its set, and each round hands the sets to new threads, so objects
+                are freed by threads that did not allocate them
+    churn       each thread allocates and frees random sizes up to 8 KiB in its own set of objects
+    pingpong    each thread allocates a batch of 64 byte objects and frees them all, over and over
+    burst       each thread allocates a burst of objects of a handful of sizes too big for slabs, like the buffers of a
+                request, and frees them all, over and over
+    xmalloc     each thread allocates objects and passes them to the next thread, which frees them
+    tlb         each thread allocates a working set far bigger than 4 KiB pages let the TLB cover and follows links
+                through it in a random order, which is as fast as the allocator packs the set into few pages
+
+With -P, the dTLB load misses of each run are counted with perf counters, where the system lets them be opened. */
+
+// Objects each thread keeps live in larson and churn
+#define SET_SIZE 1000
+// Rounds of threads larson hands its sets through
+#define LARSON_ROUNDS 4
+// Objects allocated before they are all freed in pingpong and burst
+#define PINGPONG_BATCH 100
+// Objects that can wait in each xmalloc queue
+#define QUEUE_SIZE 1024
+// Objects in the working set of each tlb thread, about 20 MiB of them
+#define TLB_OBJECTS 32768
+
+// Everything a benchmark thread needs
+typedef struct worker_t
+{
+    allocator *alloc;
+    size_t id;
+    size_t num_threads;
+    size_t ops;
+    void **set;
+    unsigned int seed;
+} worker;
+
+// Queue passing objects from one xmalloc thread to the next. Only one thread pushes and only one pops.
+typedef struct queue_t
+{
+    void *objects[QUEUE_SIZE];
+    size_t head;
+    size_t tail;
+} queue;
+
+static queue queues[MAX_ARENAS];
+
+#pragma region Benchmarks
+
+/* Replaces random objects in the worker's set with new ones of random small sizes. */
+void *larson_thread(void *arg)
+{
+    worker *w = arg;
+    for (size_t i = 0; i < w->ops / 2; i++)
+    {
+        size_t slot = rand_r(&w->seed) % SET_SIZE;
+        w->alloc->free(w->set[slot]);
+        w->set[slot] = w->alloc->malloc(16 + rand_r(&w->seed) % 512);
+    }
+    return NULL;
+}
+
+/* Allocates or frees a random object in the worker's set, with sizes up to 8 KiB. */
+void *churn_thread(void *arg)
+{
+    worker *w = arg;
+    void *set[SET_SIZE] = {0};
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        size_t slot = rand_r(&w->seed) % SET_SIZE;
+        if (set[slot])
+        {
+            w->alloc->free(set[slot]);
+            set[slot] = NULL;
+        }
+        else
+        {
+            set[slot] = w->alloc->malloc(8 + rand_r(&w->seed) % 8192);
+        }
+    }
+    for (size_t slot = 0; slot < SET_SIZE; slot++)
+    {
+        w->alloc->free(set[slot]);
+    }
+    return NULL;
+}
+
+/* Allocates a batch of fixed size objects and frees them all, over and over. */
+void *pingpong_thread(void *arg)
+{
+    worker *w = arg;
+    void *batch[PINGPONG_BATCH];
+    for (size_t i = 0; i < w->ops; i += 2 * PINGPONG_BATCH)
+    {
+        for (size_t j = 0; j < PINGPONG_BATCH; j++)
+        {
+            batch[j] = w->alloc->malloc(64);
+        }
+        for (size_t j = 0; j < PINGPONG_BATCH; j++)
+        {
+            w->alloc->free(batch[j]);
+        }
+    }
+    return NULL;
+}
+
+/* Allocates a batch of objects of 4 sizes between the biggest slab objects and the biggest small chunks, and frees them
+all, over and over. More of each size are freed than the thread cache holds. */
+void *burst_thread(void *arg)
+{
+    worker *w = arg;
+    void *batch[PINGPONG_BATCH];
+    for (size_t i = 0; i < w->ops; i += 2 * PINGPONG_BATCH)
+    {
+        for (size_t j = 0; j < PINGPONG_BATCH; j++)
+        {
+            batch[j] = w->alloc->malloc(136 + j % 4 * 32);
+        }
+        for (size_t j = 0; j < PINGPONG_BATCH; j++)
+        {
+            w->alloc->free(batch[j]);
+        }
+    }
+    return NULL;
+}
+
+/* Pushes new objects on this thread's queue and frees the ones the previous thread pushed on its queue, until it has
+allocated and freed its share. */
+void *xmalloc_thread(void *arg)
+{
+    worker *w = arg;
+    queue *out = &queues[w->id];
+    queue *in = &queues[(w->id + w->num_threads - 1) % w->num_threads];
+    size_t allocated = 0;
+    size_t freed = 0;
+
+    while (allocated < w->ops / 2 || freed < w->ops / 2)
+    {
+        size_t progress = allocated + freed;
+        size_t tail = out->tail;
+        if (allocated < w->ops / 2 && tail - __atomic_load_n(&out->head, __ATOMIC_ACQUIRE) < QUEUE_SIZE)
+        {
+            out->objects[tail % QUEUE_SIZE] = w->alloc->malloc(16 + rand_r(&w->seed) % 256);
+            __atomic_store_n(&out->tail, tail + 1, __ATOMIC_RELEASE);
+            allocated++;
+        }
+
+        size_t head = in->head;
+        if (freed < w->ops / 2 && head != __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE))
+        {
+            w->alloc->free(in->objects[head % QUEUE_SIZE]);
+            __atomic_store_n(&in->head, head + 1, __ATOMIC_RELEASE);
+            freed++;
+        }
+
+        // Let the other threads run when there are more threads than CPUs
+        if (allocated + freed == progress)
+        {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+/* Allocates a working set of objects too big for slabs, links them into one cycle in a random order and follows the links,
+so nearly every step lands on a page the last few steps did not touch. Frees the set after. */
+void *tlb_thread(void *arg)
+{
+    worker *w = arg;
+    void **objects = malloc(TLB_OBJECTS * sizeof(void *));
+    for (size_t i = 0; i < TLB_OBJECTS; i++)
+    {
+        objects[i] = w->alloc->malloc(256 + rand_r(&w->seed) % 768);
+    }
+    for (size_t i = TLB_OBJECTS - 1; i > 0; i--)
+    {
+        size_t j = rand_r(&w->seed) % (i + 1);
+        void *swap = objects[i];
+        objects[i] = objects[j];
+        objects[j] = swap;
+    }
+    for (size_t i = 0; i < TLB_OBJECTS; i++)
+    {
+        *(void **)objects[i] = objects[(i + 1) % TLB_OBJECTS];
+    }
+
+    void *p = objects[0];
+    for (size_t i = 0; i < w->ops; i++)
+    {
+        p = *(void **)p;
+    }
+    // Keeps the chase from being optimized away
+    __asm__ volatile("" : : "r"(p));
+
+    for (size_t i = 0; i < TLB_OBJECTS; i++)
+    {
+        w->alloc->free(objects[i]);
+    }
+    free(objects);
+    return NULL;
+}
+
+/* Opens a counter of the dTLB load misses of this thread and the threads it starts from then on. Returns -1 if perf
+counters can't be opened, as in most containers and virtual machines. */
+static int open_tlb_counter()
+{
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HW_CACHE,
+        .size = sizeof(struct perf_event_attr),
+        .config = PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16,
+        .inherit = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Returns the seconds on a monotonic clock. */
+double seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Runs a benchmark with each thread doing ops operations, and returns how long it took in seconds. Larson fills the sets
+first and frees them after, outside of the timing. If tlb_misses is not NULL, it is set to the dTLB load misses of the
+threads while they ran, or -1 if they could not be counted. */
+double run_benchmark(const char *name, allocator *alloc, size_t num_threads, size_t ops, long long *tlb_misses)
+{
+    worker workers[num_threads];
+    pthread_t threads[num_threads];
+    void *(*thread_function)(void *) = !strcmp(name, "larson") ? larson_thread : !strcmp(name, "churn") ? churn_thread : !strcmp(name, "pingpong") ? pingpong_thread : !strcmp(name, "burst") ? burst_thread : !strcmp(name, "tlb") ? tlb_thread : xmalloc_thread;
+    bool larson = thread_function == larson_thread;
+    size_t rounds = larson ? LARSON_ROUNDS : 1;
+
+    for (size_t i = 0; i < num_threads; i++)
+    {
+        workers[i] = (worker){alloc, i, num_threads, ops / rounds, NULL, i + 1};
+        queues[i].head = queues[i].tail = 0;
+        if (larson)
+        {
+            workers[i].set = malloc(SET_SIZE * sizeof(void *));
+            for (size_t slot = 0; slot < SET_SIZE; slot++)
+            {
+                workers[i].set[slot] = alloc->malloc(16 + slot % 512);
+            }
+        }
+    }
+
+    int counter = tlb_misses ? open_tlb_counter() : -1;
+    double start = seconds();
+    // Each round is new threads carrying on with the sets the last round left
+    for (size_t round = 0; round < rounds; round++)
+    {
+        for (size_t i = 0; i < num_threads; i++)
+        {
+            pthread_create(&threads[i], NULL, thread_function, &workers[i]);
+        }
+        for (size_t i = 0; i < num_threads; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+    }
+    double elapsed = seconds() - start;
+    if (tlb_misses)
+    {
+        // Threads that exited have added their counts to this one
+        *tlb_misses = -1;
+        if (counter >= 0)
+        {
+            if (read(counter, tlb_misses, sizeof(*tlb_misses)) != sizeof(*tlb_misses))
+            {
+                *tlb_misses = -1;
+            }
+            close(counter);
+        }
+    }
+
+    for (size_t i = 0; larson && i < num_threads; i++)
+    {
+        for (size_t slot = 0; slot < SET_SIZE; slot++)
+        {
+            alloc->free(workers[i].set[slot]);
+        }
+        free(workers[i].set);
+    }
+    return elapsed;
+}
+
+#pragma endregion Benchmarks
+
+void show_usage()
+{
+    printf("Usage: microbench.exe [-t max threads] [-n operations per thread] [-j] [-H] [-D] [-P] [-c options] [benchmark...]\n");
+    printf("Benchmarks are larson, churn, pingpong, burst, xmalloc and tlb, and all of them run if none are given\n");
+    printf("-P adds the dTLB load misses of each run from perf counters, or -1 where they can't be read.\n");
+    printf("Prints CSV, or JSON with -j. -H hardens the heap to measure what the checks cost. -D defers coalescing.\n");
+    printf("-c sets heap options in the same format as %s, like heap_size:64k,slabs:false\n", HEAP_OPTIONS_ENV);
+}
+
+int main(int argc, char const *argv[])
+{
+    size_t max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t ops = 1000000;
+    bool json = false;
+    bool count_tlb_misses = false;
+    const char *all_benchmarks[] = {"larson", "churn", "pingpong", "burst", "xmalloc", "tlb"};
+    const char *benchmarks[6];
+    size_t num_benchmarks = 0;
+    const char *conf = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc)
+        {
+            max_threads = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            ops = strtoul(argv[++i], NULL, 10);
+        }
+        else if (!strcmp(argv[i], "-j"))
+        {
+            json = true;
+        }
+        else if (!strcmp(argv[i], "-H"))
+        {
+            harden_heap = true;
+        }
+        else if (!strcmp(argv[i], "-D"))
+        {
+            defer_coalescing = true;
+        }
+        else if (!strcmp(argv[i], "-P"))
+        {
+            count_tlb_misses = true;
+        }
+        else if (!strcmp(argv[i], "-c") && i + 1 < argc)
+        {
+            conf = argv[++i];
+        }
+        else if (num_benchmarks < 6 && (!strcmp(argv[i], "larson") || !strcmp(argv[i], "churn") || !strcmp(argv[i], "pingpong") || !strcmp(argv[i], "burst") || !strcmp(argv[i], "xmalloc") || !strcmp(argv[i], "tlb")))
+        {
+            benchmarks[num_benchmarks++] = argv[i];
+        }
+        else
+        {
+            show_usage();
+            return 1;
+        }
+    }
+    if (!num_benchmarks)
+    {
+        memcpy(benchmarks, all_benchmarks, sizeof(all_benchmarks));
+        num_benchmarks = 6;
+    }
+    // xmalloc has a queue for each thread
+    if (max_threads < 1 || max_threads > MAX_ARENAS)
+    {
+        max_threads = max_threads < 1 ? 1 : MAX_ARENAS;
+    }
+
+    allocator allocators[] = {
+        {"myalloc", my_malloc, my_free, my_calloc, my_realloc, my_aligned_alloc, heap_footprint},
+        {"glibc", malloc, free, calloc, realloc, aligned_alloc, NULL},
+    };
+    heap_options options;
+    get_heap_options(&options);
+    if (!parse_heap_options(&options, conf))
+    {
+        printf("Bad heap options %s\n", conf);
+        return 1;
+    }
+    init_heap_with_options(&options);
+
+    printf(json ? "[\n" : count_tlb_misses ? "benchmark,allocator,threads,ops,seconds,ops_per_sec,dtlb_misses\n" : "benchmark,allocator,threads,ops,seconds,ops_per_sec\n");
+    bool first = true;
+    for (size_t b = 0; b < num_benchmarks; b++)
+    {
+        for (size_t a = 0; a < 2; a++)
+        {
+            for (size_t threads = 1; threads <= max_threads; threads++)
+            {
+                long long tlb_misses = -1;
+                double elapsed = run_benchmark(benchmarks[b], &allocators[a], threads, ops, count_tlb_misses ? &tlb_misses : NULL);
+                size_t total_ops = threads * ops;
+                if (json)
+                {
+                    printf("%s  {\"benchmark\": \"%s\", \"allocator\": \"%s\", \"threads\": %zu, \"ops\": %zu, \"seconds\": %.6f, \"ops_per_sec\": %.0f", first ? "" : ",\n", benchmarks[b], allocators[a].name, threads, total_ops, elapsed, total_ops / elapsed);
+                    if (count_tlb_misses)
+                    {
+                        printf(", \"dtlb_misses\": %lld", tlb_misses);
+                    }
+                    printf("}");
+                }
+                else
+                {
+                    printf("%s,%s,%zu,%zu,%.6f,%.0f", benchmarks[b], allocators[a].name, threads, total_ops, elapsed, total_ops / elapsed);
+                    printf(count_tlb_misses ? ",%lld\n" : "\n", tlb_misses);
+                }
+                fflush(stdout);
+                first = false;
+            }
+        }
+    }
+    printf(json ? "\n]\n" : "");
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,327 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "malloc_free.h"
+#include "profile.h"
+
+/* The standard allocation functions, backed by malloc_free.c. These are built into libmyalloc.so so the allocator can be put
+under any program with LD_PRELOAD. my_malloc refuses size 0, but programs expect a pointer they can pass to free, so they get
+the smallest chunk instead.
+
+Setting MYALLOC_CONF to a list of options like policy:best,heap_size:1m,harden:true configures the heap when it is first
+used. parse_heap_options() in malloc_free.c lists them all.
+
+Setting MYALLOC_TRACE to a path records every allocation to <path>.<pid> in the trace format bench.exe replays.
+
+Setting MYALLOC_PROFILE to a path turns on the heap profiler, sampling every MYALLOC_PROFILE_INTERVAL bytes on average (512
+KiB by default), and writes the allocations still live at exit to <path>.<pid>.heap for pprof and <path>.<pid>.folded for
+flame graphs. */
+
+#pragma region Trace
+
+// Trace file being written, or -1 when not recording
+static int trace_fd = -1;
+// Prefix of the trace file names
+static const char *trace_path;
+// Events are formatted here and written out when it fills, since a write for each one would cost far more than the allocation
+static char trace_buffer[64 * 1024];
+static size_t trace_length;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Writes out the buffered events. Must hold the trace lock. */
+static void flush_trace()
+{
+    size_t written = 0;
+    while (written < trace_length)
+    {
+        ssize_t result = write(trace_fd, trace_buffer + written, trace_length - written);
+        if (result <= 0)
+        {
+            break;
+        }
+        written += result;
+    }
+    trace_length = 0;
+}
+
+/* Appends a number in decimal. printf can't be used here, since it can call malloc. */
+static void append_number(char *buffer, size_t *length, uint64_t number)
+{
+    char digits[20];
+    size_t count = 0;
+    do
+    {
+        digits[count++] = '0' + number % 10;
+        number /= 10;
+    } while (number);
+
+    while (count)
+    {
+        buffer[(*length)++] = digits[--count];
+    }
+}
+
+/* Buffers an event with count numbers after it. Must hold the trace lock. */
+static void trace_locked(char op, int count, uint64_t a, uint64_t b, uint64_t c)
+{
+    uint64_t numbers[] = {a, b, c};
+
+    // Room for the longest event, three 20 digit numbers
+    if (trace_length + 64 > sizeof(trace_buffer))
+    {
+        flush_trace();
+    }
+
+    trace_buffer[trace_length++] = op;
+    for (int i = 0; i < count; i++)
+    {
+        trace_buffer[trace_length++] = ' ';
+        append_number(trace_buffer, &trace_length, numbers[i]);
+    }
+    trace_buffer[trace_length++] = '\n';
+}
+
+/* Records an event if a trace is being written. Frees are recorded before they happen and allocations after, so another
+thread reusing the same address is always recorded in the right order. */
+static void trace(char op, int count, uint64_t a, uint64_t b, uint64_t c)
+{
+    if (trace_fd < 0)
+    {
+        return;
+    }
+    pthread_mutex_lock(&trace_lock);
+    trace_locked(op, count, a, b, c);
+    pthread_mutex_unlock(&trace_lock);
+}
+
+/* Opens a file for this process, named <prefix>.<pid><suffix> so forked processes get their own. */
+static int open_for_process(const char *prefix, const char *suffix)
+{
+    char path[4096];
+    size_t length = 0;
+    for (const char *c = prefix; *c && length < sizeof(path) - 64; c++)
+    {
+        path[length++] = *c;
+    }
+    path[length++] = '.';
+    append_number(path, &length, getpid());
+    for (const char *c = suffix; *c; c++)
+    {
+        path[length++] = *c;
+    }
+    path[length] = '\0';
+
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+}
+
+static void open_trace()
+{
+    trace_fd = open_for_process(trace_path, "");
+}
+
+/* Flushes the trace before forking, and keeps the lock held so the child doesn't inherit it locked by another thread. realloc
+holds the lock across my_realloc, so it is taken before the allocator's locks through the allocator's fork hooks, never with a
+pthread_atfork handler of its own. */
+static void before_fork()
+{
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0)
+    {
+        flush_trace();
+    }
+}
+
+static void after_fork_in_parent()
+{
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void after_fork_in_child()
+{
+    if (trace_fd >= 0)
+    {
+        close(trace_fd);
+        open_trace();
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+__attribute__((constructor)) static void start_trace()
+{
+    trace_path = getenv("MYALLOC_TRACE");
+    if (trace_path && *trace_path)
+    {
+        open_trace();
+        set_fork_hooks(before_fork, after_fork_in_parent, after_fork_in_child);
+    }
+}
+
+__attribute__((destructor)) static void stop_trace()
+{
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0)
+    {
+        flush_trace();
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+#pragma endregion Trace
+
+#pragma region Profile
+
+// Prefix of the profile file names, or NULL when not profiling
+static const char *profile_path;
+
+__attribute__((constructor)) static void start_profile()
+{
+    profile_path = getenv("MYALLOC_PROFILE");
+    if (profile_path && *profile_path)
+    {
+        const char *interval = getenv("MYALLOC_PROFILE_INTERVAL");
+        start_heap_profile(interval ? strtoul(interval, NULL, 10) : 0);
+    }
+}
+
+__attribute__((destructor)) static void stop_profile()
+{
+    if (!profile_path || !*profile_path)
+    {
+        return;
+    }
+    stop_heap_profile();
+
+    int fd = open_for_process(profile_path, ".heap");
+    if (fd >= 0)
+    {
+        dump_heap_profile(fd, PPROF_PROFILE);
+        close(fd);
+    }
+    fd = open_for_process(profile_path, ".folded");
+    if (fd >= 0)
+    {
+        dump_heap_profile(fd, FOLDED_PROFILE);
+        close(fd);
+    }
+}
+
+#pragma endregion Profile
+
+void *malloc(size_t size)
+{
+    void *ptr = my_malloc(size ? size : 1);
+    if (!ptr)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    trace('m', 2, (uint64_t)ptr, size, 0);
+    return ptr;
+}
+
+void free(void *ptr)
+{
+    if (ptr)
+    {
+        trace('f', 1, (uint64_t)ptr, 0, 0);
+    }
+    my_free(ptr);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    void *ptr = count && size ? my_calloc(count, size) : my_calloc(1, 1);
+    if (!ptr)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    trace('c', 2, (uint64_t)ptr, count * size, 0);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (!ptr)
+    {
+        return malloc(size);
+    }
+    if (!size)
+    {
+        free(ptr);
+        return NULL;
+    }
+
+    // The old address can be reused as soon as realloc moves it, so hold the trace lock until the event is recorded
+    void *new_ptr;
+    if (trace_fd >= 0)
+    {
+        pthread_mutex_lock(&trace_lock);
+        new_ptr = my_realloc(ptr, size);
+        if (new_ptr)
+        {
+            trace_locked('r', 3, (uint64_t)ptr, (uint64_t)new_ptr, size);
+        }
+        pthread_mutex_unlock(&trace_lock);
+    }
+    else
+    {
+        new_ptr = my_realloc(ptr, size);
+    }
+
+    if (!new_ptr)
+    {
+        errno = ENOMEM;
+    }
+    return new_ptr;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *ptr = my_aligned_alloc(alignment, size ? size : 1);
+    if (!ptr)
+    {
+        errno = alignment && !(alignment & (alignment - 1)) ? ENOMEM : EINVAL;
+        return NULL;
+    }
+    trace('a', 3, (uint64_t)ptr, alignment, size);
+    return ptr;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    return aligned_alloc(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int result = my_posix_memalign(memptr, alignment, size ? size : 1);
+    if (!result)
+    {
+        trace('a', 3, (uint64_t)*memptr, alignment, size);
+    }
+    return result;
+}
+
+void *valloc(size_t size)
+{
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page_size, (size + page_size - 1) / page_size * page_size);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return my_malloc_usable_size(ptr);
+}
\ No newline at end of file
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <execinfo.h>
+#include <dlfcn.h>
+
+#include "profile.h"
+
+/* Sampling heap profiler. Each thread counts down the bytes it allocates, and the allocation that takes the count past zero
+is sampled: its stack is captured and kept in a table keyed by its address until it is freed. The gaps between samples are
+drawn from an exponential distribution with a mean of profile_interval bytes, so every byte is equally likely to be sampled
+whatever the size of the allocation it is in, and an allocation of size bytes stands for size / (1 - e^(-size / interval))
+bytes of allocations like it.
+
+The allocator marks sampled chunks with a flag, so only frees of sampled chunks ever look in the table. The table and the
+samples live in pages mapped for them, never on the heap they describe. */
+
+// Buckets of the table of samples keyed by address
+#define SAMPLE_BUCKETS 4096
+// Frames of the profiler and the allocator at the top of every captured stack, which are left out
+#define SKIPPED_FRAMES 2
+
+// A live sampled allocation
+typedef struct sample_t
+{
+    void *ptr;
+    size_t size;
+    void *stack[PROFILE_DEPTH];
+    int depth;
+    // Set while dumping once the sample has been added to the line of its stack
+    bool dumped;
+    // Next sample in its bucket, or in the list of unused samples
+    struct sample_t *next;
+} sample;
+
+// Mean bytes between samples, or 0 when the profiler is off
+size_t profile_interval;
+// Interval the samples were last taken with, which dumps still need once the profiler is off
+static size_t last_interval = DEFAULT_PROFILE_INTERVAL;
+static sample *buckets[SAMPLE_BUCKETS];
+// Samples that were freed, to reuse before mapping more
+static sample *unused_samples;
+static size_t num_samples;
+// Guards the table, which is only touched by sampled allocations, so it is rarely contended
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+// Bytes the thread can allocate before its next sample
+static __thread ptrdiff_t bytes_until_sample __attribute__((tls_model("initial-exec")));
+static __thread uint64_t sample_seed __attribute__((tls_model("initial-exec")));
+// Set while the thread is inside the profiler, which can call malloc when capturing a stack or writing a dump
+static __thread bool in_profiler __attribute__((tls_model("initial-exec")));
+
+/* Returns the base 2 logarithm of x, to within about 1%. Close enough to draw gaps between samples without pulling in libm. */
+static double fast_log2(double x)
+{
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = (int)((bits >> 52) & 0x7FF) - 1023;
+    // Put the mantissa back in [1, 2) and fit a quadratic to the logarithm over it
+    bits = (bits & ((1UL << 52) - 1)) | (1023UL << 52);
+    double mantissa;
+    memcpy(&mantissa, &bits, sizeof(mantissa));
+    return exponent + (-0.34484843 * mantissa + 2.02466578) * mantissa - 1.67487759;
+}
+
+/* Returns e to the power of -x for x of at least 0, by halving x until a short series is accurate and squaring back up. */
+static double exp_negative(double x)
+{
+    int halvings = 0;
+    while (x > 0.5)
+    {
+        x /= 2;
+        halvings++;
+    }
+    double result = 1 - x + x * x / 2 - x * x * x / 6 + x * x * x * x / 24;
+    while (halvings--)
+    {
+        result *= result;
+    }
+    return result;
+}
+
+/* Draws the bytes until the thread's next sample from an exponential distribution with a mean of the interval. */
+static ptrdiff_t next_sample_gap()
+{
+    if (!sample_seed)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        sample_seed = ((uintptr_t)&sample_seed ^ ts.tv_nsec) | 1;
+    }
+    // xorshift64*, keeping 26 bits for a uniform number in (0, 1]
+    sample_seed ^= sample_seed >> 12;
+    sample_seed ^= sample_seed << 25;
+    sample_seed ^= sample_seed >> 27;
+    uint64_t uniform = ((sample_seed * 0x2545F4914F6CDD1DUL) >> 38) + 1;
+    double log_uniform = fast_log2(uniform) - 26;
+    // -ln(u) is exponential with a mean of 1
+    return (ptrdiff_t)(-log_uniform * 0.6931471805599453 * profile_interval) + 1;
+}
+
+/* Turns the profiler on, sampling every interval bytes on average, and starts the calling thread's count over. Other
+threads start over after their next sample. */
+void start_heap_profile(size_t interval)
+{
+    profile_interval = interval ? interval : DEFAULT_PROFILE_INTERVAL;
+    last_interval = profile_interval;
+    bytes_until_sample = next_sample_gap();
+}
+
+/* Turns the profiler off. Samples already taken stay until their allocations are freed, and can still be dumped. */
+void stop_heap_profile()
+{
+    profile_interval = 0;
+}
+
+/* Counts an allocation of size bytes against the thread's count, and returns true if it should be sampled. Only called
+while the profiler is on. */
+bool sample_allocation(size_t size)
+{
+    if (in_profiler)
+    {
+        return false;
+    }
+    if (!bytes_until_sample)
+    {
+        bytes_until_sample = next_sample_gap();
+    }
+    bytes_until_sample -= size;
+    if (bytes_until_sample > 0)
+    {
+        return false;
+    }
+    bytes_until_sample = next_sample_gap();
+    return true;
+}
+
+static size_t bucket_of(void *ptr)
+{
+    return ((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15UL >> 52;
+}
+
+/* Takes a sample off the unused list, mapping a page more of them if it is empty. Must hold the profile lock. */
+static sample *new_sample()
+{
+    if (!unused_samples)
+    {
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        sample *page = mmap(NULL, page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (page == MAP_FAILED)
+        {
+            return NULL;
+        }
+        for (size_t i = 0; i < page_size / sizeof(sample); i++)
+        {
+            page[i].next = unused_samples;
+            unused_samples = &page[i];
+        }
+    }
+    sample *s = unused_samples;
+    unused_samples = s->next;
+    return s;
+}
+
+/* Captures the stack of a sampled allocation of size bytes at ptr and keeps it until forget_sample(). The sample is dropped
+if there is no memory to keep it in. */
+void record_sample(void *ptr, size_t size)
+{
+    void *stack[PROFILE_DEPTH + SKIPPED_FRAMES];
+    // Capturing the first stack loads the unwinder, which allocates
+    in_profiler = true;
+    int depth = backtrace(stack, PROFILE_DEPTH + SKIPPED_FRAMES);
+    in_profiler = false;
+
+    pthread_mutex_lock(&profile_lock);
+    sample *s = new_sample();
+    if (s)
+    {
+        s->ptr = ptr;
+        s->size = size;
+        s->depth = depth > SKIPPED_FRAMES ? depth - SKIPPED_FRAMES : 0;
+        memcpy(s->stack, stack + SKIPPED_FRAMES, s->depth * sizeof(void *));
+        s->dumped = false;
+        s->next = buckets[bucket_of(ptr)];
+        buckets[bucket_of(ptr)] = s;
+        num_samples++;
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Drops the sample of the allocation at ptr, if it has one. */
+void forget_sample(void *ptr)
+{
+    pthread_mutex_lock(&profile_lock);
+    for (sample **link = &buckets[bucket_of(ptr)]; *link; link = &(*link)->next)
+    {
+        if ((*link)->ptr == ptr)
+        {
+            sample *s = *link;
+            *link = s->next;
+            s->next = unused_samples;
+            unused_samples = s;
+            num_samples--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Drops every sample, for when the heap they were taken from starts over. Must not be called while other threads are using
+the heap. */
+void forget_all_samples()
+{
+    pthread_mutex_lock(&profile_lock);
+    for (size_t i = 0; i < SAMPLE_BUCKETS; i++)
+    {
+        while (buckets[i])
+        {
+            sample *s = buckets[i];
+            buckets[i] = s->next;
+            s->next = unused_samples;
+            unused_samples = s;
+        }
+    }
+    num_samples = 0;
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Takes the profiler's lock so a fork can't copy it while another thread holds it. */
+void lock_heap_profile()
+{
+    pthread_mutex_lock(&profile_lock);
+}
+
+/* Lets go of the lock taken by lock_heap_profile(), in the parent or the child after a fork. */
+void unlock_heap_profile()
+{
+    pthread_mutex_unlock(&profile_lock);
+}
+
+/* Returns the number of sampled allocations that are still live. */
+size_t live_samples()
+{
+    pthread_mutex_lock(&profile_lock);
+    size_t count = num_samples;
+    pthread_mutex_unlock(&profile_lock);
+    return count;
+}
+
+/* Returns true if two samples were taken at the same stack. */
+static bool same_stack(sample *a, sample *b)
+{
+    return a->depth == b->depth && !memcmp(a->stack, b->stack, a->depth * sizeof(void *));
+}
+
+/* Writes a frame of a folded stack as its symbol, or as its object file and offset when it has no symbol to find, which
+addr2line can turn into a function later. */
+static void write_folded_frame(int fd, void *frame)
+{
+    Dl_info info;
+    if (dladdr(frame, &info) && info.dli_sname)
+    {
+        dprintf(fd, "%s", info.dli_sname);
+    }
+    else if (info.dli_fname)
+    {
+        const char *name = strrchr(info.dli_fname, '/');
+        dprintf(fd, "%s+0x%lx", name ? name + 1 : info.dli_fname, (uintptr_t)frame - (uintptr_t)info.dli_fbase);
+    }
+    else
+    {
+        dprintf(fd, "0x%lx", (uintptr_t)frame);
+    }
+}
+
+/* Copies the memory map of the process, which pprof needs to find the symbols of the addresses in a legacy profile. */
+static void write_memory_map(int fd)
+{
+    dprintf(fd, "\nMAPPED_LIBRARIES:\n");
+    int maps = open("/proc/self/maps", O_RDONLY);
+    if (maps < 0)
+    {
+        return;
+    }
+    char buffer[4096];
+    ssize_t length;
+    while ((length = read(maps, buffer, sizeof(buffer))) > 0)
+    {
+        write(fd, buffer, length);
+    }
+    close(maps);
+}
+
+/* Writes the live sampled allocations to fd, added up by the stack they were allocated from. The pprof format has the raw
+samples and the interval, which pprof scales up itself. The folded format has the bytes each stack is estimated to have
+live, with the frames from the outermost in, and whatever addresses have no symbol left as object and offset. Samples are
+only added up while dumping, by comparing every pair of them, which is fine for the few thousand a big heap would have. */
+void dump_heap_profile(int fd, profile_format format)
+{
+    // Allocations made while writing are not sampled, so the lock held here is never needed for them
+    in_profiler = true;
+    pthread_mutex_lock(&profile_lock);
+
+    size_t interval = last_interval;
+    if (format == PPROF_PROFILE)
+    {
+        size_t total_bytes = 0;
+        for (size_t i = 0; i < SAMPLE_BUCKETS; i++)
+        {
+            for (sample *s = buckets[i]; s; s = s->next)
+            {
+                total_bytes += s->size;
+            }
+        }
+        dprintf(fd, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n", num_samples, total_bytes, num_samples, total_bytes, interval);
+    }
+
+    // Each sample that is first for its stack gathers up the rest with the same stack
+    for (size_t i = 0; i < SAMPLE_BUCKETS; i++)
+    {
+        for (sample *first = buckets[i]; first; first = first->next)
+        {
+            if (first->dumped)
+            {
+                continue;
+            }
+            size_t count = 0;
+            size_t bytes = 0;
+            double estimated_bytes = 0;
+            for (size_t j = i; j < SAMPLE_BUCKETS; j++)
+            {
+                for (sample *s = j == i ? first : buckets[j]; s; s = s->next)
+                {
+                    if (!s->dumped && same_stack(first, s))
+                    {
+                        s->dumped = true;
+                        count++;
+                        bytes += s->size;
+                        estimated_bytes += s->size / (1 - exp_negative((double)s->size / interval));
+                    }
+                }
+            }
+
+            if (format == PPROF_PROFILE)
+            {
+                dprintf(fd, "%zu: %zu [%zu: %zu] @", count, bytes, count, bytes);
+                for (int f = 0; f < first->depth; f++)
+                {
+                    dprintf(fd, " %p", first->stack[f]);
+                }
+                dprintf(fd, "\n");
+            }
+            else
+            {
+                for (int f = first->depth - 1; f >= 0; f--)
+                {
+                    write_folded_frame(fd, first->stack[f]);
+                    if (f)
+                    {
+                        dprintf(fd, ";");
+                    }
+                }
+                dprintf(fd, " %.0f\n", estimated_bytes);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < SAMPLE_BUCKETS; i++)
+    {
+        for (sample *s = buckets[i]; s; s = s->next)
+        {
+            s->dumped = false;
+        }
+    }
+    if (format == PPROF_PROFILE)
+    {
+        write_memory_map(fd);
+    }
+
+    pthread_mutex_unlock(&profile_lock);
+    in_profiler = false;
+}
\ No newline at end of file
@@ -0,0 +1,34 @@
+#if !defined(PROFILE_H)
+#define PROFILE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Most frames kept from the stack of a sampled allocation
+#define PROFILE_DEPTH 32
+// Mean bytes between samples when the profiler is started without one
+#define DEFAULT_PROFILE_INTERVAL (512 * 1024)
+
+// Formats dump_heap_profile() can write
+typedef enum profile_format_t
+{
+    // Legacy pprof heap profile, read with pprof <program> <file>
+    PPROF_PROFILE,
+    // One line of semicolon separated frames and bytes for each stack, read by flame graph tools
+    FOLDED_PROFILE,
+} profile_format;
+
+extern size_t profile_interval;
+
+void start_heap_profile(size_t interval);
+void stop_heap_profile();
+bool sample_allocation(size_t size);
+void record_sample(void *ptr, size_t size);
+void forget_sample(void *ptr);
+void forget_all_samples();
+size_t live_samples();
+void lock_heap_profile();
+void unlock_heap_profile();
+void dump_heap_profile(int fd, profile_format format);
+
+#endif // PROFILE_H
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "scoped_region.h"
+#include "malloc_free.h"
+
+/* Scoped regions on top of the heap. A region is a list of blocks allocated with my_malloc, and allocating from it only
+bumps a pointer through the current block, moving on to the next block when it is full and allocating a new one at the end
+of the list when there is no next block. Resetting a region keeps its blocks and points it back at the start of the first
+one, so emptying it takes the same time however much was allocated, and the next round reuses the same memory without
+going to the heap. Destroying a region frees its blocks. */
+
+/* Returns the first byte after the struct at the start of a block. */
+static char *block_start(region_block *block)
+{
+    return (char *)(block + 1);
+}
+
+/* Starts bumping through a block. */
+static void use_block(scoped_region *r, region_block *block)
+{
+    r->current = block;
+    r->bump = block_start(block);
+    r->end = r->bump + block->size;
+}
+
+/* Creates an empty region whose first block has room for block_size bytes, or DEFAULT_REGION_BLOCK if it is 0. The region
+itself sits at the start of the first block. Returns NULL if the heap is out of memory. */
+scoped_region *region_create(size_t block_size)
+{
+    block_size = block_size ? block_size : DEFAULT_REGION_BLOCK;
+    block_size = (block_size + ALIGN_TO - 1) & ~(ALIGN_TO - 1);
+    region_block *block = my_malloc(sizeof(region_block) + sizeof(scoped_region) + block_size);
+    if (!block)
+    {
+        return NULL;
+    }
+    block->next = NULL;
+    block->size = sizeof(scoped_region) + block_size;
+
+    scoped_region *r = (scoped_region *)block_start(block);
+    r->first = block;
+    use_block(r, block);
+    r->bump += sizeof(scoped_region);
+    r->next_block_size = 2 * block_size < MAX_REGION_BLOCK ? 2 * block_size : MAX_REGION_BLOCK;
+    return r;
+}
+
+/* Moves on to the next block with room for size bytes, allocating a new one if none of the blocks left has room. Blocks
+too small for the request are skipped until the region is reset. Returns NULL if the heap is out of memory. */
+static void *next_block_alloc(scoped_region *r, size_t size)
+{
+    region_block *block = r->current->next;
+    while (block && block->size < size)
+    {
+        block = block->next;
+    }
+
+    if (!block)
+    {
+        size_t block_size = size > r->next_block_size ? size : r->next_block_size;
+        if (!(block = my_malloc(sizeof(region_block) + block_size)))
+        {
+            return NULL;
+        }
+        block->size = block_size;
+        // New blocks go right after the current one, so the blocks skipped over are still there after a reset
+        block->next = r->current->next;
+        r->current->next = block;
+        r->next_block_size = 2 * r->next_block_size < MAX_REGION_BLOCK ? 2 * r->next_block_size : MAX_REGION_BLOCK;
+    }
+
+    use_block(r, block);
+    r->bump += size;
+    return block_start(block);
+}
+
+/* Allocates size bytes from the region, aligned to ALIGN_TO. The memory lasts until the region is reset or destroyed, and
+is never freed on its own. Returns NULL for 0 bytes or if the heap is out of memory. */
+void *region_alloc(scoped_region *r, size_t size)
+{
+    if (size == 0 || size > SIZE_MASK / 2)
+    {
+        return NULL;
+    }
+    size = (size + ALIGN_TO - 1) & ~(ALIGN_TO - 1);
+    if (size <= (size_t)(r->end - r->bump))
+    {
+        void *ptr = r->bump;
+        r->bump += size;
+        return ptr;
+    }
+    return next_block_alloc(r, size);
+}
+
+/* Empties the region in constant time. Everything allocated from it is gone, and its blocks are kept for what is allocated
+next. */
+void region_reset(scoped_region *r)
+{
+    use_block(r, r->first);
+    r->bump += sizeof(scoped_region);
+}
+
+/* Frees every block of the region, and the region with them. */
+void region_destroy(scoped_region *r)
+{
+    region_block *block = r->first->next;
+    while (block)
+    {
+        region_block *next = block->next;
+        my_free(block);
+        block = next;
+    }
+    my_free(r->first);
+}
+
+/* Returns how many blocks the region has. */
+size_t region_blocks(scoped_region *r)
+{
+    size_t count = 0;
+    for (region_block *block = r->first; block; block = block->next)
+    {
+        count++;
+    }
+    return count;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#if !defined(SCOPED_REGION_H)
+#define SCOPED_REGION_H
+
+#include <stddef.h>
+
+// Size of the first block of a scoped region created without one
+#define DEFAULT_REGION_BLOCK 4096
+// Blocks double in size up to this, so a region that keeps growing still makes few heap allocations
+#define MAX_REGION_BLOCK (64 * 1024)
+
+// Block of memory a scoped region bumps through, allocated from the heap. Allocations follow the struct.
+typedef struct region_block_t
+{
+    struct region_block_t *next;
+    // Bytes after the struct
+    size_t size;
+} region_block;
+
+// Represents a scoped region, memory for allocations that all end together, like everything a request needs. Allocating
+// bumps a pointer through the current block, and the region is emptied or destroyed as a whole instead of freeing each
+// allocation. Not safe to use from more than one thread at a time.
+typedef struct scoped_region_t
+{
+    // Blocks in the order they are bumped through. The first one holds this struct.
+    region_block *first;
+    region_block *current;
+    // Next free byte of the current block, and the end of it
+    char *bump;
+    char *end;
+    // Size of the next block to allocate
+    size_t next_block_size;
+} scoped_region;
+
+scoped_region *region_create(size_t block_size);
+void *region_alloc(scoped_region *r, size_t size);
+void region_reset(scoped_region *r);
+void region_destroy(scoped_region *r);
+size_t region_blocks(scoped_region *r);
+
+#endif // SCOPED_REGION_H
\ No newline at end of file
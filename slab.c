@@ -0,0 +1,376 @@
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "malloc_free.h"
+#include "slab.h"
+
+/* Slabs for small requests. Each thread allocates from a slab of its own for each size class without any atomics, and frees
+from other threads push onto the slab's free list with a compare and swap, so neither path takes a lock. When a thread runs
+out of objects it gives the slab up, and the next free into it publishes it on a list other threads take slabs from.
+
+Slabs are carved from one reserved range of address space, so a pointer is known to be a slab object by its address alone,
+and its slab by masking off the low bits.
+
+When hardened, the links between free objects are mangled with a random key, and each slab has a bit for every object that
+is allocated, so a corrupted link or a double free aborts instead of handing out the same memory twice. */
+
+// Start of the address space reserved for slabs, mapped once and kept across heap resets
+static void *slab_space;
+// Bytes of the reserved space carved into slabs so far
+static size_t slab_top;
+// Slabs given up by their owners that have objects free again, one list per size class. Slabs are only ever pushed on
+// or taken off all at once, which can't go wrong the way popping a single slab can when it is taken and pushed back between.
+static slab *partial_slabs[SLAB_CLASSES];
+// Bumped each time the slabs are reset, so threads drop the slabs they had from before
+static unsigned long slab_generation;
+// Slab each thread allocates from for each size class
+static __thread slab *current_slabs[SLAB_CLASSES] __attribute__((tls_model("initial-exec")));
+// Slabs a thread took off the partial list to use once its current slab runs out
+static __thread slab *spare_slabs[SLAB_CLASSES] __attribute__((tls_model("initial-exec")));
+static __thread unsigned long thread_generation __attribute__((tls_model("initial-exec")));
+static __thread bool registered __attribute__((tls_model("initial-exec")));
+// Used to give up a thread's slabs when it exits
+static pthread_key_t slab_key;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+// Check links and frees, set by init_slabs()
+static bool harden_slabs;
+// Whether the reserved space was last advised to use huge pages
+static bool huge_slabs;
+// Mixed into the links between free objects when hardened
+static uintptr_t link_key;
+
+/* Reserves the address space for slabs the first time, or gives back the pages of every slab on a reset. When harden is set,
+links are mangled with the key and frees are checked. When huge is set, the space is backed with transparent huge pages, so
+the slabs of every thread, which are carved one after the other, share a few TLB entries. Must not be called while other
+threads are using the heap. */
+void init_slabs(bool harden, bool huge, uintptr_t key)
+{
+    if (!slab_space)
+    {
+        // Nothing is backed until it is touched, so the whole range costs no memory up front
+        slab_space = mmap(NULL, SLAB_SPACE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (slab_space == MAP_FAILED)
+        {
+            slab_space = NULL;
+        }
+    }
+    else
+    {
+        madvise(slab_space, slab_top, MADV_DONTNEED);
+    }
+#if defined(MADV_HUGEPAGE)
+    if (slab_space && huge != huge_slabs)
+    {
+        madvise(slab_space, SLAB_SPACE, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+        huge_slabs = huge;
+    }
+#endif
+
+    slab_top = 0;
+    for (size_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        partial_slabs[i] = NULL;
+    }
+    slab_generation++;
+    harden_slabs = harden;
+    link_key = harden ? key : 0;
+}
+
+/* Returns true if the pointer is an object in a slab rather than a chunk of the heap. */
+bool is_slab_object(void *ptr)
+{
+    return slab_space && (uintptr_t)ptr - (uintptr_t)slab_space < SLAB_SPACE;
+}
+
+/* Returns the slab an object is in. */
+static slab *object_slab(void *ptr)
+{
+    return (slab *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_SIZE - 1));
+}
+
+/* Returns the first object of a slab, at the alignment every object size is a multiple of. */
+static void *first_object(slab *s)
+{
+    return (void *)s + (sizeof(slab) + SLAB_STEP - 1) / SLAB_STEP * SLAB_STEP;
+}
+
+/* Returns true if the pointer is at the start of an object of the slab. */
+static bool is_object_start(slab *s, void *ptr)
+{
+    return object_slab(ptr) == s && ptr >= first_object(s) && (size_t)(ptr - first_object(s)) % s->object_size == 0;
+}
+
+/* Mangles a link to the next free object with where it is stored and the key, so an overwritten link only points somewhere
+chosen by someone who knows both. Mangling twice gives the link back. Does nothing unless hardened. */
+static void *protect_link(void *position, void *link)
+{
+    return harden_slabs ? (void *)((uintptr_t)link ^ ((uintptr_t)position >> 12) ^ link_key) : link;
+}
+
+/* Returns the free object after the given one in a list of the slab's free objects, aborting if it is not in the slab. */
+static void *next_object(slab *s, void *object)
+{
+    void *next = protect_link(object, *(void **)object);
+    if (harden_slabs && next && !is_object_start(s, next))
+    {
+        heap_corrupted("corrupted slab free list");
+    }
+    return next;
+}
+
+/* Links an object to the free object after it. */
+static void set_next_object(void *object, void *next)
+{
+    *(void **)object = protect_link(object, next);
+}
+
+/* Returns the size of the objects in the slab the object is in. */
+size_t slab_object_size(void *ptr)
+{
+    return object_slab(ptr)->object_size;
+}
+
+/* Returns how many bytes have been carved into slabs. */
+size_t slab_footprint()
+{
+    return __atomic_load_n(&slab_top, __ATOMIC_RELAXED);
+}
+
+/* Pushes a list of objects running from first to last on the slab's free list. */
+static void push_free(slab *s, void *first, void *last)
+{
+    void *head = __atomic_load_n(&s->free, __ATOMIC_RELAXED);
+    do
+    {
+        set_next_object(last, head);
+    } while (!__atomic_compare_exchange_n(&s->free, &head, first, true, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+}
+
+/* Puts a slab with free objects on the partial list of its size class. */
+static void publish_slab(slab *s)
+{
+    slab **list = &partial_slabs[s->size_class];
+    slab *head = __atomic_load_n(list, __ATOMIC_RELAXED);
+    do
+    {
+        s->next = head;
+    } while (!__atomic_compare_exchange_n(list, &head, s, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Clears the detached flag of a slab. Only one thread can, and that thread decides what happens to the slab. */
+static bool reclaim(slab *s)
+{
+    int expected = 1;
+    return __atomic_compare_exchange_n(&s->detached, &expected, 0, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/* Gives up a slab the calling thread owns. A free from another thread can land between the owner seeing no free objects
+and setting the flag, so the owner looks again after, and whichever of the two clears the flag first keeps the slab or
+publishes it. Returns true if the owner can keep using it. */
+static bool detach(slab *s)
+{
+    __atomic_store_n(&s->detached, 1, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&s->free, __ATOMIC_SEQ_CST) && reclaim(s);
+}
+
+/* Takes a new slab for the size class from the reserved space, with all of its objects linked in address order. Returns NULL
+if the space is used up. */
+static slab *carve_slab(size_t size_class)
+{
+    size_t top = __atomic_load_n(&slab_top, __ATOMIC_RELAXED);
+    do
+    {
+        if (!slab_space || top + SLAB_SIZE > SLAB_SPACE)
+        {
+            return NULL;
+        }
+    } while (!__atomic_compare_exchange_n(&slab_top, &top, top + SLAB_SIZE, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    slab *s = slab_space + top;
+    s->free = NULL;
+    s->next = NULL;
+    s->object_size = (size_class + 1) * SLAB_STEP;
+    s->size_class = size_class;
+    s->detached = 0;
+    memset(s->in_use, 0, sizeof(s->in_use));
+
+    void *first = first_object(s);
+    size_t count = ((void *)s + SLAB_SIZE - first) / s->object_size;
+    s->local = NULL;
+    for (size_t i = count; i > 0; i--)
+    {
+        void *object = first + (i - 1) * s->object_size;
+        set_next_object(object, s->local);
+        s->local = object;
+    }
+    return s;
+}
+
+/* Gives up every slab of a thread that is exiting, so other threads can use their free objects. */
+static void release_exiting_thread_slabs(__attribute__((unused)) void *unused)
+{
+    release_thread_slabs();
+}
+
+static void create_slab_key()
+{
+    pthread_key_create(&slab_key, release_exiting_thread_slabs);
+}
+
+/* Gives the calling thread a slab with free objects for the size class in place of the one it ran out of: the same one if
+objects were freed into it meanwhile, then a spare, then one from the partial list, then a new one. Returns NULL if no slab
+has room and the reserved space is used up. */
+static slab *next_slab(size_t size_class)
+{
+    slab *s = current_slabs[size_class];
+    if (s && detach(s))
+    {
+        s->local = __atomic_exchange_n(&s->free, NULL, __ATOMIC_ACQUIRE);
+        return s;
+    }
+    current_slabs[size_class] = NULL;
+
+    if (!spare_slabs[size_class])
+    {
+        spare_slabs[size_class] = __atomic_exchange_n(&partial_slabs[size_class], NULL, __ATOMIC_ACQUIRE);
+    }
+    s = spare_slabs[size_class];
+    if (s)
+    {
+        spare_slabs[size_class] = s->next;
+        s->local = __atomic_exchange_n(&s->free, NULL, __ATOMIC_ACQUIRE);
+    }
+    else
+    {
+        s = carve_slab(size_class);
+        if (!s)
+        {
+            return NULL;
+        }
+    }
+
+    if (!registered)
+    {
+        pthread_once(&slab_key_once, create_slab_key);
+        pthread_setspecific(slab_key, current_slabs);
+        registered = true;
+    }
+    current_slabs[size_class] = s;
+    return s;
+}
+
+/* Drops the slabs the calling thread had before the slabs were last reset. */
+static void check_generation()
+{
+    if (thread_generation != slab_generation)
+    {
+        for (size_t i = 0; i < SLAB_CLASSES; i++)
+        {
+            current_slabs[i] = NULL;
+            spare_slabs[i] = NULL;
+        }
+        thread_generation = slab_generation;
+    }
+}
+
+/* Returns an object of at least the given size from the calling thread's slab for its size class. Returns NULL if the size
+is too big for a slab or there is no room for another slab. */
+void *slab_malloc(size_t size)
+{
+    if (size == 0 || size > SLAB_MAX_SIZE)
+    {
+        return NULL;
+    }
+    check_generation();
+
+    size_t size_class = (size - 1) / SLAB_STEP;
+    slab *s = current_slabs[size_class];
+    // Take back everything other threads freed once the objects only this thread uses run out
+    if (!s || (!s->local && !(s->local = __atomic_exchange_n(&s->free, NULL, __ATOMIC_ACQUIRE))))
+    {
+        s = next_slab(size_class);
+        if (!s)
+        {
+            return NULL;
+        }
+    }
+
+    void *object = s->local;
+    s->local = next_object(s, object);
+    if (harden_slabs)
+    {
+        // Frees from other threads clear bits in the same words
+        size_t bit = (object - (void *)s) / SLAB_STEP;
+        __atomic_fetch_or(&s->in_use[bit / 64], 1UL << (bit % 64), __ATOMIC_RELAXED);
+    }
+    return object;
+}
+
+/* Frees an object back to its slab. The owner of the slab frees without atomics, and any other thread pushes it on the
+slab's free list, publishing the slab if its owner gave it up. When hardened, aborts if the object is not allocated. */
+void slab_free(void *ptr)
+{
+    slab *s = object_slab(ptr);
+    if (harden_slabs)
+    {
+        if (!is_object_start(s, ptr))
+        {
+            heap_corrupted("free(): invalid pointer");
+        }
+        size_t bit = (ptr - (void *)s) / SLAB_STEP;
+        if (!(__atomic_fetch_and(&s->in_use[bit / 64], ~(1UL << (bit % 64)), __ATOMIC_RELAXED) & (1UL << (bit % 64))))
+        {
+            heap_corrupted("free(): double free detected");
+        }
+    }
+
+    if (thread_generation == slab_generation && current_slabs[s->size_class] == s)
+    {
+        set_next_object(ptr, s->local);
+        s->local = ptr;
+        return;
+    }
+
+    push_free(s, ptr, ptr);
+    if (__atomic_load_n(&s->detached, __ATOMIC_SEQ_CST) && reclaim(s))
+    {
+        publish_slab(s);
+    }
+}
+
+/* Gives up every slab the calling thread has, so other threads can allocate their free objects. */
+void release_thread_slabs()
+{
+    check_generation();
+    for (size_t i = 0; i < SLAB_CLASSES; i++)
+    {
+        slab *s = current_slabs[i];
+        current_slabs[i] = NULL;
+        if (s && s->local)
+        {
+            void *last = s->local;
+            for (void *next = next_object(s, last); next; next = next_object(s, last))
+            {
+                last = next;
+            }
+            push_free(s, s->local, last);
+            s->local = NULL;
+        }
+        if (s && detach(s))
+        {
+            publish_slab(s);
+        }
+
+        // Spares have free objects and are not detached, so no free will publish them
+        while (spare_slabs[i])
+        {
+            s = spare_slabs[i];
+            spare_slabs[i] = s->next;
+            publish_slab(s);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+#if !defined(SLAB_H)
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Size and alignment of a slab, so the slab of an object is found by masking its address
+#define SLAB_SIZE 4096
+// Object sizes of the size classes are multiples of this
+#define SLAB_STEP 16
+// Number of size classes, the biggest of which is the largest request slabs serve
+#define SLAB_CLASSES 8
+#define SLAB_MAX_SIZE (SLAB_STEP * SLAB_CLASSES)
+// Address space reserved for slabs. Pages are only backed once a slab is carved from them.
+#define SLAB_SPACE (1UL << 30)
+
+// Represents a slab, a page of equal sized objects for one size class. Sits at the start of the page, and free objects
+// are linked through their first word, so objects carry no header of their own.
+typedef struct slab_t
+{
+    // Objects freed by any thread, pushed without a lock and taken all at once by the owner
+    void *free;
+    // Objects only the thread that owns the slab allocates from
+    void *local;
+    // Next slab in the list of slabs that were given up with objects free
+    struct slab_t *next;
+    size_t object_size;
+    size_t size_class;
+    // Set once the owner has run out of objects and given up the slab. The first free to clear it publishes the slab.
+    int detached;
+    // Bit for each SLAB_STEP of the page that starts an allocated object, only kept when hardened to catch double frees
+    uint64_t in_use[SLAB_SIZE / SLAB_STEP / 64];
+} slab;
+
+void init_slabs(bool harden, bool huge, uintptr_t key);
+void *slab_malloc(size_t size);
+void slab_free(void *ptr);
+bool is_slab_object(void *ptr);
+size_t slab_object_size(void *ptr);
+size_t slab_footprint();
+void release_thread_slabs();
+
+#endif // SLAB_H
\ No newline at end of file
@@ -1,537 +1,2570 @@
-#include <stdio.h>
-#include <stdbool.h>
-#include <assert.h>
-#include <string.h>
-
-#include "tests.h"
-#include "malloc_free.h"
-#include "main.h"
-
-size_t MAX_CHUNKS;
-size_t CHUNK_SIZE;
-
-#pragma region Test_Helpers
-
-/* Adds emphasis */
-void emphasis(char *message)
-{
-    char top[100] = {0};
-    char bot[100] = {0};
-    for (size_t i = 0; i < strlen(message); i++)
-    {
-        strcat(top, "=");
-        strcat(bot, "=");
-    }
-    printf("\n%s\n%s\n%s\n\n", top, message, bot);
-}
-
-/* Just colors it green to indicate success */
-void success(char *message)
-{
-    printf("\x1b[32m");
-    emphasis(message);
-    printf("\x1b[0m");
-}
-
-/* Just so if I want to edit this it is easier */
-void passed()
-{
-    printf("\nTEST PASSED\n\n");
-}
-
-/* Frees any allocated chunks on the heap. */
-void free_all_chunks()
-{
-    void *chunks_to_free[MAX_CHUNKS];
-    int num_allocated_chunks = 0;
-
-    void *address = heap_pointer;
-    node *last_free = free_list_head;
-    while (address < heap_pointer + HEAP_SIZE)
-    {
-        // If it is free
-        // check if it is in free list
-        if (address == last_free)
-        {
-            node *chunk = (node *)address;
-
-            // next free chunk
-            last_free = last_free->next;
-            // next chunk
-            address += (chunk->size + sizeof(node));
-        }
-        // else it must be allocated
-        else
-        {
-            header *chunk = (header *)address;
-            // check magic number is right
-            assert(chunk->magic == MAGIC_NUMBER);
-
-            // can't free while inside this loop, so store the address for later
-            chunks_to_free[num_allocated_chunks] = chunk + 1;
-            num_allocated_chunks++;
-
-            // next chunk
-            address += (chunk->size + sizeof(header));
-        }
-    }
-    // Free them all
-    for (size_t i = 0; i < num_allocated_chunks; i++)
-    {
-        my_free(chunks_to_free[i]);
-    }
-}
-
-/* Verifies that the each free list node's next pointer address is greater than the node's current address. */
-bool verify_sorted()
-{
-    bool sorted = true;
-    node *curr = free_list_head;
-    while (curr)
-    {
-        if (curr->next && curr->next <= curr)
-        {
-            sorted = false;
-        }
-
-        curr = curr->next;
-    }
-
-    return sorted;
-}
-
-/* Verifies that no free list nodes next pointer is equal to the address of the node plus it's size, which would mean they are adjacent. */
-bool verify_alternating()
-{
-    bool alternating = true;
-    node *curr = free_list_head;
-    while (curr)
-    {
-        if ((uint64_t)curr + curr->size + sizeof(node) == (uint64_t)curr->next)
-        {
-            alternating = false;
-        }
-
-        curr = curr->next;
-    }
-
-    return alternating;
-}
-
-#pragma endregion Test_Helpers
-
-#pragma region Tests
-
-void test_free_chunk_reuse()
-{
-    emphasis("TESTING FREE CHUNKS BEING REUSED AS MUCH AS POSSIBLE");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("ALLOCATING 1 CHUNK WITH SIZE 1/3 OF HEAP...\n");
-    chunks[0] = my_malloc(HEAP_SIZE / 3);
-    printf("ALLOCATING 1 CHUNK WITH A SLIGHTLY GREATER SIZE...\n");
-    chunks[1] = my_malloc((HEAP_SIZE / 3) + CHUNK_SIZE);
-    printf("FREEING THE FIRST CHUNK...\n");
-    my_free(chunks[0]);
-    printf("ALLOCATING ANOTHER CHUNK...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING ADDRESS OF FIRST CHUNK AT START OF HEAP...\n");
-    audit();
-    assert((header *)chunks[0] - 1 == heap_pointer);
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 2 CHUNKS EACH WITH SIZE 1/3 OF HEAP...\n");
-    chunks[0] = my_malloc(HEAP_SIZE / 3);
-    chunks[1] = my_malloc(HEAP_SIZE / 3);
-    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    printf("FREEING THE FIRST 2 CHUNKS...\n");
-    my_free(chunks[0]);
-    my_free(chunks[1]);
-    printf("ALLOCATING ANOTHER CHUNK...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING ADDRESS OF FIRST CHUNK AT START OF HEAP...\n");
-    audit();
-    assert((header *)chunks[0] - 1 == heap_pointer);
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 3 CHUNKS EACH WITH SIZE 1/4 OF HEAP...\n");
-    chunks[0] = my_malloc(HEAP_SIZE / 4);
-    chunks[1] = my_malloc(HEAP_SIZE / 4);
-    chunks[2] = my_malloc(HEAP_SIZE / 4);
-    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    printf("FREEING THE SECOND CHUNK...\n");
-    my_free(chunks[1]);
-    printf("VERIFYING THAT FREE LIST HEAD IS AT THE END OF FIRST ALLOCATED CHUNK...\n");
-    audit();
-    assert(free_list_head == heap_pointer + align(HEAP_SIZE / 4));
-    printf("ALLOCATING ANOTHER CHUNK...\n");
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING THAT NEW CHUNK ADDRESS IS AT THE END OF FIRST ALLOCATED CHUNK...\n");
-    audit();
-    assert((header *)chunks[1] - 1 == heap_pointer + align(HEAP_SIZE / 4));
-    free_all_chunks();
-    passed();
-
-    success("ALL FREE CHUNK REUSE TESTS PASSED");
-}
-
-void test_sorted_free_list()
-{
-    emphasis("TESTING FREE LIST IS SORTED IN IN-MEMORY ORDER");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("ALLOCATING 5 CHUNKS...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    printf("FREEING EVERY OTHER CHUNK...\n");
-    my_free(chunks[0]);
-    my_free(chunks[2]);
-    my_free(chunks[4]);
-    printf("VERIFYING THAT THE FREE CHUNK LIST IS SORTED...\n");
-    audit();
-    assert(verify_sorted());
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 10 CHUNKS...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    chunks[5] = my_malloc(CHUNK_SIZE);
-    chunks[6] = my_malloc(CHUNK_SIZE);
-    chunks[7] = my_malloc(CHUNK_SIZE);
-    chunks[8] = my_malloc(CHUNK_SIZE);
-    chunks[9] = my_malloc(CHUNK_SIZE);
-    printf("FREEING EVERY OTHER CHUNK IN A NON-SEQUENTIAL ORDER...\n");
-    my_free(chunks[4]);
-    my_free(chunks[6]);
-    my_free(chunks[2]);
-    my_free(chunks[0]);
-    my_free(chunks[8]);
-    printf("VERIFYING THAT THE FREE CHUNK LIST IS SORTED...\n");
-    audit();
-    assert(verify_sorted());
-    free_all_chunks();
-    passed();
-
-    success("ALL SORTED FREE LIST TESTS PASSED");
-}
-
-void test_splitting_free_chunks()
-{
-    emphasis("TESTING FREE CHUNKS ARE SPLIT PROPERLY WHEN ALLOCATING");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("ALLOCATING 1 CHUNK...\n");
-    node *prev_head_address = free_list_head;
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    uint64_t expected = (uint64_t)prev_head_address + align(CHUNK_SIZE);
-    printf("CHECKING ADDRESS OF FREE LIST HEAD...\n");
-    printf("EXPECTED: %ld, ACTUAL: %ld\n", expected - offset, (uint64_t)free_list_head - offset);
-    assert((uint64_t)free_list_head == expected);
-    free_all_chunks();
-    passed();
-
-    prev_head_address = free_list_head;
-    printf("ALLOCATING 1 CHUNK OF SIZE 1/2 OF HEAP SIZE...\n");
-    chunks[0] = my_malloc(HEAP_SIZE / 2);
-    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING THAT FREE LIST HEAD HAS MOVED UP BY TOTAL SIZE OF ALLOCATED CHUNKS...\n");
-    expected = (uint64_t)prev_head_address + align(HEAP_SIZE / 2) + align(CHUNK_SIZE);
-    printf("CHECKING ADDRESS OF FREE LIST HEAD...\n");
-    printf("EXPECTED: %ld, ACTUAL: %ld\n", expected - offset, (uint64_t)free_list_head - offset);
-    audit();
-    assert((uint64_t)free_list_head == expected);
-    printf("FREEING FIRST CHUNK...\n");
-    my_free(chunks[0]);
-    prev_head_address = free_list_head;
-    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING THAT FREE LIST HEAD HAS MOVED UP BY SIZE OF ALLOCATED CHUNK...\n");
-    expected = (uint64_t)prev_head_address + align(CHUNK_SIZE);
-    printf("CHECKING ADDRESS OF FREE LIST HEAD...\n");
-    printf("EXPECTED: %ld, ACTUAL: %ld\n", expected - offset, (uint64_t)free_list_head - offset);
-    audit();
-    assert((uint64_t)free_list_head == expected);
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 1 CHUNK THAT IS THE MAX CHUNK SIZE THE HEAP CAN HOLD...\n");
-    chunks[0] = my_malloc(HEAP_SIZE - sizeof(header));
-    printf("VERIFYING FREE LIST HEAD IS NULL...\n");
-    audit();
-    assert(free_list_head == NULL);
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 1 CHUNK OF SIZE 1/2 OF HEAP SIZE...\n");
-    chunks[0] = my_malloc(HEAP_SIZE / 2);
-    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    printf("FREEING FIRST CHUNK...\n");
-    my_free(chunks[0]);
-    printf("ALLOCATING 1 CHUNK OF SIZE 1/2 OF HEAP SIZE...\n");
-    chunks[0] = my_malloc(HEAP_SIZE / 2);
-    printf("VERIFYING THAT THERE IS ONLY 1 FREE CHUNK\n");
-    audit();
-    assert(free_list_head->next == NULL);
-    free_all_chunks();
-    passed();
-
-    success("ALL SPLITTING FREE CHUNKS TESTS PASSED");
-}
-
-void test_coalesce()
-{
-    emphasis("TESTING FREE CHUNKS BEING COALESCED PROPERLY");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("ALLOCATING 5 CHUNKS...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    printf("FREEING ALL CHUNKS...\n");
-    free_all_chunks();
-    printf("MAKING SURE THERE IS ONLY 1 CHUNK...\n");
-    audit();
-    assert(free_list_head->next == NULL);
-    passed();
-
-    printf("ALLOCATING 5 CHUNKS...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    printf("FREEING FIRST 2 AND LAST 2 CHUNKS...\n");
-    my_free(chunks[0]);
-    my_free(chunks[1]);
-    my_free(chunks[3]);
-    my_free(chunks[4]);
-    printf("MAKING SURE THERE ARE ONLY 2 FREE CHUNKS...\n");
-    audit();
-    assert(free_list_head->next->next == NULL);
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 5 CHUNKS...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    printf("FREEING CHUNKS 1, 3 AND 4...\n");
-    my_free(chunks[0]);
-    my_free(chunks[2]);
-    my_free(chunks[3]);
-    printf("MAKING SURE THERE ARE ONLY 3 FREE CHUNKS...\n");
-    audit();
-    assert(free_list_head->next->next->next == NULL);
-    free_all_chunks();
-    passed();
-
-    success("ALL COALESCING TESTS PASSED");
-}
-
-void test_alternating_sequence()
-{
-    emphasis("TESTING HEAP IS IN ALTERNATING SEQUENCE OF 1 FREE CHUNK AND 1 OR MORE ALLOCATED CHUNKS");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("ALLOCATING 2 CHUNKS\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    printf("FREEING SECOND CHUNK\n");
-    my_free(chunks[1]);
-    printf("VERIFYING NO FREE CHUNKS ARE NEXT TO EACH OTHER...\n");
-    audit();
-    assert(verify_alternating());
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 7 CHUNKS\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    chunks[5] = my_malloc(CHUNK_SIZE);
-    chunks[6] = my_malloc(CHUNK_SIZE);
-    printf("FREEING EVERY OTHER CHUNK\n");
-    my_free(chunks[0]);
-    my_free(chunks[2]);
-    my_free(chunks[4]);
-    my_free(chunks[6]);
-    printf("VERIFYING NO FREE CHUNKS ARE NEXT TO EACH OTHER...\n");
-    audit();
-    assert(verify_alternating());
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 3 CHUNKS\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(HEAP_SIZE / 2);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    printf("FREEING MIDDLE CHUNK\n");
-    my_free(chunks[1]);
-    printf("ALLOCATING 4 MORE CHUNKS\n");
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    chunks[5] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING NO FREE CHUNKS ARE NEXT TO EACH OTHER...\n");
-    audit();
-    assert(verify_alternating());
-    free_all_chunks();
-    passed();
-
-    success("ALL ALTERNATING SEQUENCE TESTS PASSED");
-}
-
-void test_worst_fit()
-{
-    emphasis("TESTING WORST FIRST ALLOCATION");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("ALLOCATING 2 CHUNKS...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    printf("FREEING FIRST CHUNK...\n");
-    my_free(chunks[0]);
-    printf("ALLOCATING CHUNK OF SMALLER SIZE...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE / 2);
-    printf("VERIFYING ADDRESS OF SECOND CHUNK IS GREATER THAN ADDRESS OF FIRST...\n");
-    audit();
-    assert(chunks[0] > chunks[1]);
-    free_all_chunks();
-    passed();
-
-    printf("ALLOCATING 3 CHUNKS. MIDDLE CHUNK IS HALF THE HEAP SIZE...\n");
-    chunks[0] = my_malloc(CHUNK_SIZE);
-    chunks[1] = my_malloc(HEAP_SIZE / 2);
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    printf("FREEING MIDDLE CHUNK...\n");
-    my_free(chunks[1]);
-    printf("ALLOCATING 1 CHUNK...\n");
-    chunks[1] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING CHUNK WAS ALLOCATED IN MIDDLE...\n");
-    audit();
-    assert(chunks[1] > chunks[0] && chunks[1] < chunks[2]);
-    printf("ALLOCATING 1 CHUNK...\n");
-    chunks[3] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING CHUNK WAS ALLOCATED IN MIDDLE...\n");
-    audit();
-    assert(chunks[3] > chunks[0] && chunks[3] < chunks[2]);
-    printf("ALLOCATING 1 CHUNK...\n");
-    chunks[4] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING CHUNK WAS ALLOCATED IN MIDDLE...\n");
-    audit();
-    assert(chunks[4] > chunks[0] && chunks[4] < chunks[2]);
-    printf("ALLOCATING 1 CHUNK...\n");
-    chunks[5] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING CHUNK WAS ALLOCATED AT THE END...\n");
-    audit();
-    assert(chunks[5] > chunks[2]);
-    free_all_chunks();
-    passed();
-
-    success("ALL WORST FIT ALLOCATION TESTS PASSED");
-}
-
-void test_malloc_bad_size()
-{
-    emphasis("TESTING MALLOC RETURNS NULL ON BAD VALUE SIZE REQUESTS");
-
-    free_all_chunks();
-    void *chunks[MAX_CHUNKS];
-
-    printf("REQUESTING 1 CHUNK THAT IS TWICE THE SIZE OF HEAP...\n");
-    chunks[0] = my_malloc(2 * HEAP_SIZE);
-    printf("VERIFYING RETURN IS NULL...\n");
-    audit();
-    assert(chunks[0] == NULL);
-    passed();
-
-    printf("ALLOCATING 2 CHUNKS WITH SUM SLIGHTLY SMALLER THAN HEAP SIZE...\n");
-    chunks[0] = my_malloc((HEAP_SIZE / 2) - (CHUNK_SIZE / 2));
-    chunks[1] = my_malloc((HEAP_SIZE / 2) - (CHUNK_SIZE / 2));
-    printf("REQUESTING ADDITIONAL CHUNK WITH SIZE GREATER THAN REMAINING HEAP SIZE...\n");
-    chunks[2] = my_malloc(CHUNK_SIZE);
-    printf("VERIFYING RETURN IS NULL...\n");
-    audit();
-    assert(chunks[2] == NULL);
-    free_all_chunks();
-    passed();
-
-    printf("REQUESTING 1 CHUNK OF SIZE -1...\n");
-    chunks[0] = my_malloc(-1);
-    printf("VERIFYING RETURN IS NULL...\n");
-    audit();
-    assert(chunks[0] == NULL);
-    passed();
-
-    printf("REQUESTING LARGE NEGATIVE SIZE CHUNK...\n");
-    chunks[0] = my_malloc(-HEAP_SIZE / 2);
-    printf("VERIFYING RETURN IS NULL...\n");
-    audit();
-    assert(chunks[0] == NULL);
-    passed();
-
-    printf("REQUESTING SIZE 0 CHUNK...\n");
-    chunks[0] = my_malloc(0);
-    printf("VERIFYING RETURN IS NULL...\n");
-    audit();
-    assert(chunks[0] == NULL);
-    passed();
-
-    success("ALL MALLOC BAD SIZE TESTS PASSED");
-}
-
-void test_all()
-{
-    emphasis("RUNNING ALL TESTS");
-    test_free_chunk_reuse();
-    test_sorted_free_list();
-    test_splitting_free_chunks();
-    test_coalesce();
-    test_alternating_sequence();
-    test_worst_fit();
-    test_malloc_bad_size();
-    success("ALL TESTS PASSED");
-}
-
-#pragma endregion Tests
-
-/* Sets standard chunk size for tests. */
-void init_tests()
-{
-    MAX_CHUNKS = 10;
-    CHUNK_SIZE = HEAP_SIZE / 20;
-
-    printf("Tests using standard chunk size of %ld\n", CHUNK_SIZE);
-    printf("This translate to a total aligned size of %ld\n", align(CHUNK_SIZE));
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <pthread.h>
+#include <errno.h>
+
+#include "tests.h"
+#include "malloc_free.h"
+#include "slab.h"
+#include "profile.h"
+#include "scoped_region.h"
+#include "main.h"
+
+size_t MAX_CHUNKS;
+size_t CHUNK_SIZE;
+
+#pragma region Test_Helpers
+
+/* Adds emphasis */
+void emphasis(char *message)
+{
+    char top[100] = {0};
+    char bot[100] = {0};
+    for (size_t i = 0; i < strlen(message); i++)
+    {
+        strcat(top, "=");
+        strcat(bot, "=");
+    }
+    printf("\n%s\n%s\n%s\n\n", top, message, bot);
+}
+
+/* Just colors it green to indicate success */
+void success(char *message)
+{
+    printf("\x1b[32m");
+    emphasis(message);
+    printf("\x1b[0m");
+}
+
+/* Just so if I want to edit this it is easier */
+void passed()
+{
+    printf("\nTEST PASSED\n\n");
+}
+
+/* Returns true if the chunk is allocated and not sitting in a thread cache. */
+bool chunk_in_use(void *chunk)
+{
+    return !chunk_is_free(chunk) && !chunk_is_cached(chunk);
+}
+
+/* Frees any allocated chunks on the heap. */
+void free_all_chunks()
+{
+    // Chunks in this thread's cache and the quick lists have to go back to the heap first
+    flush_thread_cache();
+    consolidate_heap();
+
+    // Count first so there is room to store them all
+    int num_allocated_chunks = 0;
+    for (size_t a = 0; a < active_arenas; a++)
+    {
+        for (region *r = arenas[a].regions; r; r = r->next)
+        {
+            for (void *address = region_start(r); address < (void *)r; address += chunk_size(address))
+            {
+                if (chunk_in_use(address))
+                {
+                    num_allocated_chunks++;
+                }
+            }
+        }
+    }
+
+    void *chunks_to_free[num_allocated_chunks + 1];
+    num_allocated_chunks = 0;
+
+    for (size_t a = 0; a < active_arenas; a++)
+    {
+        for (region *r = arenas[a].regions; r; r = r->next)
+        {
+            for (void *address = region_start(r); address < (void *)r; address += chunk_size(address))
+            {
+                // If it is not free or cached it must be allocated
+                if (chunk_in_use(address))
+                {
+                    header *chunk = (header *)address;
+                    // check magic number is right
+                    CHECK_MAGIC(chunk);
+
+                    // can't free while inside this loop, so store the address for later
+                    chunks_to_free[num_allocated_chunks] = chunk + 1;
+                    num_allocated_chunks++;
+                }
+            }
+        }
+    }
+    // They were found in address order, so freeing them as a batch walks each free list once
+    my_free_batch(chunks_to_free, num_allocated_chunks);
+}
+
+/* Switches the heap to a placement policy, fixed or growable size, and with or without thread caches, starting over with a fresh heap if any of them change. Otherwise just frees everything.
+Slabs are turned off, since these tests are about the chunks of the heap. */
+void use_heap(placement_policy policy, bool growable, bool cached)
+{
+    if (fit_policy != policy || grow_heap != growable || thread_cache != cached || use_slabs)
+    {
+        grow_heap = growable;
+        thread_cache = cached;
+        use_slabs = false;
+        init_heap_with_policy(policy);
+    }
+    else
+    {
+        free_all_chunks();
+    }
+}
+
+/* Counts the regions in the main arena. */
+int num_regions()
+{
+    int count = 0;
+    for (region *r = main_arena->regions; r; r = r->next)
+    {
+        count++;
+    }
+    return count;
+}
+
+/* Counts the chunks in a bin of the main arena. */
+int bin_length(size_t index)
+{
+    int length = 0;
+    for (node *curr = main_arena->bins[index]; curr; curr = free_chunk_next(curr))
+    {
+        length++;
+    }
+    return length;
+}
+
+/* Verifies that the each free list node's next pointer address is greater than the node's current address. */
+bool verify_sorted()
+{
+    bool sorted = true;
+    node *curr = main_arena->free_list_head;
+    while (curr)
+    {
+        if (free_chunk_next(curr) && free_chunk_next(curr) <= curr)
+        {
+            sorted = false;
+        }
+
+        curr = free_chunk_next(curr);
+    }
+
+    return sorted;
+}
+
+/* Verifies that no free list nodes next pointer is equal to the address of the node plus it's size, which would mean they are adjacent. */
+bool verify_alternating()
+{
+    bool alternating = true;
+    node *curr = main_arena->free_list_head;
+    while (curr)
+    {
+        if ((uint64_t)curr + chunk_size(curr) == (uint64_t)free_chunk_next(curr))
+        {
+            alternating = false;
+        }
+
+        curr = free_chunk_next(curr);
+    }
+
+    return alternating;
+}
+
+#pragma endregion Test_Helpers
+
+#pragma region Tests
+
+void test_free_chunk_reuse()
+{
+    emphasis("TESTING FREE CHUNKS BEING REUSED AS MUCH AS POSSIBLE");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 1 CHUNK WITH SIZE 1/3 OF HEAP...\n");
+    chunks[0] = my_malloc(HEAP_SIZE / 3);
+    printf("ALLOCATING 1 CHUNK WITH A SLIGHTLY GREATER SIZE...\n");
+    chunks[1] = my_malloc((HEAP_SIZE / 3) + CHUNK_SIZE);
+    printf("FREEING THE FIRST CHUNK...\n");
+    my_free(chunks[0]);
+    printf("ALLOCATING ANOTHER CHUNK...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING ADDRESS OF FIRST CHUNK AT START OF HEAP...\n");
+    audit();
+    assert((header *)chunks[0] - 1 == main_arena->heap_pointer);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 2 CHUNKS EACH WITH SIZE 1/3 OF HEAP...\n");
+    chunks[0] = my_malloc(HEAP_SIZE / 3);
+    chunks[1] = my_malloc(HEAP_SIZE / 3);
+    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    printf("FREEING THE FIRST 2 CHUNKS...\n");
+    my_free(chunks[0]);
+    my_free(chunks[1]);
+    printf("ALLOCATING ANOTHER CHUNK...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING ADDRESS OF FIRST CHUNK AT START OF HEAP...\n");
+    audit();
+    assert((header *)chunks[0] - 1 == main_arena->heap_pointer);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 3 CHUNKS EACH WITH SIZE 1/4 OF HEAP...\n");
+    chunks[0] = my_malloc(HEAP_SIZE / 4);
+    chunks[1] = my_malloc(HEAP_SIZE / 4);
+    chunks[2] = my_malloc(HEAP_SIZE / 4);
+    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    printf("FREEING THE SECOND CHUNK...\n");
+    my_free(chunks[1]);
+    printf("VERIFYING THAT FREE LIST HEAD IS AT THE END OF FIRST ALLOCATED CHUNK...\n");
+    audit();
+    assert(main_arena->free_list_head == main_arena->heap_pointer + align(HEAP_SIZE / 4));
+    printf("ALLOCATING ANOTHER CHUNK...\n");
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THAT NEW CHUNK ADDRESS IS AT THE END OF FIRST ALLOCATED CHUNK...\n");
+    audit();
+    assert((header *)chunks[1] - 1 == main_arena->heap_pointer + align(HEAP_SIZE / 4));
+    free_all_chunks();
+    passed();
+
+    success("ALL FREE CHUNK REUSE TESTS PASSED");
+}
+
+void test_sorted_free_list()
+{
+    emphasis("TESTING FREE LIST IS SORTED IN IN-MEMORY ORDER");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 5 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("FREEING EVERY OTHER CHUNK...\n");
+    my_free(chunks[0]);
+    my_free(chunks[2]);
+    my_free(chunks[4]);
+    printf("VERIFYING THAT THE FREE CHUNK LIST IS SORTED...\n");
+    audit();
+    assert(verify_sorted());
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 10 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    chunks[5] = my_malloc(CHUNK_SIZE);
+    chunks[6] = my_malloc(CHUNK_SIZE);
+    chunks[7] = my_malloc(CHUNK_SIZE);
+    chunks[8] = my_malloc(CHUNK_SIZE);
+    chunks[9] = my_malloc(CHUNK_SIZE);
+    printf("FREEING EVERY OTHER CHUNK IN A NON-SEQUENTIAL ORDER...\n");
+    my_free(chunks[4]);
+    my_free(chunks[6]);
+    my_free(chunks[2]);
+    my_free(chunks[0]);
+    my_free(chunks[8]);
+    printf("VERIFYING THAT THE FREE CHUNK LIST IS SORTED...\n");
+    audit();
+    assert(verify_sorted());
+    free_all_chunks();
+    passed();
+
+    success("ALL SORTED FREE LIST TESTS PASSED");
+}
+
+void test_splitting_free_chunks()
+{
+    emphasis("TESTING FREE CHUNKS ARE SPLIT PROPERLY WHEN ALLOCATING");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 1 CHUNK...\n");
+    node *prev_head_address = main_arena->free_list_head;
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    uint64_t expected = (uint64_t)prev_head_address + align(CHUNK_SIZE);
+    printf("CHECKING ADDRESS OF FREE LIST HEAD...\n");
+    printf("EXPECTED: %ld, ACTUAL: %ld\n", expected - offset, (uint64_t)main_arena->free_list_head - offset);
+    assert((uint64_t)main_arena->free_list_head == expected);
+    free_all_chunks();
+    passed();
+
+    prev_head_address = main_arena->free_list_head;
+    printf("ALLOCATING 1 CHUNK OF SIZE 1/2 OF HEAP SIZE...\n");
+    chunks[0] = my_malloc(HEAP_SIZE / 2);
+    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THAT FREE LIST HEAD HAS MOVED UP BY TOTAL SIZE OF ALLOCATED CHUNKS...\n");
+    expected = (uint64_t)prev_head_address + align(HEAP_SIZE / 2) + align(CHUNK_SIZE);
+    printf("CHECKING ADDRESS OF FREE LIST HEAD...\n");
+    printf("EXPECTED: %ld, ACTUAL: %ld\n", expected - offset, (uint64_t)main_arena->free_list_head - offset);
+    audit();
+    assert((uint64_t)main_arena->free_list_head == expected);
+    printf("FREEING FIRST CHUNK...\n");
+    my_free(chunks[0]);
+    prev_head_address = main_arena->free_list_head;
+    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THAT FREE LIST HEAD HAS MOVED UP BY SIZE OF ALLOCATED CHUNK...\n");
+    expected = (uint64_t)prev_head_address + align(CHUNK_SIZE);
+    printf("CHECKING ADDRESS OF FREE LIST HEAD...\n");
+    printf("EXPECTED: %ld, ACTUAL: %ld\n", expected - offset, (uint64_t)main_arena->free_list_head - offset);
+    audit();
+    assert((uint64_t)main_arena->free_list_head == expected);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 1 CHUNK THAT IS THE MAX CHUNK SIZE THE HEAP CAN HOLD...\n");
+    chunks[0] = my_malloc(HEAP_SIZE - sizeof(header));
+    printf("VERIFYING FREE LIST HEAD IS NULL...\n");
+    audit();
+    assert(main_arena->free_list_head == NULL);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 1 CHUNK OF SIZE 1/2 OF HEAP SIZE...\n");
+    chunks[0] = my_malloc(HEAP_SIZE / 2);
+    printf("ALLOCATING ANOTHER CHUNK OF STANDARD SIZE...\n");
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    printf("FREEING FIRST CHUNK...\n");
+    my_free(chunks[0]);
+    printf("ALLOCATING 1 CHUNK OF SIZE 1/2 OF HEAP SIZE...\n");
+    chunks[0] = my_malloc(HEAP_SIZE / 2);
+    printf("VERIFYING THAT THERE IS ONLY 1 FREE CHUNK\n");
+    audit();
+    assert(free_chunk_next(main_arena->free_list_head) == NULL);
+    free_all_chunks();
+    passed();
+
+    success("ALL SPLITTING FREE CHUNKS TESTS PASSED");
+}
+
+void test_coalesce()
+{
+    emphasis("TESTING FREE CHUNKS BEING COALESCED PROPERLY");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 5 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("FREEING ALL CHUNKS...\n");
+    free_all_chunks();
+    printf("MAKING SURE THERE IS ONLY 1 CHUNK...\n");
+    audit();
+    assert(free_chunk_next(main_arena->free_list_head) == NULL);
+    passed();
+
+    printf("ALLOCATING 5 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("FREEING FIRST 2 AND LAST 2 CHUNKS...\n");
+    my_free(chunks[0]);
+    my_free(chunks[1]);
+    my_free(chunks[3]);
+    my_free(chunks[4]);
+    printf("MAKING SURE THERE ARE ONLY 2 FREE CHUNKS...\n");
+    audit();
+    assert(free_chunk_next(free_chunk_next(main_arena->free_list_head)) == NULL);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 5 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("FREEING CHUNKS 1, 3 AND 4...\n");
+    my_free(chunks[0]);
+    my_free(chunks[2]);
+    my_free(chunks[3]);
+    printf("MAKING SURE THERE ARE ONLY 3 FREE CHUNKS...\n");
+    audit();
+    assert(free_chunk_next(free_chunk_next(free_chunk_next(main_arena->free_list_head))) == NULL);
+    free_all_chunks();
+    passed();
+
+    success("ALL COALESCING TESTS PASSED");
+}
+
+void test_alternating_sequence()
+{
+    emphasis("TESTING HEAP IS IN ALTERNATING SEQUENCE OF 1 FREE CHUNK AND 1 OR MORE ALLOCATED CHUNKS");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 2 CHUNKS\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    printf("FREEING SECOND CHUNK\n");
+    my_free(chunks[1]);
+    printf("VERIFYING NO FREE CHUNKS ARE NEXT TO EACH OTHER...\n");
+    audit();
+    assert(verify_alternating());
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 7 CHUNKS\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    chunks[5] = my_malloc(CHUNK_SIZE);
+    chunks[6] = my_malloc(CHUNK_SIZE);
+    printf("FREEING EVERY OTHER CHUNK\n");
+    my_free(chunks[0]);
+    my_free(chunks[2]);
+    my_free(chunks[4]);
+    my_free(chunks[6]);
+    printf("VERIFYING NO FREE CHUNKS ARE NEXT TO EACH OTHER...\n");
+    audit();
+    assert(verify_alternating());
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 3 CHUNKS\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(HEAP_SIZE / 2);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    printf("FREEING MIDDLE CHUNK\n");
+    my_free(chunks[1]);
+    printf("ALLOCATING 4 MORE CHUNKS\n");
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    chunks[5] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING NO FREE CHUNKS ARE NEXT TO EACH OTHER...\n");
+    audit();
+    assert(verify_alternating());
+    free_all_chunks();
+    passed();
+
+    success("ALL ALTERNATING SEQUENCE TESTS PASSED");
+}
+
+void test_worst_fit()
+{
+    emphasis("TESTING WORST FIRST ALLOCATION");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 2 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    printf("FREEING FIRST CHUNK...\n");
+    my_free(chunks[0]);
+    printf("ALLOCATING CHUNK OF SMALLER SIZE...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE / 2);
+    printf("VERIFYING ADDRESS OF SECOND CHUNK IS GREATER THAN ADDRESS OF FIRST...\n");
+    audit();
+    assert(chunks[0] > chunks[1]);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 3 CHUNKS. MIDDLE CHUNK IS HALF THE HEAP SIZE...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(HEAP_SIZE / 2);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    printf("FREEING MIDDLE CHUNK...\n");
+    my_free(chunks[1]);
+    printf("ALLOCATING 1 CHUNK...\n");
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING CHUNK WAS ALLOCATED IN MIDDLE...\n");
+    audit();
+    assert(chunks[1] > chunks[0] && chunks[1] < chunks[2]);
+    printf("ALLOCATING 1 CHUNK...\n");
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING CHUNK WAS ALLOCATED IN MIDDLE...\n");
+    audit();
+    assert(chunks[3] > chunks[0] && chunks[3] < chunks[2]);
+    printf("ALLOCATING 1 CHUNK...\n");
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING CHUNK WAS ALLOCATED IN MIDDLE...\n");
+    audit();
+    assert(chunks[4] > chunks[0] && chunks[4] < chunks[2]);
+    printf("ALLOCATING 1 CHUNK...\n");
+    chunks[5] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING CHUNK WAS ALLOCATED AT THE END...\n");
+    audit();
+    assert(chunks[5] > chunks[2]);
+    free_all_chunks();
+    passed();
+
+    success("ALL WORST FIT ALLOCATION TESTS PASSED");
+}
+
+void test_malloc_bad_size()
+{
+    emphasis("TESTING MALLOC RETURNS NULL ON BAD VALUE SIZE REQUESTS");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("REQUESTING 1 CHUNK THAT IS TWICE THE SIZE OF HEAP...\n");
+    chunks[0] = my_malloc(2 * HEAP_SIZE);
+    printf("VERIFYING RETURN IS NULL...\n");
+    audit();
+    assert(chunks[0] == NULL);
+    passed();
+
+    printf("ALLOCATING 2 CHUNKS WITH SUM SLIGHTLY SMALLER THAN HEAP SIZE...\n");
+    chunks[0] = my_malloc((HEAP_SIZE / 2) - (CHUNK_SIZE / 2));
+    chunks[1] = my_malloc((HEAP_SIZE / 2) - (CHUNK_SIZE / 2));
+    printf("REQUESTING ADDITIONAL CHUNK WITH SIZE GREATER THAN REMAINING HEAP SIZE...\n");
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING RETURN IS NULL...\n");
+    audit();
+    assert(chunks[2] == NULL);
+    free_all_chunks();
+    passed();
+
+    printf("REQUESTING 1 CHUNK OF SIZE -1...\n");
+    chunks[0] = my_malloc(-1);
+    printf("VERIFYING RETURN IS NULL...\n");
+    audit();
+    assert(chunks[0] == NULL);
+    passed();
+
+    printf("REQUESTING LARGE NEGATIVE SIZE CHUNK...\n");
+    chunks[0] = my_malloc(-HEAP_SIZE / 2);
+    printf("VERIFYING RETURN IS NULL...\n");
+    audit();
+    assert(chunks[0] == NULL);
+    passed();
+
+    printf("REQUESTING SIZE 0 CHUNK...\n");
+    chunks[0] = my_malloc(0);
+    printf("VERIFYING RETURN IS NULL...\n");
+    audit();
+    assert(chunks[0] == NULL);
+    passed();
+
+    success("ALL MALLOC BAD SIZE TESTS PASSED");
+}
+
+void test_boundary_tags()
+{
+    emphasis("TESTING BOUNDARY TAG MODE COALESCES NEIGHBOURS WITHOUT A SORTED FREE LIST");
+
+    lifo_free_list = true;
+    grow_heap = false;
+    thread_cache = false;
+    use_slabs = false;
+    init_heap_with_policy(WORST_FIT);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 5 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("FREEING CHUNKS 1 AND 3...\n");
+    my_free(chunks[0]);
+    my_free(chunks[2]);
+    printf("VERIFYING LAST FREED CHUNK IS AT THE FRONT OF THE FREE LIST...\n");
+    audit();
+    assert((header *)chunks[2] - 1 == (header *)main_arena->free_list_head);
+    printf("FREEING CHUNK 2...\n");
+    my_free(chunks[1]);
+    printf("VERIFYING CHUNKS 1 TO 3 WERE MERGED INTO ONE FREE CHUNK AT THE START OF THE HEAP...\n");
+    audit();
+    assert(main_arena->free_list_head == main_arena->heap_pointer);
+    assert(chunk_size(main_arena->free_list_head) == 3 * align(CHUNK_SIZE));
+    assert(free_chunk_next(free_chunk_next(main_arena->free_list_head)) == NULL);
+    passed();
+
+    printf("FREEING CHUNK 5...\n");
+    my_free(chunks[4]);
+    printf("VERIFYING CHUNK 5 WAS MERGED WITH THE END OF THE HEAP...\n");
+    audit();
+    assert(free_chunk_next(main_arena->free_list_head) == (node *)((header *)chunks[4] - 1));
+    assert(free_chunk_next(free_chunk_next(main_arena->free_list_head)) == NULL);
+    printf("FREEING CHUNK 4...\n");
+    my_free(chunks[3]);
+    printf("VERIFYING THE WHOLE HEAP IS ONE FREE CHUNK...\n");
+    audit();
+    assert(main_arena->free_list_head == main_arena->heap_pointer);
+    assert(chunk_size(main_arena->free_list_head) == HEAP_SIZE);
+    assert(free_chunk_next(main_arena->free_list_head) == NULL);
+    passed();
+
+    lifo_free_list = false;
+    init_heap();
+
+    success("ALL BOUNDARY TAG TESTS PASSED");
+}
+
+void test_segregated_fit()
+{
+    emphasis("TESTING SEGREGATED FIT TAKES CHUNKS FROM THE SMALLEST SIZE CLASS THAT FITS");
+
+    use_heap(SEGREGATED_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+    size_t chunk_bin = bin_index(align(CHUNK_SIZE));
+
+    printf("ALLOCATING 5 CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    chunks[2] = my_malloc(CHUNK_SIZE);
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    chunks[4] = my_malloc(CHUNK_SIZE);
+    printf("FREEING CHUNKS 2 AND 4...\n");
+    my_free(chunks[1]);
+    my_free(chunks[3]);
+    printf("VERIFYING BOTH CHUNKS ARE IN THE BIN FOR THEIR SIZE...\n");
+    audit();
+    assert(bin_length(chunk_bin) == 2);
+    assert(main_arena->bin_bitmap & (1UL << chunk_bin));
+    printf("ALLOCATING ANOTHER CHUNK...\n");
+    void *last_freed = chunks[3];
+    chunks[3] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THE LAST FREED CHUNK WAS REUSED...\n");
+    audit();
+    assert(chunks[3] == last_freed);
+    assert(bin_length(chunk_bin) == 1);
+    passed();
+
+    printf("ALLOCATING CHUNK OF SMALLER SIZE...\n");
+    chunks[1] = my_malloc(CHUNK_SIZE / 2);
+    printf("VERIFYING IT WAS SPLIT FROM THE FREE CHUNK IN THE SMALLER BIN INSTEAD OF THE END OF THE HEAP...\n");
+    audit();
+    assert(chunks[1] > chunks[0] && chunks[1] < chunks[2]);
+    assert(bin_length(chunk_bin) == 0);
+    assert(bin_length(bin_index(align(CHUNK_SIZE) - align(CHUNK_SIZE / 2))) == 1);
+    passed();
+
+    printf("FREEING ALL CHUNKS...\n");
+    free_all_chunks();
+    printf("VERIFYING ONLY THE BIN FOR THE WHOLE HEAP IS MARKED IN THE BITMAP...\n");
+    audit();
+    assert(main_arena->bin_bitmap == 1UL << bin_index(HEAP_SIZE));
+    assert(bin_length(bin_index(HEAP_SIZE)) == 1);
+    passed();
+
+    success("ALL SEGREGATED FIT TESTS PASSED");
+}
+
+void test_placement_policies()
+{
+    emphasis("TESTING EACH PLACEMENT POLICY PICKS THE CHUNK IT SHOULD");
+
+    for (placement_policy policy = 0; policy < NUM_POLICIES; policy++)
+    {
+        printf("USING %s FIT...\n", policy_names[policy]);
+        use_heap(policy, false, false);
+        void *chunks[MAX_CHUNKS];
+
+        printf("ALLOCATING 6 CHUNKS. SECOND AND FIFTH CHUNKS ARE A QUARTER OF THE HEAP SIZE...\n");
+        chunks[0] = my_malloc(CHUNK_SIZE);
+        chunks[1] = my_malloc(HEAP_SIZE / 4);
+        chunks[2] = my_malloc(CHUNK_SIZE);
+        chunks[3] = my_malloc(CHUNK_SIZE);
+        chunks[4] = my_malloc(HEAP_SIZE / 4);
+        chunks[5] = my_malloc(CHUNK_SIZE);
+        printf("FREEING SECOND AND FOURTH CHUNKS...\n");
+        my_free(chunks[1]);
+        my_free(chunks[3]);
+
+        // Holes are a big one near the start, an exact fit in the middle, and the end of the heap which is a bit bigger than the first
+        void *big_hole = chunks[1];
+        void *exact_hole = chunks[3];
+        void *end = chunks[5] + align(CHUNK_SIZE);
+        void *expected[NUM_POLICIES][2] = {
+            [SEGREGATED_FIT] = {exact_hole, big_hole},
+            [FIRST_FIT] = {big_hole, big_hole + align(CHUNK_SIZE)},
+            [NEXT_FIT] = {end, end + align(CHUNK_SIZE)},
+            [BEST_FIT] = {exact_hole, big_hole},
+            [WORST_FIT] = {end, big_hole},
+        };
+
+        printf("ALLOCATING 2 CHUNKS...\n");
+        chunks[1] = my_malloc(CHUNK_SIZE);
+        chunks[3] = my_malloc(CHUNK_SIZE);
+        printf("VERIFYING CHUNKS WERE PLACED WHERE %s FIT SHOULD PUT THEM...\n", policy_names[policy]);
+        audit();
+        assert(chunks[1] == expected[policy][0]);
+        assert(chunks[3] == expected[policy][1]);
+        free_all_chunks();
+        passed();
+    }
+
+    success("ALL PLACEMENT POLICY TESTS PASSED");
+}
+
+void test_heap_growth()
+{
+    emphasis("TESTING HEAP GROWS BY MAPPING MORE REGIONS");
+
+    // One policy using bins and one using the sorted free list
+    placement_policy policies[] = {SEGREGATED_FIT, WORST_FIT};
+    for (size_t p = 0; p < 2; p++)
+    {
+        placement_policy policy = policies[p];
+        printf("USING %s FIT...\n", policy_names[policy]);
+        use_heap(policy, true, false);
+        void *chunks[MAX_CHUNKS];
+
+        printf("ALLOCATING 1 CHUNK THAT IS TWICE THE SIZE OF THE HEAP...\n");
+        chunks[0] = my_malloc(2 * HEAP_SIZE);
+        printf("VERIFYING IT WAS PUT IN A NEW REGION...\n");
+        audit();
+        assert(chunks[0] != NULL);
+        assert(num_regions() == 2);
+        assert(find_region(chunks[0]) != find_region(main_arena->heap_pointer));
+        free_all_chunks();
+        passed();
+
+        printf("ALLOCATING 200 CHUNKS...\n");
+        void *many_chunks[200];
+        for (size_t i = 0; i < 200; i++)
+        {
+            many_chunks[i] = my_malloc(CHUNK_SIZE);
+            assert(many_chunks[i] != NULL);
+        }
+        printf("VERIFYING REGIONS DOUBLED IN SIZE SO ONLY 1 MORE REGION WAS NEEDED...\n");
+        audit();
+        assert(num_regions() == 3);
+        printf("FREEING EVERY OTHER CHUNK AND THEN THE REST...\n");
+        for (size_t i = 0; i < 200; i += 2)
+        {
+            my_free(many_chunks[i]);
+        }
+        for (size_t i = 1; i < 200; i += 2)
+        {
+            my_free(many_chunks[i]);
+        }
+        printf("VERIFYING EACH REGION IS ONE FREE CHUNK...\n");
+        audit();
+        for (region *r = main_arena->regions; r; r = r->next)
+        {
+            assert(chunk_is_free(region_start(r)));
+            assert(chunk_size(region_start(r)) == r->size);
+        }
+        passed();
+
+        printf("REQUESTING A NEGATIVE SIZE CHUNK...\n");
+        chunks[0] = my_malloc(-HEAP_SIZE / 2);
+        printf("VERIFYING RETURN IS NULL AND THE HEAP DID NOT GROW...\n");
+        audit();
+        assert(chunks[0] == NULL);
+        assert(num_regions() == 3);
+        passed();
+    }
+
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL HEAP GROWTH TESTS PASSED");
+}
+
+/* Returns true if none of the whole pages between start and end are in memory. */
+bool pages_released(void *start, void *end)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t first_page = ((uint64_t)start + page_size - 1) / page_size * page_size;
+    uint64_t last_page = (uint64_t)end / page_size * page_size;
+    size_t num_pages = (last_page - first_page) / page_size;
+
+    unsigned char resident[num_pages + 1];
+    mincore((void *)first_page, last_page - first_page, resident);
+    for (size_t i = 0; i < num_pages; i++)
+    {
+        if (resident[i] & 1)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_trim()
+{
+    emphasis("TESTING FREE PAGES AND REGIONS ARE GIVEN BACK TO THE OS");
+
+    use_heap(SEGREGATED_FIT, true, false);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t big_size = 8 * page_size;
+    size_t default_threshold = trim_threshold;
+    size_t default_keep = trim_keep;
+    trim_threshold = page_size;
+    trim_keep = 16 * big_size;
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING AND FILLING 1 CHUNK OF 8 PAGES...\n");
+    chunks[0] = my_malloc(big_size);
+    memset(chunks[0], 0xAA, big_size);
+    printf("VERIFYING ITS PAGES ARE IN MEMORY...\n");
+    audit();
+    assert(num_regions() == 2);
+    assert(!pages_released(chunks[0], chunks[0] + big_size));
+    printf("FREEING THE CHUNK...\n");
+    my_free(chunks[0]);
+    printf("VERIFYING ITS PAGES WERE RELEASED BUT THE REGION IS KEPT SINCE THERE IS NOT MUCH OTHER FREE SPACE...\n");
+    audit();
+    assert(num_regions() == 2);
+    assert(pages_released(chunks[0], chunks[0] + big_size));
+    passed();
+
+    printf("ALLOCATING AND FILLING 1 CHUNK OF 8 PAGES...\n");
+    trim_keep = 0;
+    chunks[0] = my_malloc(big_size);
+    memset(chunks[0], 0xAA, big_size);
+    printf("VERIFYING THE KEPT REGION WAS REUSED...\n");
+    audit();
+    assert(num_regions() == 2);
+    printf("FREEING THE CHUNK WITH NO FREE SPACE REQUIRED TO BE KEPT...\n");
+    my_free(chunks[0]);
+    printf("VERIFYING THE REGION WAS UNMAPPED...\n");
+    audit();
+    assert(num_regions() == 1);
+    passed();
+
+    printf("ALLOCATING 2 CHUNKS OF 8 PAGES...\n");
+    chunks[0] = my_malloc(big_size);
+    chunks[1] = my_malloc(big_size);
+    printf("FREEING BOTH CHUNKS...\n");
+    my_free(chunks[0]);
+    my_free(chunks[1]);
+    printf("VERIFYING ONLY THE FIRST REGION IS LEFT, SINCE IT IS NEVER UNMAPPED...\n");
+    audit();
+    assert(num_regions() == 1);
+    assert(find_region(main_arena->heap_pointer) != NULL);
+    passed();
+
+    trim_threshold = default_threshold;
+    trim_keep = default_keep;
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL TRIM TESTS PASSED");
+}
+
+// Chunks allocated by the main thread for the worker threads to free
+void *handed_off_chunks[400];
+
+/* Frees a quarter of the handed off chunks, then allocates and frees chunks of mixed sizes, checking nothing it
+owns was overwritten by another thread. */
+void *churn_thread(void *arg)
+{
+    size_t id = (size_t)arg;
+    for (size_t i = id; i < 400; i += 4)
+    {
+        my_free(handed_off_chunks[i]);
+    }
+
+    unsigned char *owned[16] = {0};
+    size_t sizes[16] = {0};
+    unsigned int seed = id;
+    for (size_t i = 0; i < 20000; i++)
+    {
+        size_t slot = rand_r(&seed) % 16;
+        if (owned[slot])
+        {
+            for (size_t j = 0; j < sizes[slot]; j++)
+            {
+                assert(owned[slot][j] == (unsigned char)(id + slot));
+            }
+            my_free(owned[slot]);
+            owned[slot] = NULL;
+        }
+        else
+        {
+            // Mostly small sizes that go through the cache, with the odd bigger one
+            sizes[slot] = rand_r(&seed) % 8 == 0 ? 1 + rand_r(&seed) % 2000 : 1 + rand_r(&seed) % 200;
+            owned[slot] = my_malloc(sizes[slot]);
+            assert(owned[slot] != NULL);
+            memset(owned[slot], (unsigned char)(id + slot), sizes[slot]);
+        }
+    }
+    for (size_t slot = 0; slot < 16; slot++)
+    {
+        if (owned[slot])
+        {
+            my_free(owned[slot]);
+        }
+    }
+    return NULL;
+}
+
+void test_thread_cache()
+{
+    emphasis("TESTING THREAD CACHES AND ALLOCATING FROM MANY THREADS");
+
+    use_heap(SEGREGATED_FIT, true, true);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 2 SMALL CHUNKS...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE / 4);
+    chunks[1] = my_malloc(CHUNK_SIZE / 4);
+    printf("FREEING THE FIRST CHUNK...\n");
+    my_free(chunks[0]);
+    printf("VERIFYING IT WENT IN THE THREAD CACHE INSTEAD OF THE FREE LIST...\n");
+    audit();
+    assert(chunk_is_cached((header *)chunks[0] - 1));
+    assert(!chunk_is_free((header *)chunks[0] - 1));
+    printf("ALLOCATING ANOTHER SMALL CHUNK...\n");
+    void *cached_chunk = chunks[0];
+    chunks[0] = my_malloc(CHUNK_SIZE / 4);
+    printf("VERIFYING IT CAME FROM THE THREAD CACHE...\n");
+    audit();
+    assert(chunks[0] == cached_chunk);
+    assert(!chunk_is_cached((header *)chunks[0] - 1));
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 1 MORE SMALL CHUNK THAN THE THREAD CACHE CAN HOLD...\n");
+    void *small_chunks[thread_cache_limit + 1];
+    for (size_t i = 0; i <= thread_cache_limit; i++)
+    {
+        small_chunks[i] = my_malloc(CHUNK_SIZE / 4);
+    }
+    printf("FREEING THEM ALL...\n");
+    for (size_t i = 0; i <= thread_cache_limit; i++)
+    {
+        my_free(small_chunks[i]);
+    }
+    printf("VERIFYING THE LAST ONE WENT BACK TO THE HEAP...\n");
+    audit();
+    assert(chunk_is_cached((header *)small_chunks[thread_cache_limit - 1] - 1));
+    assert(chunk_is_free((header *)small_chunks[thread_cache_limit] - 1));
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 400 CHUNKS TO HAND OFF TO 4 THREADS...\n");
+    for (size_t i = 0; i < 400; i++)
+    {
+        handed_off_chunks[i] = my_malloc(1 + i % 300);
+    }
+    printf("FREEING THEM FROM THE THREADS WHILE EACH THREAD ALLOCATES AND FREES 20000 TIMES...\n");
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        pthread_create(&threads[i], NULL, churn_thread, (void *)i);
+    }
+    for (size_t i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    printf("VERIFYING THE THREADS GAVE EVERYTHING BACK WHEN THEY EXITED...\n");
+    audit();
+    for (size_t a = 0; a < active_arenas; a++)
+    {
+        for (region *r = arenas[a].regions; r; r = r->next)
+        {
+            assert(chunk_is_free(region_start(r)));
+            assert(chunk_size(region_start(r)) == r->size);
+        }
+    }
+    passed();
+
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL THREAD CACHE TESTS PASSED");
+}
+
+// Chunks allocated by the arena test threads
+void *arena_chunks[4];
+
+/* Allocates a chunk from whichever arena this thread is given. */
+void *arena_thread(void *arg)
+{
+    size_t id = (size_t)arg;
+    arena_chunks[id] = my_malloc(CHUNK_SIZE);
+    return NULL;
+}
+
+/* Holds the main arena's lock for a moment, setting the flag once it has it. */
+void *lock_holder_thread(void *arg)
+{
+    pthread_mutex_lock(&main_arena->lock);
+    __atomic_store_n((bool *)arg, true, __ATOMIC_RELEASE);
+    usleep(100000);
+    pthread_mutex_unlock(&main_arena->lock);
+    return NULL;
+}
+
+// Stands in for a lock a wrapper like the tracing in preload.c holds across its calls into the allocator
+pthread_mutex_t wrapper_lock = PTHREAD_MUTEX_INITIALIZER;
+bool stop_reallocating;
+
+void lock_wrapper()
+{
+    pthread_mutex_lock(&wrapper_lock);
+}
+
+void unlock_wrapper()
+{
+    pthread_mutex_unlock(&wrapper_lock);
+}
+
+/* Reallocates a chunk back and forth between the heap and a mapping of its own, holding the wrapper's lock across each call,
+until told to stop. */
+void *wrapped_realloc_thread(void *arg)
+{
+    void *ptr = my_malloc(1000);
+    for (size_t i = 0; !__atomic_load_n(&stop_reallocating, __ATOMIC_ACQUIRE); i++)
+    {
+        pthread_mutex_lock(&wrapper_lock);
+        ptr = my_realloc(ptr, i % 2 ? 300000 : 1000);
+        pthread_mutex_unlock(&wrapper_lock);
+    }
+    my_free(ptr);
+    return NULL;
+}
+
+/* Forks 500 times while 4 threads reallocate under the wrapper's lock, which the fork hooks take. Each child takes the
+wrapper's lock and allocates. Returns how many children failed to. */
+int fork_while_reallocating()
+{
+    set_fork_hooks(lock_wrapper, unlock_wrapper, unlock_wrapper);
+    pthread_t threads[4];
+    for (size_t i = 0; i < 4; i++)
+    {
+        pthread_create(&threads[i], NULL, wrapped_realloc_thread, NULL);
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < 500; i++)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            alarm(5);
+            pthread_mutex_lock(&wrapper_lock);
+            my_free(my_malloc(CHUNK_SIZE));
+            pthread_mutex_unlock(&wrapper_lock);
+            _exit(0);
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        failed += !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+    }
+
+    __atomic_store_n(&stop_reallocating, true, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    return failed;
+}
+
+/* Pins this thread to the first CPU it is allowed on, stores which one, then allocates a chunk. */
+void *pinned_thread(void *arg)
+{
+    cpu_set_t cpus;
+    pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    int cpu = 0;
+    while (!CPU_ISSET(cpu, &cpus))
+    {
+        cpu++;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+    *(int *)arg = cpu;
+    arena_chunks[0] = my_malloc(CHUNK_SIZE);
+    return NULL;
+}
+
+void test_arenas()
+{
+    emphasis("TESTING THREADS ALLOCATE FROM THEIR OWN ARENAS");
+
+    num_arenas = 4;
+    grow_heap = true;
+    thread_cache = false;
+    use_slabs = false;
+    init_heap_with_policy(SEGREGATED_FIT);
+    void *chunks[MAX_CHUNKS];
+    pthread_t threads[4];
+
+    printf("ALLOCATING 1 CHUNK FROM EACH OF 3 NEW THREADS, ONE AFTER ANOTHER...\n");
+    for (size_t i = 1; i < 4; i++)
+    {
+        pthread_create(&threads[i], NULL, arena_thread, (void *)i);
+        pthread_join(threads[i], NULL);
+    }
+    printf("ALLOCATING 1 CHUNK FROM THIS THREAD...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THIS THREAD KEPT THE MAIN ARENA AND THE OTHERS WERE HANDED THE NEXT ARENAS IN TURN...\n");
+    audit();
+    assert(chunk_arena((header *)chunks[0] - 1) == main_arena);
+    for (size_t i = 1; i < 4; i++)
+    {
+        assert(chunk_arena((header *)arena_chunks[i] - 1) == &arenas[i]);
+        assert(find_region(arena_chunks[i]) == arenas[i].regions);
+    }
+    printf("FREEING THE OTHER THREADS' CHUNKS FROM THIS THREAD...\n");
+    for (size_t i = 1; i < 4; i++)
+    {
+        my_free(arena_chunks[i]);
+    }
+    printf("VERIFYING EACH CHUNK WENT BACK TO ITS OWN ARENA...\n");
+    audit();
+    for (size_t i = 1; i < 4; i++)
+    {
+        assert(chunk_is_free(arenas[i].heap_pointer));
+        assert(chunk_size(arenas[i].heap_pointer) == arenas[i].regions->size);
+    }
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 400 CHUNKS TO HAND OFF TO 4 THREADS...\n");
+    for (size_t i = 0; i < 400; i++)
+    {
+        handed_off_chunks[i] = my_malloc(1 + i % 300);
+    }
+    printf("FREEING THEM FROM THE THREADS WHILE EACH THREAD ALLOCATES AND FREES 20000 TIMES FROM ITS OWN ARENA...\n");
+    for (size_t i = 0; i < 4; i++)
+    {
+        pthread_create(&threads[i], NULL, churn_thread, (void *)i);
+    }
+    for (size_t i = 0; i < 4; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    printf("VERIFYING EVERY ARENA IS ENTIRELY FREE...\n");
+    audit();
+    for (size_t a = 0; a < active_arenas; a++)
+    {
+        for (region *r = arenas[a].regions; r; r = r->next)
+        {
+            assert(chunk_is_free(region_start(r)));
+            assert(chunk_size(region_start(r)) == r->size);
+        }
+    }
+    passed();
+
+    printf("ALLOCATING 1 CHUNK FROM A THREAD PINNED TO ONE CPU WITH ARENAS ASSIGNED BY CPU...\n");
+    arena_policy = BY_CPU;
+    int cpu = -1;
+    pthread_create(&threads[0], NULL, pinned_thread, &cpu);
+    pthread_join(threads[0], NULL);
+    printf("VERIFYING IT CAME FROM THE ARENA FOR THAT CPU...\n");
+    audit();
+    assert(chunk_arena((header *)arena_chunks[0] - 1) == &arenas[cpu % 4]);
+    my_free(arena_chunks[0]);
+    passed();
+
+    printf("FORKING WHILE ANOTHER THREAD HOLDS THE MAIN ARENA'S LOCK...\n");
+    bool locked = false;
+    pthread_create(&threads[0], NULL, lock_holder_thread, &locked);
+    while (!__atomic_load_n(&locked, __ATOMIC_ACQUIRE))
+    {
+        sched_yield();
+    }
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // A lock copied while held would never be let go in the child
+        alarm(5);
+        my_free(my_malloc(CHUNK_SIZE));
+        _exit(0);
+    }
+    pthread_join(threads[0], NULL);
+    printf("VERIFYING THE CHILD CAN ALLOCATE...\n");
+    int status;
+    waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    passed();
+
+    printf("FORKING 500 TIMES WHILE 4 THREADS REALLOCATE HOLDING A WRAPPER'S LOCK TAKEN BY THE FORK HOOKS...\n");
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0)
+    {
+        // In a process of its own, so a deadlock is ended by the alarm instead of hanging the tests
+        alarm(30);
+        _exit(fork_while_reallocating());
+    }
+    waitpid(pid, &status, 0);
+    printf("VERIFYING NO FORK DEADLOCKED AND EVERY CHILD COULD TAKE THE LOCK AND ALLOCATE...\n");
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    passed();
+
+    num_arenas = 0;
+    arena_policy = ROUND_ROBIN;
+    grow_heap = false;
+    init_heap();
+
+    success("ALL ARENA TESTS PASSED");
+}
+
+/* Returns true if every byte of the memory is zero. */
+bool all_zero(unsigned char *memory, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if (memory[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void test_malloc_family()
+{
+    emphasis("TESTING REALLOC, CALLOC, ALIGNED ALLOC AND USABLE SIZE");
+
+    use_heap(SEGREGATED_FIT, true, false);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 2 CHUNKS AND FILLING THE FIRST...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    memset(chunks[0], 0xAA, CHUNK_SIZE);
+    printf("VERIFYING THE USABLE SIZE IS THE SIZE IN THE HEADER AND AT LEAST WHAT WAS ASKED FOR...\n");
+    assert(my_malloc_usable_size(chunks[0]) == stored_size((header *)chunks[0] - 1));
+    assert(my_malloc_usable_size(chunks[0]) >= CHUNK_SIZE);
+    printf("FREEING THE SECOND CHUNK AND GROWING THE FIRST TO 1.5 CHUNKS...\n");
+    my_free(chunks[1]);
+    void *old_chunk = chunks[0];
+    chunks[0] = my_realloc(chunks[0], CHUNK_SIZE + CHUNK_SIZE / 2);
+    printf("VERIFYING IT GREW IN PLACE INTO THE FREE CHUNK AFTER IT AND KEPT ITS CONTENTS...\n");
+    audit();
+    assert(chunks[0] == old_chunk);
+    assert(my_malloc_usable_size(chunks[0]) >= CHUNK_SIZE + CHUNK_SIZE / 2);
+    assert(chunk_is_free((void *)chunks[0] - sizeof(header) + align(CHUNK_SIZE + CHUNK_SIZE / 2)));
+    for (size_t i = 0; i < CHUNK_SIZE; i++)
+    {
+        assert(((unsigned char *)chunks[0])[i] == 0xAA);
+    }
+    printf("SHRINKING IT TO HALF A CHUNK...\n");
+    chunks[0] = my_realloc(chunks[0], CHUNK_SIZE / 2);
+    printf("VERIFYING IT SHRANK IN PLACE AND THE END WAS FREED...\n");
+    audit();
+    assert(chunks[0] == old_chunk);
+    assert(chunk_size((header *)chunks[0] - 1) == align(CHUNK_SIZE / 2));
+    assert(chunk_is_free((void *)chunks[0] - sizeof(header) + align(CHUNK_SIZE / 2)));
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 2 CHUNKS AND FILLING THE FIRST...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    memset(chunks[0], 0xAA, CHUNK_SIZE);
+    printf("GROWING THE FIRST TO 2 CHUNKS...\n");
+    old_chunk = chunks[0];
+    chunks[0] = my_realloc(chunks[0], 2 * CHUNK_SIZE);
+    printf("VERIFYING IT WAS MOVED, SINCE THE CHUNK AFTER IT IS ALLOCATED, AND ITS CONTENTS WERE COPIED...\n");
+    audit();
+    assert(chunks[0] != old_chunk);
+    assert(chunk_is_free((header *)old_chunk - 1));
+    for (size_t i = 0; i < CHUNK_SIZE; i++)
+    {
+        assert(((unsigned char *)chunks[0])[i] == 0xAA);
+    }
+    printf("REALLOCATING NULL AND THEN TO SIZE 0...\n");
+    chunks[2] = my_realloc(NULL, CHUNK_SIZE);
+    void *shrunk = my_realloc(chunks[2], 0);
+    printf("VERIFYING THE FIRST ACTED AS MALLOC AND THE SECOND AS FREE...\n");
+    audit();
+    assert(chunks[2] != NULL && shrunk == NULL);
+    assert(chunk_is_free((header *)chunks[2] - 1));
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING 2 CHUNKS, FILLING THE FIRST AND FREEING IT...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    memset(chunks[0], 0xAA, CHUNK_SIZE);
+    my_free(chunks[0]);
+    printf("CALLOCING THE SAME SIZE...\n");
+    old_chunk = chunks[0];
+    chunks[0] = my_calloc(1, CHUNK_SIZE);
+    printf("VERIFYING IT REUSED THE DIRTY CHUNK AND ZEROED IT...\n");
+    audit();
+    assert(chunks[0] == old_chunk);
+    assert(all_zero(chunks[0], CHUNK_SIZE));
+    printf("CALLOCING 2 HEAP SIZES THAT NEED A NEW REGION...\n");
+    chunks[2] = my_calloc(2, HEAP_SIZE);
+    printf("VERIFYING IT IS ZERO...\n");
+    audit();
+    assert(chunks[2] != NULL);
+    assert(all_zero(chunks[2], 2 * HEAP_SIZE));
+    printf("CALLOCING A TOTAL SIZE THAT OVERFLOWS...\n");
+    chunks[3] = my_calloc(SIZE_MAX / 2, 3);
+    printf("VERIFYING RETURN IS NULL...\n");
+    assert(chunks[3] == NULL);
+    free_all_chunks();
+    passed();
+
+    printf("ALLOCATING A SMALL CHUNK AND THEN CHUNKS ALIGNED TO 64, 256 AND 4096 BYTES...\n");
+    chunks[0] = my_malloc(1);
+    size_t alignments[] = {64, 256, 4096};
+    for (size_t i = 0; i < 3; i++)
+    {
+        chunks[i + 1] = my_aligned_alloc(alignments[i], CHUNK_SIZE);
+    }
+    printf("VERIFYING THEY ARE ALIGNED AND THE GAPS BEFORE THEM WERE FREED...\n");
+    audit();
+    for (size_t i = 0; i < 3; i++)
+    {
+        assert(chunks[i + 1] != NULL);
+        assert((uint64_t)chunks[i + 1] % alignments[i] == 0);
+        assert(my_malloc_usable_size(chunks[i + 1]) >= CHUNK_SIZE);
+    }
+    printf("REQUESTING ALIGNMENTS THAT ARE NOT A POWER OF TWO...\n");
+    void *misaligned = my_aligned_alloc(48, CHUNK_SIZE);
+    int error = my_posix_memalign(&chunks[4], 24, CHUNK_SIZE);
+    printf("VERIFYING THEY ARE REFUSED...\n");
+    assert(misaligned == NULL && error == EINVAL);
+    printf("ALIGNING A CHUNK TO 512 BYTES WITH POSIX_MEMALIGN...\n");
+    error = my_posix_memalign(&chunks[4], 512, CHUNK_SIZE);
+    printf("VERIFYING IT IS ALIGNED...\n");
+    audit();
+    assert(error == 0 && (uint64_t)chunks[4] % 512 == 0);
+    free_all_chunks();
+    passed();
+
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL MALLOC FAMILY TESTS PASSED");
+}
+
+// Objects allocated by one thread for another to free in the slab tests
+void *slab_objects[1000];
+
+/* Allocates the slab objects, and exits without freeing them. */
+void *slab_thread(__attribute__((unused)) void *arg)
+{
+    for (size_t i = 0; i < 1000; i++)
+    {
+        slab_objects[i] = my_malloc(64);
+    }
+    return NULL;
+}
+
+void test_slabs()
+{
+    emphasis("TESTING SMALL OBJECTS ARE SERVED FROM SLABS");
+
+    use_slabs = true;
+    grow_heap = true;
+    thread_cache = false;
+    init_heap_with_policy(SEGREGATED_FIT);
+    size_t objects_per_slab = (SLAB_SIZE - (sizeof(slab) + SLAB_STEP - 1) / SLAB_STEP * SLAB_STEP) / SLAB_STEP;
+    void *objects[objects_per_slab + 1];
+
+    printf("ALLOCATING 1 OBJECT OF EACH SIZE FROM 1 TO %d BYTES...\n", SLAB_MAX_SIZE);
+    for (size_t size = 1; size <= SLAB_MAX_SIZE; size++)
+    {
+        void *object = my_malloc(size);
+        printf("VERIFYING THE %ld BYTE OBJECT IS IN A SLAB OF ITS SIZE CLASS AND NOT IN THE HEAP...\n", size);
+        assert(is_slab_object(object));
+        assert(!find_region(object));
+        assert((uint64_t)object % SLAB_STEP == 0);
+        assert(my_malloc_usable_size(object) == (size + SLAB_STEP - 1) / SLAB_STEP * SLAB_STEP);
+        assert(my_malloc_usable_size(object) == ((slab *)((uint64_t)object & ~(uint64_t)(SLAB_SIZE - 1)))->object_size);
+        my_free(object);
+    }
+    printf("VERIFYING THE HEAP WAS NEVER USED...\n");
+    audit();
+    assert(chunk_is_free(main_arena->heap_pointer));
+    assert(chunk_size(main_arena->heap_pointer) == HEAP_SIZE);
+    printf("ALLOCATING 1 CHUNK OF STANDARD SIZE...\n");
+    void *chunk = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING IT CAME FROM THE HEAP...\n");
+    audit();
+    assert(!is_slab_object(chunk));
+    assert((header *)chunk - 1 == main_arena->heap_pointer);
+    my_free(chunk);
+    passed();
+
+    printf("ALLOCATING 1 MORE %d BYTE OBJECT THAN FITS IN A SLAB...\n", SLAB_STEP);
+    size_t footprint = slab_footprint();
+    for (size_t i = 0; i <= objects_per_slab; i++)
+    {
+        objects[i] = my_malloc(SLAB_STEP);
+    }
+    printf("VERIFYING THE FIRST SLAB WAS FILLED IN ADDRESS ORDER WITHOUT HEADERS AND THE LAST OBJECT STARTED ANOTHER...\n");
+    for (size_t i = 1; i < objects_per_slab; i++)
+    {
+        assert(objects[i] == objects[i - 1] + SLAB_STEP);
+    }
+    assert((uint64_t)objects[objects_per_slab] / SLAB_SIZE != (uint64_t)objects[0] / SLAB_SIZE);
+    assert(slab_footprint() == footprint + SLAB_SIZE);
+    printf("FREEING THEM ALL AND ALLOCATING THE SAME NUMBER AGAIN...\n");
+    for (size_t i = 0; i <= objects_per_slab; i++)
+    {
+        my_free(objects[i]);
+    }
+    for (size_t i = 0; i <= objects_per_slab; i++)
+    {
+        objects[i] = my_malloc(SLAB_STEP);
+    }
+    printf("VERIFYING NO NEW SLAB WAS NEEDED...\n");
+    assert(slab_footprint() == footprint + SLAB_SIZE);
+    for (size_t i = 0; i <= objects_per_slab; i++)
+    {
+        my_free(objects[i]);
+    }
+    passed();
+
+    printf("ALLOCATING 1000 64 BYTE OBJECTS FROM A THREAD THAT THEN EXITS...\n");
+    pthread_t thread;
+    pthread_create(&thread, NULL, slab_thread, NULL);
+    pthread_join(thread, NULL);
+    footprint = slab_footprint();
+    printf("FREEING THEM FROM THIS THREAD...\n");
+    for (size_t i = 0; i < 1000; i++)
+    {
+        assert(is_slab_object(slab_objects[i]));
+        my_free(slab_objects[i]);
+    }
+    printf("ALLOCATING 1000 64 BYTE OBJECTS FROM ANOTHER THREAD...\n");
+    pthread_create(&thread, NULL, slab_thread, NULL);
+    pthread_join(thread, NULL);
+    printf("VERIFYING IT REUSED THE SLABS THE FIRST THREAD GAVE UP...\n");
+    assert(slab_footprint() == footprint);
+    for (size_t i = 0; i < 1000; i++)
+    {
+        my_free(slab_objects[i]);
+    }
+    passed();
+
+    printf("CALLOCING, REALLOCATING AND ALIGNING SMALL OBJECTS...\n");
+    objects[0] = my_malloc(40);
+    memset(objects[0], 0xAA, 40);
+    objects[1] = my_realloc(objects[0], 48);
+    printf("VERIFYING REALLOC STAYS IN THE OBJECT WHILE IT FITS AND MOVES TO THE HEAP WHEN IT DOESN'T...\n");
+    assert(objects[1] == objects[0]);
+    objects[1] = my_realloc(objects[0], CHUNK_SIZE);
+    assert(!is_slab_object(objects[1]));
+    for (size_t i = 0; i < 40; i++)
+    {
+        assert(((unsigned char *)objects[1])[i] == 0xAA);
+    }
+    my_free(objects[1]);
+    printf("VERIFYING A CALLOC REUSING THE DIRTY OBJECT IS ZERO...\n");
+    objects[1] = my_calloc(1, 48);
+    assert(objects[1] == objects[0]);
+    assert(all_zero(objects[1], 48));
+    my_free(objects[1]);
+    printf("VERIFYING A 16 BYTE ALIGNED OBJECT COMES FROM A SLAB...\n");
+    objects[2] = my_aligned_alloc(16, 24);
+    assert(is_slab_object(objects[2]));
+    assert((uint64_t)objects[2] % 16 == 0);
+    my_free(objects[2]);
+    audit();
+    passed();
+
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL SLAB TESTS PASSED");
+}
+
+/* Returns true if none of the pages from the address on are mapped. */
+bool unmapped(void *address, size_t length)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    unsigned char resident[length / page_size + 1];
+    return mincore(address, length, resident) == -1 && errno == ENOMEM;
+}
+
+void test_mapped_chunks()
+{
+    emphasis("TESTING LARGE REQUESTS GET MAPPINGS OF THEIR OWN");
+
+    use_heap(SEGREGATED_FIT, true, false);
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 1 CHUNK JUST UNDER THE MMAP THRESHOLD OF %ld BYTES...\n", mmap_threshold);
+    chunks[0] = my_malloc(mmap_threshold - 1);
+    printf("VERIFYING IT CAME FROM THE HEAP...\n");
+    audit();
+    assert(!(((header *)chunks[0] - 1)->size_flags & CHUNK_MAPPED));
+    assert(find_region(chunks[0]));
+    my_free(chunks[0]);
+    // The region it needed is kept, so everything after is measured from here
+    size_t footprint = heap_footprint();
+    printf("ALLOCATING 1 CHUNK OF THE THRESHOLD...\n");
+    chunks[0] = my_malloc(mmap_threshold);
+    printf("VERIFYING IT HAS A MAPPING OF ITS OWN STARTING WITH ITS HEADER AND THE HEAP WAS NOT USED...\n");
+    audit();
+    header *hptr = (header *)chunks[0] - 1;
+    assert(hptr->size_flags & CHUNK_MAPPED);
+    assert(!find_region(chunks[0]));
+    assert((uint64_t)hptr % page_size == 0);
+    assert(my_malloc_usable_size(chunks[0]) >= mmap_threshold);
+    assert(heap_footprint() == footprint + my_malloc_usable_size(chunks[0]) + sizeof(header));
+    assert(chunk_is_free(main_arena->heap_pointer));
+    passed();
+
+    printf("FILLING THE MAPPED CHUNK AND REALLOCATING IT TO 4 TIMES ITS SIZE...\n");
+    memset(chunks[0], 0xAA, mmap_threshold);
+    chunks[0] = my_realloc(chunks[0], 4 * mmap_threshold);
+    printf("VERIFYING IT IS STILL MAPPED, BIG ENOUGH AND KEPT ITS CONTENTS...\n");
+    audit();
+    assert(((header *)chunks[0] - 1)->size_flags & CHUNK_MAPPED);
+    assert(my_malloc_usable_size(chunks[0]) >= 4 * mmap_threshold);
+    assert(heap_footprint() == footprint + my_malloc_usable_size(chunks[0]) + sizeof(header));
+    for (size_t i = 0; i < mmap_threshold; i++)
+    {
+        assert(((unsigned char *)chunks[0])[i] == 0xAA);
+    }
+    printf("REALLOCATING IT DOWN TO 1 CHUNK OF STANDARD SIZE...\n");
+    void *old_chunk = chunks[0];
+    chunks[0] = my_realloc(chunks[0], CHUNK_SIZE);
+    printf("VERIFYING IT MOVED INTO THE HEAP WITH ITS CONTENTS AND ITS MAPPING WAS UNMAPPED...\n");
+    audit();
+    assert(find_region(chunks[0]));
+    assert(unmapped((header *)old_chunk - 1, 4 * mmap_threshold));
+    assert(heap_footprint() == footprint);
+    for (size_t i = 0; i < CHUNK_SIZE; i++)
+    {
+        assert(((unsigned char *)chunks[0])[i] == 0xAA);
+    }
+    printf("REALLOCATING IT BACK UP TO THE THRESHOLD...\n");
+    chunks[0] = my_realloc(chunks[0], mmap_threshold);
+    printf("VERIFYING IT MOVED INTO A MAPPING OF ITS OWN...\n");
+    audit();
+    assert(((header *)chunks[0] - 1)->size_flags & CHUNK_MAPPED);
+    assert(chunk_is_free(main_arena->heap_pointer));
+    my_free(chunks[0]);
+    passed();
+
+    printf("CALLOCING 2 HALVES OF THE THRESHOLD...\n");
+    chunks[0] = my_calloc(2, mmap_threshold / 2);
+    printf("VERIFYING IT IS MAPPED AND ZERO...\n");
+    audit();
+    assert(((header *)chunks[0] - 1)->size_flags & CHUNK_MAPPED);
+    assert(all_zero(chunks[0], mmap_threshold));
+    printf("FREEING IT...\n");
+    hptr = (header *)chunks[0] - 1;
+    my_free(chunks[0]);
+    printf("VERIFYING IT WAS UNMAPPED...\n");
+    assert(unmapped(hptr, mmap_threshold));
+    assert(heap_footprint() == footprint);
+    passed();
+
+    printf("ALLOCATING 1 CHUNK OF THE THRESHOLD ON A FIXED SIZE HEAP...\n");
+    use_heap(SEGREGATED_FIT, false, false);
+    chunks[0] = my_malloc(mmap_threshold);
+    printf("VERIFYING IT WAS MAPPED EVEN THOUGH IT IS BIGGER THAN THE HEAP...\n");
+    audit();
+    assert(chunks[0] != NULL);
+    assert(((header *)chunks[0] - 1)->size_flags & CHUNK_MAPPED);
+    my_free(chunks[0]);
+    passed();
+
+    printf("ALLOCATING 0 BYTES AND THEN 1 BYTE WITH A THRESHOLD OF 0...\n");
+    size_t saved_threshold = mmap_threshold;
+    mmap_threshold = 0;
+    chunks[0] = my_malloc(0);
+    chunks[1] = my_malloc(1);
+    printf("VERIFYING 0 BYTES STILL GIVES NULL AND ONLY THE BYTE WAS MAPPED...\n");
+    audit();
+    assert(chunks[0] == NULL && chunks[1] != NULL);
+    assert(((header *)chunks[1] - 1)->size_flags & CHUNK_MAPPED);
+    my_free(chunks[1]);
+    mmap_threshold = saved_threshold;
+    passed();
+
+    success("ALL MAPPED CHUNK TESTS PASSED");
+}
+
+/* Runs a function in a child process and returns true if it aborted, for checks that are meant to kill the program. */
+bool aborts(void (*function)(void *), void *arg)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        function(arg);
+        _exit(0);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+}
+
+void free_twice(void *ptr)
+{
+    my_free(ptr);
+    my_free(ptr);
+}
+
+void free_once(void *ptr)
+{
+    my_free(ptr);
+}
+
+/* Flips a bit of the link left in a cached chunk, as a write through a dangling pointer would, then allocates it and the
+chunk its link leads to. */
+void corrupt_link_and_malloc(void *ptr)
+{
+    *(uint64_t *)ptr ^= 1;
+    my_malloc(CHUNK_SIZE);
+    my_malloc(CHUNK_SIZE);
+}
+
+void test_hardening()
+{
+    emphasis("TESTING A HARDENED HEAP CATCHES DOUBLE FREES AND CORRUPTED LINKS");
+
+    harden_heap = true;
+    use_slabs = true;
+    grow_heap = true;
+    thread_cache = true;
+    init_heap_with_policy(SEGREGATED_FIT);
+    void *chunks[MAX_CHUNKS];
+
+    printf("ALLOCATING 2 CHUNKS AND FREEING BOTH INTO THE THREAD CACHE...\n");
+    chunks[0] = my_malloc(CHUNK_SIZE);
+    chunks[1] = my_malloc(CHUNK_SIZE);
+    my_free(chunks[0]);
+    my_free(chunks[1]);
+    printf("VERIFYING THE LINK BETWEEN THEM IS NOT A PLAIN POINTER...\n");
+    assert(chunk_is_cached((header *)chunks[1] - 1));
+    assert(*(header **)chunks[1] != (header *)chunks[0] - 1);
+    void *last_freed = my_malloc(CHUNK_SIZE);
+    void *first_freed = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THEY COME BACK OUT IN ORDER...\n");
+    assert(last_freed == chunks[1] && first_freed == chunks[0]);
+    passed();
+
+    printf("ALLOCATING 4 CHUNKS TOO BIG FOR THE THREAD CACHE AND FREEING THE 1ST AND 3RD...\n");
+    for (size_t i = 2; i < 6; i++)
+    {
+        chunks[i] = my_malloc(4 * CHUNK_SIZE);
+    }
+    my_free(chunks[2]);
+    my_free(chunks[4]);
+    printf("VERIFYING THEY SHARE A BIN LINKED WITHOUT A PLAIN POINTER...\n");
+    audit();
+    node *first = (node *)((header *)chunks[4] - 1);
+    node *second = (node *)((header *)chunks[2] - 1);
+    assert(main_arena->bins[bin_index(chunk_size(first))] == first);
+    assert(free_chunk_next(first) == second);
+    assert(first->next != second);
+    passed();
+
+    printf("FREEING THE 2ND CHUNK TWICE...\n");
+    bool aborted = aborts(free_twice, chunks[3]);
+    printf("VERIFYING THE SECOND FREE ABORTS...\n");
+    assert(aborted);
+    printf("FREEING THE 1ST CHUNK AGAIN AFTER IT WENT TO THE HEAP...\n");
+    aborted = aborts(free_once, chunks[2]);
+    printf("VERIFYING IT ABORTS...\n");
+    assert(aborted);
+    printf("FREEING A CACHED SIZE CHUNK TWICE...\n");
+    aborted = aborts(free_twice, chunks[0]);
+    printf("VERIFYING IT ABORTS...\n");
+    assert(aborted);
+    printf("FREEING A SLAB OBJECT TWICE AND FREEING A POINTER INTO THE MIDDLE OF ONE...\n");
+    void *object = my_malloc(32);
+    bool aborted_twice = aborts(free_twice, object);
+    bool aborted_inside = aborts(free_once, object + 8);
+    printf("VERIFYING BOTH ABORT...\n");
+    assert(is_slab_object(object));
+    assert(aborted_twice && aborted_inside);
+    aborted = aborts(free_once, object);
+    printf("VERIFYING FREEING IT ONCE DOES NOT...\n");
+    assert(!aborted);
+    my_free(object);
+    passed();
+
+    printf("FREEING 2 CACHED SIZE CHUNKS, FLIPPING A BIT OF THE LINK IN THE LAST ONE AND ALLOCATING BOTH...\n");
+    my_free(chunks[0]);
+    my_free(chunks[1]);
+    aborted = aborts(corrupt_link_and_malloc, chunks[1]);
+    printf("VERIFYING IT ABORTS...\n");
+    assert(aborted);
+    passed();
+
+    harden_heap = false;
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL HARDENING TESTS PASSED");
+}
+
+/* Allocates 100 objects of 64 bytes and frees half of them. */
+void *stats_thread(__attribute__((unused)) void *unused)
+{
+    void *objects[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        objects[i] = my_malloc(64);
+    }
+    for (size_t i = 0; i < 50; i++)
+    {
+        my_free(objects[i]);
+    }
+    return NULL;
+}
+
+void test_stats()
+{
+    emphasis("TESTING HEAP STATISTICS ARE KEPT AS THE HEAP CHANGES");
+
+    use_slabs = true;
+    grow_heap = true;
+    thread_cache = false;
+    init_heap_with_policy(SEGREGATED_FIT);
+    void *chunks[MAX_CHUNKS];
+    heap_stats stats;
+
+    printf("VERIFYING A NEW HEAP HAS NOTHING IN USE AND ONE FREE CHUNK...\n");
+    my_malloc_stats(&stats);
+    assert(stats.in_use_bytes == 0 && stats.in_use_count == 0);
+    assert(stats.free_chunks == 1);
+    assert(stats.free_bytes == HEAP_SIZE && stats.largest_free_chunk == HEAP_SIZE);
+    assert(stats.footprint == heap_footprint());
+    passed();
+
+    printf("ALLOCATING 5 CHUNKS AND 1 16 BYTE SLAB OBJECT...\n");
+    for (size_t i = 0; i < 5; i++)
+    {
+        chunks[i] = my_malloc(CHUNK_SIZE);
+    }
+    void *object = my_malloc(16);
+    printf("VERIFYING THEY ARE COUNTED IN USE AND IN THEIR BINS, AND THE CHUNKS TOOK SEARCHES...\n");
+    my_malloc_stats(&stats);
+    assert(stats.in_use_count == 6);
+    assert(stats.in_use_bytes == 5 * my_malloc_usable_size(chunks[0]) + 16);
+    assert(stats.allocations[bin_index(align(CHUNK_SIZE))] == 5);
+    assert(stats.allocations[bin_index(align(16))] == 1);
+    assert(stats.searches == 5);
+    assert(stats.free_chunks == 1);
+    assert(stats.free_bytes == HEAP_SIZE - 5 * align(CHUNK_SIZE));
+    passed();
+
+    printf("FREEING THE 2ND AND 4TH CHUNKS...\n");
+    my_free(chunks[1]);
+    my_free(chunks[3]);
+    printf("VERIFYING THERE ARE 3 FREE CHUNKS AND THE LARGEST IS THE REST OF THE HEAP...\n");
+    audit();
+    my_malloc_stats(&stats);
+    assert(stats.in_use_count == 4);
+    assert(stats.in_use_bytes == 3 * my_malloc_usable_size(chunks[0]) + 16);
+    assert(stats.free_chunks == 3);
+    assert(stats.free_bytes == HEAP_SIZE - 3 * align(CHUNK_SIZE));
+    assert(stats.largest_free_chunk == HEAP_SIZE - 5 * align(CHUNK_SIZE));
+    passed();
+
+    printf("REALLOCATING THE 5TH CHUNK IN PLACE TO 2 CHUNKS AND ASKING FOR 0 AND TOO MANY BYTES...\n");
+    size_t old_size = my_malloc_usable_size(chunks[4]);
+    void *grown = my_realloc(chunks[4], 2 * CHUNK_SIZE);
+    void *empty = my_malloc(0);
+    void *too_many = my_malloc(-1);
+    printf("VERIFYING THE BYTES IN USE GREW BY THE REALLOC AND 2 ALLOCATIONS FAILED...\n");
+    assert(grown == chunks[4] && empty == NULL && too_many == NULL);
+    my_malloc_stats(&stats);
+    assert(stats.in_use_count == 4);
+    assert(stats.in_use_bytes == 2 * my_malloc_usable_size(chunks[0]) + my_malloc_usable_size(chunks[4]) + 16);
+    assert(my_malloc_usable_size(chunks[4]) > old_size);
+    assert(stats.failed_allocations == 2);
+    passed();
+
+    printf("ALLOCATING 100 64 BYTE OBJECTS FROM ANOTHER THREAD THAT FREES HALF OF THEM AND EXITS...\n");
+    pthread_t thread;
+    pthread_create(&thread, NULL, stats_thread, NULL);
+    pthread_join(thread, NULL);
+    printf("VERIFYING ITS COUNTS WERE KEPT AFTER IT EXITED...\n");
+    my_malloc_stats(&stats);
+    assert(stats.in_use_count == 54);
+    assert(stats.allocations[bin_index(align(64))] == 100);
+    passed();
+
+    printf("FREEING EVERYTHING ON THE HEAP...\n");
+    my_free(object);
+    free_all_chunks();
+    printf("VERIFYING NOTHING ON THE HEAP IS IN USE...\n");
+    my_malloc_stats(&stats);
+    assert(stats.in_use_count == 50);
+    assert(stats.in_use_bytes == 50 * 64);
+    assert(stats.free_chunks == 1);
+    passed();
+
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL STATS TESTS PASSED");
+}
+
+/* Counts the times a string appears in a larger one. */
+size_t count_occurrences(const char *haystack, const char *needle)
+{
+    size_t count = 0;
+    for (const char *found = strstr(haystack, needle); found; found = strstr(found + 1, needle))
+    {
+        count++;
+    }
+    return count;
+}
+
+void test_fragmentation()
+{
+    emphasis("TESTING FRAGMENTATION IS MEASURED AND THE HEAP MAP MATCHES THE HEAP");
+
+    use_heap(WORST_FIT, false, false);
+    void *chunks[MAX_CHUNKS];
+    fragmentation frag;
+
+    printf("VERIFYING A NEW HEAP IS ONE FREE CHUNK WITH NO FRAGMENTATION...\n");
+    heap_fragmentation(&frag);
+    assert(frag.free_chunks == 1 && frag.free_bytes == HEAP_SIZE && frag.largest_free_chunk == HEAP_SIZE);
+    assert(frag.external == 0 && frag.largest_to_free == 1);
+    assert(frag.free_chunks_by_bin[bin_index(HEAP_SIZE)] == 1);
+    passed();
+
+    printf("ALLOCATING 5 CHUNKS AND FREEING THE 2ND AND 4TH...\n");
+    for (size_t i = 0; i < 5; i++)
+    {
+        chunks[i] = my_malloc(CHUNK_SIZE);
+    }
+    my_free(chunks[1]);
+    my_free(chunks[3]);
+    audit();
+    printf("VERIFYING THE 2 HOLES ARE COUNTED IN THEIR BIN AND THE FRAGMENTATION IS THEIR SHARE OF THE FREE SPACE...\n");
+    heap_fragmentation(&frag);
+    size_t rest = HEAP_SIZE - 5 * align(CHUNK_SIZE);
+    assert(frag.free_chunks == 3 && frag.free_bytes == rest + 2 * align(CHUNK_SIZE) && frag.largest_free_chunk == rest);
+    assert(frag.free_chunks_by_bin[bin_index(align(CHUNK_SIZE))] == 2 && frag.free_chunks_by_bin[bin_index(rest)] == 1);
+    assert(frag.largest_to_free == (double)rest / frag.free_bytes);
+    assert(frag.external == 1 - frag.largest_to_free);
+    passed();
+
+    printf("EXPORTING THE HEAP MAP...\n");
+    FILE *file = tmpfile();
+    export_heap_map(fileno(file));
+    char map[4096] = {0};
+    size_t length = pread(fileno(file), map, sizeof(map) - 1, 0);
+    fclose(file);
+    printf("%s", map);
+    printf("VERIFYING IT IS ONE LINE WITH EVERY CHUNK IN ADDRESS ORDER AND THE SAME FRAGMENTATION...\n");
+    assert(length > 0 && length < sizeof(map) - 1);
+    assert(map[0] == '{' && map[length - 1] == '\n' && strchr(map, '\n') == map + length - 1);
+    assert(count_occurrences(map, "\"a\"]") == 3 && count_occurrences(map, "\"f\"]") == 3);
+    char expected[256];
+    sprintf(expected, "{\"address\": %lu, \"size\": %lu, \"chunks\": [[0, %lu, \"a\"], [%lu, %lu, \"f\"]", (uint64_t)region_start(main_arena->regions), HEAP_SIZE, align(CHUNK_SIZE), align(CHUNK_SIZE), align(CHUNK_SIZE));
+    assert(strstr(map, expected));
+    sprintf(expected, "[%lu, %lu, \"f\"]]}]}]", 5 * align(CHUNK_SIZE), rest);
+    assert(strstr(map, expected));
+    sprintf(expected, "\"free_chunks\": 3, \"largest_free_chunk\": %lu", rest);
+    assert(strstr(map, expected));
+    passed();
+
+    free_all_chunks();
+
+    success("ALL FRAGMENTATION TESTS PASSED");
+}
+
+/* Walks the main arena for the free chunk best or worst fit should pick for a chunk of needed_size bytes: the smallest or
+biggest that fits, and the lowest addressed on a tie. Returns NULL if none fits. */
+void *expected_fit(placement_policy policy, size_t needed_size)
+{
+    void *expected = NULL;
+    for (region *r = main_arena->regions; r; r = r->next)
+    {
+        for (void *address = region_start(r); address < (void *)r; address += chunk_size(address))
+        {
+            if (!chunk_is_free(address) || chunk_size(address) < needed_size)
+            {
+                continue;
+            }
+            // Regions are in address order, so only a strictly better chunk replaces the one found first
+            if (!expected || (policy == BEST_FIT ? chunk_size(address) < chunk_size(expected) : chunk_size(address) > chunk_size(expected)))
+            {
+                expected = address;
+            }
+        }
+    }
+    return expected;
+}
+
+void test_size_tree()
+{
+    emphasis("TESTING BEST AND WORST FIT FIND THE SAME CHUNKS THROUGH THE SIZE TREE AS A FULL SEARCH");
+
+    placement_policy policies[] = {BEST_FIT, WORST_FIT};
+    for (size_t p = 0; p < 2; p++)
+    {
+        placement_policy policy = policies[p];
+        printf("USING %s FIT...\n", policy_names[policy]);
+        use_heap(policy, true, false);
+
+        printf("CALLOCING 2 HEAP SIZES THAT NEED A NEW REGION...\n");
+        void *zeroed = my_calloc(2, HEAP_SIZE);
+        printf("VERIFYING THE SIZE TREE LINKS THE REGION HAD WERE CLEARED WITH THE REST...\n");
+        audit();
+        assert(zeroed != NULL && num_regions() == 2);
+        assert(all_zero(zeroed, 2 * HEAP_SIZE));
+        my_free(zeroed);
+        passed();
+
+        printf("ALLOCATING 64 CHUNKS OF MIXED SIZES WITH A SMALL CHUNK AFTER EACH...\n");
+        void *holes[64];
+        for (size_t i = 0; i < 64; i++)
+        {
+            // Sizes repeat so there are ties, and the small ones are rounded up to the smallest tree chunk
+            holes[i] = my_malloc((i * 37 % 24 + 1) * 8);
+            void *separator = my_malloc(1);
+            assert(holes[i] != NULL && separator != NULL);
+        }
+        printf("FREEING THEM OUT OF ORDER...\n");
+        for (size_t i = 0; i < 64; i++)
+        {
+            my_free(holes[i * 23 % 64]);
+        }
+        audit();
+        assert(main_arena->size_tree != NULL);
+        passed();
+
+        printf("ALLOCATING 48 CHUNKS OF MIXED SIZES...\n");
+        printf("VERIFYING EACH WENT WHERE A FULL SEARCH OF THE HEAP SAYS %s FIT SHOULD PUT IT...\n", policy_names[policy]);
+        for (size_t i = 0; i < 48; i++)
+        {
+            size_t size = (i * 29 % 30 + 1) * 7;
+            void *expected = expected_fit(policy, align(size));
+            void *ptr = my_malloc(size);
+            assert(ptr != NULL);
+            assert(!expected || (header *)ptr - 1 == expected);
+        }
+        audit();
+        passed();
+
+        printf("FREEING ALL CHUNKS...\n");
+        free_all_chunks();
+        printf("VERIFYING EACH REGION IS ONE FREE CHUNK AGAIN...\n");
+        audit();
+        assert(main_arena->free_chunks == (size_t)num_regions() && main_arena->largest != NULL);
+        passed();
+    }
+
+    success("ALL SIZE TREE TESTS PASSED");
+}
+
+void test_deferred_coalescing()
+{
+    emphasis("TESTING DEFERRED COALESCING REUSES FREED CHUNKS AS THEY ARE AND COALESCES THEM IN A BATCH");
+
+    defer_coalescing = true;
+    grow_heap = false;
+    thread_cache = false;
+    use_slabs = false;
+    init_heap_with_policy(WORST_FIT);
+    void *chunks[MAX_CHUNKS];
+    size_t quick_index = align(CHUNK_SIZE) / ALIGN_TO;
+
+    printf("ALLOCATING 5 CHUNKS AND 1 CHUNK FOR THE REST OF THE HEAP...\n");
+    for (size_t i = 0; i < 5; i++)
+    {
+        chunks[i] = my_malloc(CHUNK_SIZE);
+    }
+    chunks[5] = my_malloc(HEAP_SIZE - 5 * align(CHUNK_SIZE) - sizeof(header));
+    assert(chunks[5] != NULL && main_arena->free_chunks == 0);
+    printf("FREEING THE 2ND AND 3RD CHUNKS...\n");
+    my_free(chunks[1]);
+    my_free(chunks[2]);
+    printf("VERIFYING THEY WERE NOT COALESCED BUT PUT ON THE QUICK LIST FOR THEIR SIZE...\n");
+    audit();
+    assert(chunk_is_cached((header *)chunks[1] - 1) && chunk_is_cached((header *)chunks[2] - 1));
+    assert(main_arena->free_chunks == 0);
+    assert(main_arena->quick_lists[quick_index] == (header *)chunks[2] - 1);
+    assert(main_arena->quick_bytes == 2 * align(CHUNK_SIZE));
+    passed();
+
+    printf("ALLOCATING 2 CHUNKS OF THE SAME SIZE...\n");
+    void *last_freed = my_malloc(CHUNK_SIZE);
+    void *first_freed = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING THEY ARE THE FREED CHUNKS, THE LAST FREED FIRST...\n");
+    assert(last_freed == chunks[2] && first_freed == chunks[1]);
+    audit();
+    assert(main_arena->quick_bytes == 0 && !chunk_is_cached((header *)chunks[1] - 1));
+    passed();
+
+    printf("FREEING THE 2ND AND 3RD CHUNKS AGAIN AND ALLOCATING 1 CHUNK OF BOTH THEIR SIZES...\n");
+    my_free(chunks[1]);
+    my_free(chunks[2]);
+    chunks[1] = my_malloc(2 * align(CHUNK_SIZE) - sizeof(header));
+    printf("VERIFYING NOTHING ELSE FIT, SO THE QUICK LIST WAS COALESCED AND THE CHUNK TOOK THEIR PLACE...\n");
+    audit();
+    assert(chunks[1] != NULL && chunks[2] == chunks[1] + align(CHUNK_SIZE));
+    assert(main_arena->quick_bytes == 0 && main_arena->free_chunks == 0);
+    passed();
+
+    printf("SETTING THE QUICK LIST BUDGET TO 2 CHUNKS AND FREEING THE 1ST, 4TH AND 5TH CHUNKS...\n");
+    quick_list_budget = 2 * align(CHUNK_SIZE);
+    my_free(chunks[0]);
+    my_free(chunks[3]);
+    assert(main_arena->quick_bytes == 2 * align(CHUNK_SIZE));
+    my_free(chunks[4]);
+    printf("VERIFYING THE 3RD WENT PAST THE BUDGET, SO ALL 3 WERE COALESCED INTO 2 FREE CHUNKS...\n");
+    audit();
+    assert(main_arena->quick_bytes == 0 && main_arena->free_chunks == 2);
+    assert(chunk_is_free((header *)chunks[3] - 1) && chunk_size((header *)chunks[3] - 1) == 2 * align(CHUNK_SIZE));
+    passed();
+
+    quick_list_budget = 64 * 1024;
+    printf("FREEING ALL CHUNKS...\n");
+    free_all_chunks();
+    printf("VERIFYING THE HEAP IS ONE FREE CHUNK AGAIN...\n");
+    audit();
+    assert(main_arena->free_chunks == 1 && main_arena->quick_bytes == 0);
+    passed();
+
+    defer_coalescing = false;
+    use_heap(WORST_FIT, false, false);
+
+    success("ALL DEFERRED COALESCING TESTS PASSED");
+}
+
+/* Returns how many allocations are live. */
+size_t live_allocations()
+{
+    heap_stats stats;
+    my_malloc_stats(&stats);
+    return stats.in_use_count;
+}
+
+/* Frees a pointer twice in one batch. */
+void free_batch_twice(void *ptr)
+{
+    void *ptrs[] = {ptr, ptr};
+    my_free_batch(ptrs, 2);
+}
+
+void test_batch()
+{
+    emphasis("TESTING BATCHES OF CHUNKS ARE CARVED SIDE BY SIDE AND FREED IN ONE PASS");
+
+    use_heap(WORST_FIT, false, false);
+    void *batch[20];
+    size_t chunk = align(CHUNK_SIZE);
+
+    printf("ALLOCATING A BATCH OF 5 CHUNKS...\n");
+    size_t allocated = my_malloc_batch(CHUNK_SIZE, 5, batch);
+    printf("VERIFYING THEY WERE CARVED SIDE BY SIDE FROM THE START OF THE HEAP...\n");
+    audit();
+    assert(allocated == 5);
+    for (size_t i = 0; i < 5; i++)
+    {
+        assert(batch[i] == main_arena->heap_pointer + sizeof(header) + i * chunk);
+        assert(my_malloc_usable_size(batch[i]) == chunk - sizeof(header));
+    }
+    assert(main_arena->free_chunks == 1);
+    passed();
+
+    printf("ALLOCATING A BATCH OF 20 CHUNKS, MORE THAN THE REST OF THE HEAP HOLDS...\n");
+    size_t rest = HEAP_SIZE - 5 * chunk;
+    size_t fits = rest / chunk;
+    allocated = my_malloc_batch(CHUNK_SIZE, 20, batch + 5);
+    printf("VERIFYING ONLY THE %lu THAT FIT WERE ALLOCATED, LEAVING THE END FREE...\n", fits);
+    audit();
+    assert(allocated == fits);
+    assert(batch[5] == batch[4] + chunk && batch[4 + fits] == batch[5] + (fits - 1) * chunk);
+    // Space left too small to be a free chunk goes to the last chunk
+    size_t left = rest - fits * chunk < align(1) ? 0 : rest - fits * chunk;
+    assert(main_arena->free_chunks == (left > 0) && main_arena->free_bytes == left);
+    passed();
+
+    printf("FREEING EVERY OTHER CHUNK IN A BATCH, IN REVERSE ORDER WITH A NULL IN IT...\n");
+    void *evens[10];
+    size_t num_evens = 0;
+    for (size_t i = 5 + fits; i-- > 0;)
+    {
+        if (i % 2 == 0)
+        {
+            evens[num_evens++] = batch[i];
+        }
+    }
+    evens[num_evens++] = NULL;
+    my_free_batch(evens, num_evens);
+    printf("VERIFYING EACH IS A FREE CHUNK OF ITS OWN IN THE SORTED FREE LIST...\n");
+    audit();
+    // The space left at the end is another free chunk, unless the last chunk is freed and merged with it
+    assert(main_arena->free_chunks == num_evens - 1 + (left > 0 && (4 + fits) % 2));
+    for (size_t i = 0; i < 5 + fits; i += 2)
+    {
+        assert(chunk_is_free((header *)batch[i] - 1));
+    }
+    passed();
+
+    printf("FREEING THE REST IN A BATCH WITH A MAPPED CHUNK...\n");
+    void *odds[10];
+    size_t num_odds = 0;
+    for (size_t i = 1; i < 5 + fits; i += 2)
+    {
+        odds[num_odds++] = batch[i];
+    }
+    size_t footprint = heap_footprint();
+    odds[num_odds++] = my_malloc(mmap_threshold);
+    assert(heap_footprint() > footprint);
+    my_free_batch(odds, num_odds);
+    printf("VERIFYING THE HEAP IS ONE FREE CHUNK AGAIN AND THE MAPPING IS GONE...\n");
+    audit();
+    assert(main_arena->free_chunks == 1 && main_arena->free_bytes == HEAP_SIZE);
+    assert(heap_footprint() == footprint);
+    passed();
+
+    printf("FREEING A MAPPED CHUNK THAT IS TWICE IN THE SAME BATCH...\n");
+    void *twice[] = {my_malloc(mmap_threshold), NULL};
+    twice[1] = twice[0];
+    my_free_batch(twice, 2);
+    printf("VERIFYING IT WAS FREED ONCE...\n");
+    audit();
+    assert(heap_footprint() == footprint && live_allocations() == 0);
+    passed();
+
+    printf("FREEING A MAPPED CHUNK THAT IS TWICE IN THE SAME BATCH ON A HARDENED HEAP...\n");
+    harden_heap = true;
+    init_heap_with_policy(WORST_FIT);
+    void *mapped = my_malloc(mmap_threshold);
+    printf("VERIFYING IT ABORTS INSTEAD OF READING THE UNMAPPED HEADER...\n");
+    bool aborted = aborts(free_batch_twice, mapped);
+    assert(aborted);
+    my_free(mapped);
+    harden_heap = false;
+    init_heap_with_policy(WORST_FIT);
+    passed();
+
+    success("ALL BATCH TESTS PASSED");
+}
+
+void test_scoped_regions()
+{
+    emphasis("TESTING SCOPED REGIONS BUMP THROUGH BLOCKS FROM THE HEAP AND RESET IN ONE STEP");
+
+    use_heap(WORST_FIT, true, false);
+    size_t live = live_allocations();
+
+    printf("CREATING A REGION WITH 256 BYTE BLOCKS...\n");
+    scoped_region *r = region_create(256);
+    printf("VERIFYING IT IS ONE CHUNK ON THE HEAP...\n");
+    audit();
+    assert(r != NULL && region_blocks(r) == 1);
+    assert(live_allocations() == live + 1);
+    passed();
+
+    printf("ALLOCATING 10 OBJECTS OF 20 BYTES FROM IT...\n");
+    void *objects[10];
+    for (size_t i = 0; i < 10; i++)
+    {
+        objects[i] = region_alloc(r, 20);
+    }
+    void *nothing = region_alloc(r, 0);
+    printf("VERIFYING THEY ARE SIDE BY SIDE, ALIGNED AND NOT ALLOCATED FROM THE HEAP ONE BY ONE...\n");
+    for (size_t i = 0; i < 10; i++)
+    {
+        assert((uint64_t)objects[i] % ALIGN_TO == 0);
+        assert(i == 0 || objects[i] == objects[i - 1] + 24);
+    }
+    assert(region_blocks(r) == 1 && live_allocations() == live + 1);
+    assert(nothing == NULL);
+    passed();
+
+    printf("ALLOCATING 300 BYTES, MORE THAN THE FIRST BLOCK HAS LEFT...\n");
+    void *big = region_alloc(r, 300);
+    printf("VERIFYING A SECOND BLOCK WAS ALLOCATED FROM THE HEAP FOR IT...\n");
+    audit();
+    assert(big != NULL && region_blocks(r) == 2);
+    assert(live_allocations() == live + 2);
+    passed();
+
+    printf("RESETTING THE REGION AND ALLOCATING THE SAME OBJECTS AGAIN...\n");
+    region_reset(r);
+    void *again[10];
+    for (size_t i = 0; i < 10; i++)
+    {
+        again[i] = region_alloc(r, 20);
+    }
+    void *big_again = region_alloc(r, 300);
+    printf("VERIFYING THEY WENT WHERE THEY DID BEFORE, IN THE SAME BLOCKS...\n");
+    assert(!memcmp(again, objects, sizeof(objects)) && big_again == big);
+    assert(region_blocks(r) == 2 && live_allocations() == live + 2);
+    passed();
+
+    printf("DESTROYING THE REGION...\n");
+    region_destroy(r);
+    printf("VERIFYING ITS BLOCKS WERE FREED...\n");
+    audit();
+    assert(live_allocations() == live);
+    passed();
+
+    printf("CREATING A REGION WITH 20 BYTE BLOCKS AND FILLING THE FIRST WITH 24 BYTES...\n");
+    r = region_create(20);
+    void *filled = region_alloc(r, 24);
+    void *spilled = region_alloc(r, 8);
+    printf("VERIFYING THE BLOCK WAS ROUNDED UP TO 24 BYTES AND NO FURTHER...\n");
+    audit();
+    assert(filled != NULL && spilled != NULL && region_blocks(r) == 2);
+    region_destroy(r);
+    assert(live_allocations() == live);
+    passed();
+
+    success("ALL SCOPED REGION TESTS PASSED");
+}
+
+void test_options()
+{
+    emphasis("TESTING HEAP OPTIONS ARE READ FROM A STRING AND USED WHEN THE HEAP STARTS OVER");
+
+    heap_options saved;
+    get_heap_options(&saved);
+
+    printf("READING POLICY:BEST,HEAP_SIZE:8K,GROW:FALSE,SLABS:0,HARDEN:TRUE,ARENA_POLICY:CPU...\n");
+    heap_options options = saved;
+    bool ok = parse_heap_options(&options, "policy:best,heap_size:8k,grow:false,slabs:0,harden:true,arena_policy:cpu");
+    printf("VERIFYING EACH OPTION WAS SET AND THE REST WERE LEFT ALONE...\n");
+    assert(ok);
+    assert(options.policy == BEST_FIT && options.heap_size == 8192 && !options.grow && !options.slabs && options.harden);
+    assert(options.arena_policy == BY_CPU);
+    assert(options.trim_threshold == saved.trim_threshold && options.arenas == saved.arenas);
+    passed();
+
+    printf("READING UNKNOWN NAMES, BAD VALUES AND A GOOD ENTRY AFTER THEM...\n");
+    heap_options bad = options;
+    ok = parse_heap_options(&bad, "colour:blue,trim:maybe,heap_size:12x,heap_size,policy:best_fit,trim_keep:2m");
+    bool empty_ok = parse_heap_options(&bad, "");
+    bool null_ok = parse_heap_options(&bad, NULL);
+    printf("VERIFYING EACH IS REJECTED WITHOUT STOPPING THE GOOD ONE...\n");
+    assert(!ok);
+    assert(bad.trim == options.trim && bad.heap_size == options.heap_size && bad.policy == options.policy);
+    assert(bad.trim_keep == 2 * 1024 * 1024);
+    assert(empty_ok && null_ok);
+    passed();
+
+    printf("STARTING AN 8 KIB HEAP THAT CAN'T GROW WITH THE OPTIONS...\n");
+    options.harden = false;
+    init_heap_with_options(&options);
+    printf("VERIFYING IT HAS ONE 8 KIB REGION AND USES BEST FIT...\n");
+    audit();
+    assert(fit_policy == BEST_FIT && heap_size == 8192 && !grow_heap);
+    assert(num_regions() == 1 && main_arena->regions->size == 8192);
+    passed();
+
+    printf("ALLOCATING 6000 BYTES, THEN 9000 BYTES...\n");
+    void *fits = my_malloc(6000);
+    void *too_big = my_malloc(9000);
+    printf("VERIFYING THE FIRST FITS AND THE SECOND DOES NOT...\n");
+    assert(fits != NULL && too_big == NULL);
+    my_free(fits);
+    audit();
+    passed();
+
+    printf("ROUNDING A HEAP SIZE OF 1 UP...\n");
+    options.heap_size = 1;
+    init_heap_with_options(&options);
+    printf("VERIFYING THE HEAP STILL HAS ROOM FOR ONE CHUNK...\n");
+    // Best fit chunks have room for the size tree links
+    assert(heap_size == TREE_MIN_CHUNK);
+    audit();
+    passed();
+
+    init_heap_with_options(&saved);
+    success("ALL HEAP OPTIONS TESTS PASSED");
+}
+
+void test_huge_pages()
+{
+    emphasis("TESTING REGIONS ARE WHOLE HUGE PAGES WHEN HUGE PAGES ARE TURNED ON");
+
+    heap_options saved;
+    get_heap_options(&saved);
+    heap_options options = saved;
+    parse_heap_options(&options, "policy:worst,grow:true,thread_cache:false,slabs:false,huge_pages:true");
+    options.mmap_threshold = SIZE_MASK;
+
+    printf("STARTING A HEAP WITH HUGE PAGES...\n");
+    init_heap_with_options(&options);
+    printf("VERIFYING ITS FIRST REGION IS ONE HUGE PAGE ALIGNED TO ONE...\n");
+    audit();
+    assert(num_regions() == 1);
+    assert((uint64_t)main_arena->heap_pointer % HUGE_PAGE_SIZE == 0);
+    assert(main_arena->regions->size + sizeof(region) == HUGE_PAGE_SIZE);
+    passed();
+
+    printf("ALLOCATING 100 SMALL CHUNKS...\n");
+    void *small[100];
+    for (size_t i = 0; i < 100; i++)
+    {
+        small[i] = my_malloc(CHUNK_SIZE);
+    }
+    printf("VERIFYING THEY ARE PACKED INTO THE FIRST HUGE PAGE...\n");
+    for (size_t i = 0; i < 100; i++)
+    {
+        assert(small[i] > main_arena->heap_pointer && small[i] < main_arena->heap_pointer + HUGE_PAGE_SIZE);
+    }
+    assert(num_regions() == 1);
+    passed();
+
+    printf("ALLOCATING 3 MIB, MORE THAN THE FIRST REGION HOLDS...\n");
+    void *big = my_malloc(3 * 1024 * 1024);
+    printf("VERIFYING IT CAME FROM A NEW REGION OF WHOLE HUGE PAGES ALIGNED TO ONE...\n");
+    audit();
+    assert(big != NULL && num_regions() == 2);
+    region *r = find_region(big);
+    assert((uint64_t)region_start(r) % HUGE_PAGE_SIZE == 0);
+    assert((r->size + sizeof(region)) % HUGE_PAGE_SIZE == 0 && r->size >= 3 * 1024 * 1024);
+    passed();
+
+    printf("FREEING EVERYTHING...\n");
+    my_free(big);
+    for (size_t i = 0; i < 100; i++)
+    {
+        my_free(small[i]);
+    }
+    printf("VERIFYING THE HEAP IS EMPTY...\n");
+    audit();
+    assert(live_allocations() == 0);
+    passed();
+
+    init_heap_with_options(&saved);
+    success("ALL HUGE PAGE TESTS PASSED");
+}
+
+void test_numa()
+{
+    emphasis("TESTING ARENAS ARE BOUND TO NUMA NODES AND THREADS USE THEIR OWN NODE'S");
+
+    heap_options saved;
+    get_heap_options(&saved);
+    heap_options options = saved;
+    parse_heap_options(&options, "policy:worst,grow:true,thread_cache:false,slabs:false,arenas:1,arena_policy:node");
+
+    printf("STARTING A HEAP WITH ONE ARENA AND BY NODE ASSIGNMENT...\n");
+    init_heap_with_options(&options);
+    printf("VERIFYING EVERY NODE GOT AN ARENA BOUND TO IT...\n");
+    audit();
+    assert(numa_nodes >= 1 && active_arenas >= numa_nodes);
+    for (size_t i = 0; i < active_arenas; i++)
+    {
+        assert(arenas[i].node == (int)(i % numa_nodes));
+    }
+    assert(numa_node() >= 0 && numa_node() < (int)numa_nodes);
+    passed();
+
+    printf("ALLOCATING A CHUNK AND FREEING IT ON THE SAME THREAD...\n");
+    void *local = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING IT CAME FROM AN ARENA OF THIS THREAD'S NODE AND ITS FREE WAS NOT REMOTE...\n");
+    assert(local != NULL && chunk_arena((header *)local - 1)->node == numa_node());
+    my_free(local);
+    heap_stats stats;
+    my_malloc_stats(&stats);
+    assert(stats.remote_frees == 0);
+    audit();
+    passed();
+
+    printf("ALLOCATING A CHUNK AND MAKING ITS ARENA LOOK LIKE IT IS ON ANOTHER NODE...\n");
+    void *remote = my_malloc(CHUNK_SIZE);
+    arena *a = chunk_arena((header *)remote - 1);
+    a->node = numa_node() + 1;
+    my_free(remote);
+    printf("FREEING A BATCH OF 2 MORE CHUNKS FROM IT...\n");
+    void *batch[2];
+    size_t allocated = my_malloc_batch(CHUNK_SIZE, 2, batch);
+    my_free_batch(batch, allocated);
+    a->node = a->index % numa_nodes;
+    printf("VERIFYING EVERY FREE WAS COUNTED AS REMOTE...\n");
+    my_malloc_stats(&stats);
+    assert(allocated == 2 && stats.remote_frees == 3);
+    audit();
+    passed();
+
+    printf("STARTING OVER WITH THE OPTIONS FROM BEFORE...\n");
+    init_heap_with_options(&saved);
+    printf("VERIFYING NO ARENA IS BOUND UNLESS THEY ASKED FOR IT...\n");
+    audit();
+    assert(saved.arena_policy == BY_NODE || arenas[0].node == -1);
+    passed();
+
+    success("ALL NUMA TESTS PASSED");
+}
+
+/* Allocates from a call site of its own, so the profiler sees a different stack. */
+__attribute__((noinline)) void *profiled_malloc(size_t size)
+{
+    return my_malloc(size);
+}
+
+/* Returns true if the allocation at ptr has a header with the sampled flag set. */
+bool is_sampled(void *ptr)
+{
+    return !is_slab_object(ptr) && ((header *)ptr - 1)->size_flags & CHUNK_SAMPLED;
+}
+
+/* Dumps the heap profile in a format and returns the number of lines it has before the memory map. */
+size_t dump_profile_lines(profile_format format, char *dump, size_t dump_size)
+{
+    FILE *file = tmpfile();
+    dump_heap_profile(fileno(file), format);
+    size_t length = pread(fileno(file), dump, dump_size - 1, 0);
+    fclose(file);
+    dump[length] = '\0';
+    // Print it up to the memory map, which is long
+    char *maps = strstr(dump, "\nMAPPED_LIBRARIES");
+    printf("%.*s", (int)(maps ? (size_t)(maps - dump) + 1 : length), dump);
+
+    size_t lines = 0;
+    for (char *line = dump; *line && *line != '\n'; line = strchr(line, '\n') + 1)
+    {
+        lines++;
+    }
+    return lines;
+}
+
+void test_profile()
+{
+    emphasis("TESTING THE HEAP PROFILER SAMPLES ALLOCATIONS UNTIL THEY ARE FREED");
+
+    use_slabs = true;
+    grow_heap = true;
+    thread_cache = true;
+    init_heap_with_policy(SEGREGATED_FIT);
+    void *chunks[MAX_CHUNKS];
+    char dump[64 * 1024];
+
+    printf("STARTING THE PROFILER WITH AN INTERVAL OF 1 BYTE AND ALLOCATING A 64 BYTE OBJECT...\n");
+    start_heap_profile(1);
+    void *object = my_malloc(64);
+    printf("VERIFYING IT WAS SAMPLED AND CAME FROM THE HEAP INSTEAD OF A SLAB...\n");
+    assert(live_samples() == 1);
+    assert(!is_slab_object(object) && is_sampled(object));
+    passed();
+
+    printf("ALLOCATING 3 CHUNKS FROM ONE CALL SITE AND 1 FROM ANOTHER...\n");
+    for (size_t i = 0; i < 3; i++)
+    {
+        chunks[i] = my_malloc(CHUNK_SIZE);
+    }
+    chunks[3] = profiled_malloc(CHUNK_SIZE);
+    printf("VERIFYING THE PPROF PROFILE ADDS UP 5 SAMPLES IN 3 STACKS...\n");
+    assert(live_samples() == 5);
+    assert(dump_profile_lines(PPROF_PROFILE, dump, sizeof(dump)) == 4);
+    char expected[128];
+    sprintf(expected, "heap profile: 5: %lu [5: %lu] @ heap_v2/1\n", 64 + 4 * CHUNK_SIZE, 64 + 4 * CHUNK_SIZE);
+    assert(!strncmp(dump, expected, strlen(expected)));
+    sprintf(expected, "\n3: %lu [3: %lu] @ 0x", 3 * CHUNK_SIZE, 3 * CHUNK_SIZE);
+    assert(strstr(dump, expected));
+    assert(strstr(dump, "\nMAPPED_LIBRARIES:\n"));
+    printf("VERIFYING THE FOLDED PROFILE HAS A LINE FOR EACH STACK...\n");
+    assert(dump_profile_lines(FOLDED_PROFILE, dump, sizeof(dump)) == 3);
+    passed();
+
+    printf("FREEING THE OBJECT, REALLOCATING THE 1ST CHUNK AND CALLOCING A CHUNK...\n");
+    my_free(object);
+    void *moved = my_realloc(chunks[0], CHUNK_SIZE / 2);
+    chunks[4] = my_calloc(1, CHUNK_SIZE);
+    printf("VERIFYING THE FREED SAMPLE WAS DROPPED, THE RESIZED CHUNK MOVED AND THE NEW ONES WERE SAMPLED AND ZEROED...\n");
+    assert(moved != chunks[0] && is_sampled(moved));
+    assert(is_sampled(chunks[4]));
+    for (size_t i = 0; i < CHUNK_SIZE; i++)
+    {
+        assert(((char *)chunks[4])[i] == 0);
+    }
+    assert(live_samples() == 5);
+    passed();
+
+    printf("STOPPING THE PROFILER AND ALLOCATING 1 MORE CHUNK...\n");
+    stop_heap_profile();
+    chunks[5] = my_malloc(CHUNK_SIZE);
+    printf("VERIFYING IT WAS NOT SAMPLED...\n");
+    assert(!is_sampled(chunks[5]));
+    assert(live_samples() == 5);
+    passed();
+
+    printf("FREEING EVERYTHING...\n");
+    my_free(moved);
+    for (size_t i = 1; i < 6; i++)
+    {
+        my_free(chunks[i]);
+    }
+    printf("VERIFYING NO SAMPLES ARE LEFT AND NO CHUNK KEPT THE FLAG...\n");
+    assert(live_samples() == 0);
+    flush_thread_cache();
+    audit();
+    for (region *r = main_arena->regions; r; r = r->next)
+    {
+        for (void *chunk = region_start(r); chunk < (void *)r; chunk += chunk_size(chunk))
+        {
+            assert(!(((header *)chunk)->size_flags & CHUNK_SAMPLED));
+        }
+    }
+    passed();
+
+    use_heap(SEGREGATED_FIT, false, false);
+
+    success("ALL PROFILER TESTS PASSED");
+}
+
+void test_all()
+{
+    emphasis("RUNNING ALL TESTS");
+    test_free_chunk_reuse();
+    test_sorted_free_list();
+    test_splitting_free_chunks();
+    test_coalesce();
+    test_alternating_sequence();
+    test_worst_fit();
+    test_malloc_bad_size();
+    test_boundary_tags();
+    test_segregated_fit();
+    test_placement_policies();
+    test_heap_growth();
+    test_trim();
+    test_thread_cache();
+    test_arenas();
+    test_malloc_family();
+    test_slabs();
+    test_mapped_chunks();
+    test_hardening();
+    test_stats();
+    test_fragmentation();
+    test_size_tree();
+    test_deferred_coalescing();
+    test_batch();
+    test_scoped_regions();
+    test_options();
+    test_huge_pages();
+    test_numa();
+    test_profile();
+    success("ALL TESTS PASSED");
+}
+
+#pragma endregion Tests
+
+/* Sets standard chunk size for tests. */
+void init_tests()
+{
+    MAX_CHUNKS = 10;
+    CHUNK_SIZE = HEAP_SIZE / 20;
+
+    printf("Tests using standard chunk size of %ld\n", CHUNK_SIZE);
+    printf("This translate to a total aligned size of %ld\n", align(CHUNK_SIZE));
 }
\ No newline at end of file
@@ -1,19 +1,43 @@
-#if !defined(TESTS_H)
-#define TESTS_H
-
-extern size_t MAX_CHUNKS;
-extern size_t CHUNK_SIZE;
-
-void init_tests();
-void free_all_chunks();
-
-void test_free_chunk_reuse();
-void test_sorted_free_list();
-void test_splitting_free_chunks();
-void test_coalesce();
-void test_alternating_sequence();
-void test_worst_fit();
-void test_malloc_bad_size();
-void test_all();
-
+#if !defined(TESTS_H)
+#define TESTS_H
+
+#include "malloc_free.h"
+
+extern size_t MAX_CHUNKS;
+extern size_t CHUNK_SIZE;
+
+void init_tests();
+void free_all_chunks();
+void use_heap(placement_policy policy, bool growable, bool cached);
+
+void test_free_chunk_reuse();
+void test_sorted_free_list();
+void test_splitting_free_chunks();
+void test_coalesce();
+void test_alternating_sequence();
+void test_worst_fit();
+void test_malloc_bad_size();
+void test_boundary_tags();
+void test_segregated_fit();
+void test_placement_policies();
+void test_heap_growth();
+void test_trim();
+void test_thread_cache();
+void test_arenas();
+void test_malloc_family();
+void test_slabs();
+void test_mapped_chunks();
+void test_hardening();
+void test_stats();
+void test_fragmentation();
+void test_size_tree();
+void test_deferred_coalescing();
+void test_batch();
+void test_scoped_regions();
+void test_options();
+void test_huge_pages();
+void test_numa();
+void test_profile();
+void test_all();
+
 #endif // TESTS_H
\ No newline at end of file